@@ -0,0 +1,128 @@
+// Measure broadcasting a message to many connections.
+//
+// Each connection is one end of a socket pair registered with the poller.
+// A message is written to every connection, the poller writes it out, and
+// the other ends are drained. The shared mode queues one message on every
+// connection; the copy mode gives each connection its own copy, as a write
+// of a span does.
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <format>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "io/buffer_pool.hpp"
+#include "io/message.hpp"
+#include "io/poller.hpp"
+#include "io/tcp_socket.hpp"
+#include "io/tcp_socket_poll_handler.hpp"
+#include "utils/utils.hpp"
+
+#include "external/popl.hpp"
+
+using namespace jetblack::io;
+
+void run(bool is_shared, std::size_t connections, std::size_t message_size, std::size_t broadcasts)
+{
+  auto poller = Poller();
+
+  std::vector<std::shared_ptr<TcpSocket>> sockets;
+  std::vector<int> peers;
+  for (std::size_t i = 0; i < connections; ++i)
+  {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+      throw std::system_error(errno, std::generic_category(), "socketpair failed");
+    auto socket = std::make_shared<TcpSocket>(fds[0]);
+    socket->blocking(false);
+    poller.add_handler(std::make_unique<TcpSocketPollHandler>(socket, 8096, 8096), "local", 0);
+    sockets.push_back(socket);
+    peers.push_back(fds[1]);
+  }
+
+  std::vector<char> payload(message_size, 'x');
+  std::vector<char> scratch(message_size);
+  auto& pool = BufferPool::local();
+  auto allocations = pool.stats().allocations;
+
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < broadcasts; ++i)
+  {
+    if (is_shared)
+    {
+      auto message = Message(payload);
+      for (auto& socket : sockets)
+        poller.write(socket->fd(), message);
+    }
+    else
+    {
+      for (auto& socket : sockets)
+        poller.write(socket->fd(), payload);
+    }
+
+    poller.run_once(0);
+
+    for (auto peer : peers)
+    {
+      std::size_t received = 0;
+      while (received < message_size)
+      {
+        auto result = ::recv(peer, scratch.data(), message_size - received, 0);
+        if (result <= 0)
+          throw std::system_error(errno, std::generic_category(), "recv failed");
+        received += result;
+      }
+    }
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  auto usec = std::chrono::duration<double, std::micro>(elapsed).count() / broadcasts;
+  auto allocations_per_broadcast = static_cast<double>(pool.stats().allocations - allocations) / broadcasts;
+  print_line(std::format(
+    "{:6} connections={:6} message_size={:6} usec/broadcast={:9.2f} allocations/broadcast={:8.2f}",
+    (is_shared ? "shared" : "copy"), connections, message_size, usec, allocations_per_broadcast));
+
+  for (auto& socket : sockets)
+    socket->close();
+  for (auto peer : peers)
+    ::close(peer);
+}
+
+int main(int argc, char** argv)
+{
+  std::size_t connections = 1000;
+  std::size_t message_size = 1024;
+  std::size_t broadcasts = 1000;
+
+  popl::OptionParser op("options");
+  auto help_option = op.add<popl::Switch>("", "help", "produce help message");
+  op.add<popl::Value<std::size_t>>("c", "connections", "number of connections", connections, &connections);
+  op.add<popl::Value<std::size_t>>("m", "message-size", "size of the message", message_size, &message_size);
+  op.add<popl::Value<std::size_t>>("b", "broadcasts", "number of broadcasts", broadcasts, &broadcasts);
+
+  try
+  {
+    op.parse(argc, argv);
+    if (help_option->is_set())
+    {
+      print_line(stderr, op.help());
+      exit(1);
+    }
+
+    run(false, connections, message_size, broadcasts);
+    run(true, connections, message_size, broadcasts);
+  }
+  catch (const std::exception& error)
+  {
+    print_line(stderr, std::format("benchmark failed: {}", error.what()));
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,286 @@
+// Measure TLS handshakes per second of server cpu, and the handshake
+// latency, for each kind of certificate key, with TLS 1.2 and 1.3, and with
+// full and resumed handshakes.
+//
+// A throwaway self signed certificate is made for each kind of key, and the
+// client trusts it directly. A TLS server runs a single poller on its own
+// thread, and its cpu time is read from the thread's clock, so the rate is
+// per core. The client makes its connections one after another, and times
+// each from the connect until its handshake completes. Each connection then
+// sends a message and waits for the echo, so a TLS 1.3 client has received
+// its session ticket before it closes. The resumed cases make one full
+// handshake first, which is not counted.
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <format>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "io/message.hpp"
+#include "io/openssl_error.hpp"
+#include "io/poller.hpp"
+#include "io/ssl_ctx.hpp"
+#include "io/ssl_session_store.hpp"
+#include "io/tcp_client_socket.hpp"
+#include "io/tcp_listener_poll_handler.hpp"
+#include "io/tcp_socket_poll_handler.hpp"
+#include "utils/utils.hpp"
+
+#include "external/popl.hpp"
+
+using namespace jetblack::io;
+
+typedef std::chrono::steady_clock clock_type;
+
+struct KeyType
+{
+  std::string name;
+  std::string algorithm;
+  std::optional<std::size_t> bits;
+  std::optional<std::string> curve;
+};
+
+struct Certificate
+{
+  std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> key { nullptr, &EVP_PKEY_free };
+  std::unique_ptr<X509, decltype(&X509_free)> cert { nullptr, &X509_free };
+};
+
+// Make a key and a self signed certificate for localhost.
+Certificate make_certificate(const KeyType& key_type)
+{
+  Certificate certificate;
+
+  if (key_type.bits)
+    certificate.key.reset(EVP_PKEY_Q_keygen(nullptr, nullptr, key_type.algorithm.c_str(), *key_type.bits));
+  else if (key_type.curve)
+    certificate.key.reset(EVP_PKEY_Q_keygen(nullptr, nullptr, key_type.algorithm.c_str(), key_type.curve->c_str()));
+  else
+    certificate.key.reset(EVP_PKEY_Q_keygen(nullptr, nullptr, key_type.algorithm.c_str()));
+  if (!certificate.key)
+    throw std::runtime_error(openssl_strerror());
+
+  certificate.cert.reset(X509_new());
+  auto cert = certificate.cert.get();
+  if (
+    !cert ||
+    X509_set_version(cert, X509_VERSION_3) != 1 ||
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1) != 1 ||
+    !X509_gmtime_adj(X509_getm_notBefore(cert), 0) ||
+    !X509_gmtime_adj(X509_getm_notAfter(cert), 60 * 60 * 24) ||
+    X509_set_pubkey(cert, certificate.key.get()) != 1)
+  {
+    throw std::runtime_error(openssl_strerror());
+  }
+
+  auto name = X509_get_subject_name(cert);
+  if (
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0) != 1 ||
+    X509_set_issuer_name(cert, name) != 1)
+  {
+    throw std::runtime_error(openssl_strerror());
+  }
+
+  // Ed25519 signs without a separate digest.
+  auto digest = EVP_PKEY_get_id(certificate.key.get()) == EVP_PKEY_ED25519 ? nullptr : EVP_sha256();
+  if (X509_sign(cert, certificate.key.get(), digest) == 0)
+    throw std::runtime_error(openssl_strerror());
+
+  return certificate;
+}
+
+// The cpu time used so far by a thread.
+std::chrono::duration<double> thread_cpu_time(std::thread& thread)
+{
+  clockid_t clock;
+  if (pthread_getcpuclockid(thread.native_handle(), &clock) != 0)
+    throw std::runtime_error("failed to get the thread's clock");
+
+  timespec time;
+  if (clock_gettime(clock, &time) != 0)
+    throw std::system_error(errno, std::generic_category(), "failed to read the thread's clock");
+  return std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec);
+}
+
+void run(
+  const KeyType& key_type,
+  const Certificate& certificate,
+  int version,
+  bool is_resumed,
+  std::uint16_t port,
+  std::size_t connections)
+{
+  auto server_ctx = std::make_shared<SslServerContext>();
+  if (
+    SSL_CTX_use_certificate(server_ctx->ptr(), certificate.cert.get()) != 1 ||
+    SSL_CTX_use_PrivateKey(server_ctx->ptr(), certificate.key.get()) != 1)
+  {
+    throw std::runtime_error(openssl_strerror());
+  }
+
+  auto client_ctx = std::make_shared<SslClientContext>();
+  client_ctx->min_proto_version(version);
+  client_ctx->max_proto_version(version);
+  if (X509_STORE_add_cert(SSL_CTX_get_cert_store(client_ctx->ptr()), certificate.cert.get()) != 1)
+    throw std::runtime_error(openssl_strerror());
+  if (is_resumed)
+    client_ctx->session_store(std::make_shared<SslSessionStore>());
+
+  auto server_poller = Poller();
+  server_poller.add_handler(
+    std::make_unique<TcpListenerPollHandler>(port, std::optional<std::shared_ptr<SslContext>>(server_ctx)),
+    "127.0.0.1",
+    port);
+  server_poller.on_read = [&](int fd, RingBuffer& input)
+  {
+    server_poller.write(fd, Message(input.read(input.size())));
+  };
+  auto server_thread = std::thread([&]() { server_poller.event_loop(); });
+
+  auto poller = Poller();
+  TcpSocketPollHandler* client = nullptr;
+  bool is_echoed = false, is_closed = false, is_reused = false;
+  poller.on_read = [&](int, RingBuffer& input)
+  {
+    input.consume(input.size());
+    is_echoed = true;
+    is_reused = client->is_resumed();
+  };
+  poller.on_close = [&](int) { is_closed = true; };
+
+  // Connect, handshake, and echo a message. Returns the handshake time, or
+  // nothing if the connection failed.
+  auto connect = [&]() -> std::optional<double>
+  {
+    auto start = clock_type::now();
+
+    auto socket = std::make_shared<TcpClientSocket>();
+    socket->connect("127.0.0.1", port);
+    socket->blocking(false);
+    // As the server does, so the message is not held behind the handshake.
+    socket->set_option(IPPROTO_TCP, TCP_NODELAY, true);
+
+    auto handler = std::make_unique<TcpSocketPollHandler>(socket, client_ctx, "localhost", 8096, 8096);
+    client = handler.get();
+    std::optional<double> elapsed;
+    handler->on_handshake(
+      [&]()
+      {
+        elapsed = std::chrono::duration<double, std::micro>(clock_type::now() - start).count();
+      });
+
+    is_echoed = is_closed = is_reused = false;
+    poller.add_handler(std::move(handler), "127.0.0.1", port);
+    poller.write(socket->fd(), Message(std::span<const char>("x", 1)));
+    while (!is_echoed && !is_closed)
+      poller.run_once();
+
+    if (!is_closed)
+    {
+      poller.close(socket->fd());
+      while (!is_closed)
+        poller.run_once(0);
+    }
+    return is_echoed ? elapsed : std::nullopt;
+  };
+
+  if (is_resumed)
+    connect();
+
+  std::vector<double> times;
+  std::size_t resumed = 0, failed = 0;
+  auto cpu_start = thread_cpu_time(server_thread);
+  auto start = clock_type::now();
+  for (std::size_t i = 0; i < connections; ++i)
+  {
+    auto elapsed = connect();
+    if (!elapsed)
+    {
+      ++failed;
+      continue;
+    }
+    times.push_back(*elapsed);
+    if (is_reused)
+      ++resumed;
+  }
+  auto wall_time = std::chrono::duration<double>(clock_type::now() - start);
+  auto cpu_time = thread_cpu_time(server_thread) - cpu_start;
+
+  server_poller.stop();
+  server_thread.join();
+
+  std::sort(times.begin(), times.end());
+  auto percentile = [&](double p) { return times.empty() ? 0.0 : times[static_cast<std::size_t>(p * (times.size() - 1))]; };
+  print_line(std::format(
+    "{:10} {} {:7} handshakes/s/core={:8.0f} handshakes/s={:7.0f} p50={:7.1f}us p99={:7.1f}us resumed={}/{} failed={}",
+    key_type.name,
+    version == TLS1_3_VERSION ? "tls1.3" : "tls1.2",
+    is_resumed ? "resumed" : "full",
+    times.size() / cpu_time.count(),
+    times.size() / wall_time.count(),
+    percentile(0.5),
+    percentile(0.99),
+    resumed,
+    times.size(),
+    failed));
+}
+
+int main(int argc, char** argv)
+{
+  std::size_t connections = 500;
+  std::uint16_t port = 22300;
+
+  popl::OptionParser op("options");
+  auto help_option = op.add<popl::Switch>("", "help", "produce help message");
+  op.add<popl::Value<std::size_t>>("n", "connections", "number of connections for each case", connections, &connections);
+  op.add<popl::Value<std::uint16_t>>("p", "port", "port number", port, &port);
+  auto key_option = op.add<popl::Value<std::string>>("", "key", "only use this key type: rsa2048, rsa4096, p256 or ed25519");
+
+  try
+  {
+    op.parse(argc, argv);
+    if (help_option->is_set())
+    {
+      print_line(stderr, op.help());
+      exit(1);
+    }
+
+    for (const auto& key_type : {
+        KeyType { "rsa2048", "RSA", 2048, std::nullopt },
+        KeyType { "rsa4096", "RSA", 4096, std::nullopt },
+        KeyType { "p256", "EC", std::nullopt, "P-256" },
+        KeyType { "ed25519", "ED25519", std::nullopt, std::nullopt } })
+    {
+      if (key_option->is_set() && key_option->value() != key_type.name)
+        continue;
+
+      auto certificate = make_certificate(key_type);
+      for (auto version : { TLS1_2_VERSION, TLS1_3_VERSION })
+      {
+        for (auto is_resumed : { false, true })
+          run(key_type, certificate, version, is_resumed, port, connections);
+      }
+    }
+  }
+  catch (const std::exception& error)
+  {
+    print_line(stderr, std::format("benchmark failed: {}", error.what()));
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,222 @@
+// Measure the echo round trip time of an established TLS connection while
+// a storm of new TLS connections handshake with the same server, with the
+// handshakes run on the server's poller, on the server's poller within a
+// handshake budget, and on a handshake pool.
+//
+// The server runs a single poller on its own thread. The probe connection
+// is made before the storm, and sends the next message when the echo of the
+// last one has arrived. The storm clients connect at once, on another
+// thread, and each sends a message which is echoed once its handshake has
+// completed. The round trips are timed until every storm client has been
+// echoed.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <format>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "io/handshake_pool.hpp"
+#include "io/message.hpp"
+#include "io/poller.hpp"
+#include "io/ssl_ctx.hpp"
+#include "io/tcp_client_socket.hpp"
+#include "io/tcp_listener_poll_handler.hpp"
+#include "io/tcp_socket_poll_handler.hpp"
+#include "utils/utils.hpp"
+
+#include "external/popl.hpp"
+
+using namespace jetblack::io;
+
+typedef std::chrono::steady_clock clock_type;
+
+std::unique_ptr<TcpSocketPollHandler> connect(
+  std::shared_ptr<SslContext> ctx,
+  std::uint16_t port)
+{
+  auto socket = std::make_shared<TcpClientSocket>();
+  socket->connect("127.0.0.1", port);
+  socket->blocking(false);
+  return std::make_unique<TcpSocketPollHandler>(socket, ctx, "localhost", 8096, TcpSocketPollHandler::max_record_size);
+}
+
+// Connect the clients and wait for each to be echoed, or closed.
+void storm(
+  std::shared_ptr<SslContext> ctx,
+  std::uint16_t port,
+  std::size_t connections,
+  std::size_t& failed)
+{
+  auto poller = Poller();
+  std::size_t done = 0;
+  poller.on_read = [&](int fd, RingBuffer& input)
+  {
+    input.consume(input.size());
+    ++done;
+    poller.close(fd);
+  };
+  poller.on_error = [&]([[maybe_unused]] int fd, [[maybe_unused]] std::exception error)
+  {
+    ++failed;
+  };
+
+  std::vector<int> fds;
+  for (std::size_t i = 0; i < connections; ++i)
+  {
+    auto handler = connect(ctx, port);
+    fds.push_back(handler->fd());
+    poller.add_handler(std::move(handler), "127.0.0.1", port);
+  }
+  for (auto fd : fds)
+    poller.write(fd, Message(std::span<const char>("x", 1)));
+
+  while (done + failed < connections)
+    poller.run_once();
+}
+
+void run(
+  std::shared_ptr<SslContext> server_ctx,
+  std::shared_ptr<SslContext> client_ctx,
+  std::uint16_t port,
+  std::size_t handshake_threads,
+  std::optional<std::chrono::microseconds> handshake_budget,
+  std::size_t connections)
+{
+  auto handshake_pool = handshake_threads == 0
+    ? nullptr
+    : std::make_shared<HandshakePool>(handshake_threads);
+
+  auto server_poller = Poller();
+  server_poller.handshake_budget(handshake_budget);
+  server_poller.add_handler(
+    std::make_unique<TcpListenerPollHandler>(
+      port,
+      std::optional<std::shared_ptr<SslContext>>(server_ctx),
+      static_cast<int>(connections),
+      false,
+      TcpTimeouts {},
+      handshake_pool),
+    "127.0.0.1",
+    port);
+  server_poller.on_read = [&](int fd, RingBuffer& input)
+  {
+    server_poller.write(fd, Message(input.read(input.size())));
+  };
+  auto server_thread = std::thread([&]() { server_poller.event_loop(); });
+
+  auto message = Message(std::vector<char>(64, 'x'));
+  auto poller = Poller();
+  auto probe = connect(client_ctx, port);
+  auto probe_fd = probe->fd();
+  poller.add_handler(std::move(probe), "127.0.0.1", port);
+
+  std::atomic<bool> is_storming { false };
+  bool is_echoed = false;
+  std::vector<double> rtts;
+  std::size_t received = 0;
+  auto start = clock_type::now();
+  poller.on_read = [&](int fd, RingBuffer& input)
+  {
+    received += input.size();
+    input.consume(input.size());
+    if (received < message.size())
+      return;
+
+    received -= message.size();
+    is_echoed = true;
+    if (is_storming.load(std::memory_order_relaxed))
+      rtts.push_back(std::chrono::duration<double, std::micro>(clock_type::now() - start).count());
+    start = clock_type::now();
+    poller.write(fd, message);
+  };
+
+  // Complete the probe's handshake before the storm starts.
+  poller.write(probe_fd, message);
+  while (!is_echoed)
+    poller.run_once();
+
+  std::size_t failed = 0;
+  auto storm_start = clock_type::now();
+  is_storming = true;
+  auto storm_thread = std::thread(
+    [&]()
+    {
+      storm(client_ctx, port, connections, failed);
+      is_storming = false;
+      poller.stop();
+    });
+  poller.event_loop();
+  storm_thread.join();
+  auto storm_time = std::chrono::duration<double, std::milli>(clock_type::now() - storm_start);
+
+  server_poller.stop();
+  server_thread.join();
+  auto handshake_stats = server_poller.handshake_stats();
+
+  std::sort(rtts.begin(), rtts.end());
+  auto percentile = [&](double p) { return rtts.empty() ? 0.0 : rtts[static_cast<std::size_t>(p * (rtts.size() - 1))]; };
+  print_line(std::format(
+    "handshake_threads={} budget={:5}us storm={:7.1f}ms failed={} round_trips={:6} p50={:8.1f}us p99={:8.1f}us max={:8.1f}us queue_high_water={} mean_wait={}us",
+    handshake_threads,
+    handshake_budget ? handshake_budget->count() : 0,
+    storm_time.count(),
+    failed,
+    rtts.size(),
+    percentile(0.5),
+    percentile(0.99),
+    rtts.empty() ? 0.0 : rtts.back(),
+    handshake_stats.high_water,
+    std::chrono::duration_cast<std::chrono::microseconds>(handshake_stats.mean_wait()).count()));
+}
+
+int main(int argc, char** argv)
+{
+  std::size_t connections = 1000;
+  std::size_t handshake_threads = 2;
+  unsigned int handshake_budget = 1000;
+  std::uint16_t port = 22200;
+
+  popl::OptionParser op("options");
+  auto help_option = op.add<popl::Switch>("", "help", "produce help message");
+  op.add<popl::Value<std::size_t>>("n", "connections", "number of connections in the storm", connections, &connections);
+  op.add<popl::Value<std::size_t>>("t", "handshake-threads", "number of handshake threads", handshake_threads, &handshake_threads);
+  op.add<popl::Value<unsigned int>>("b", "handshake-budget", "microseconds of handshakes in each iteration", handshake_budget, &handshake_budget);
+  op.add<popl::Value<std::uint16_t>>("p", "port", "port number", port, &port);
+  auto certfile_option = op.add<popl::Value<std::string>>("c", "certfile", "path to certificate file");
+  auto keyfile_option = op.add<popl::Value<std::string>>("k", "keyfile", "path to key file");
+
+  try
+  {
+    op.parse(argc, argv);
+    if (help_option->is_set() || !certfile_option->is_set() || !keyfile_option->is_set())
+    {
+      print_line(stderr, op.help());
+      exit(1);
+    }
+
+    auto server_ctx = std::make_shared<SslServerContext>();
+    server_ctx->use_certificate_file(certfile_option->value());
+    server_ctx->use_private_key_file(keyfile_option->value());
+
+    // The certificate is trusted directly, so it may be self signed.
+    auto client_ctx = std::make_shared<SslClientContext>();
+    client_ctx->load_verify_locations(certfile_option->value());
+
+    run(server_ctx, client_ctx, port, 0, std::nullopt, connections);
+    run(server_ctx, client_ctx, port, 0, std::chrono::microseconds(handshake_budget), connections);
+    run(server_ctx, client_ctx, port, handshake_threads, std::nullopt, connections);
+  }
+  catch (const std::exception& error)
+  {
+    print_line(stderr, std::format("benchmark failed: {}", error.what()));
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,141 @@
+// Measure the resident memory an echo server holds for each idle
+// connection.
+//
+// The server runs separately, and its resident set is read from /proc
+// before and after the connections are made. Each connection sends a
+// message and waits for the echo, so the buffers have been used, and then
+// stays open and idle. The connections are made in small batches, as the
+// echo server has a short listen backlog.
+//
+//   echo-server -p 22000 --low-memory &
+//   idle-memory-bench -p 22000 --pid $!
+
+#include <chrono>
+#include <cstdio>
+#include <format>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "io/message.hpp"
+#include "io/poller.hpp"
+#include "io/ssl_ctx.hpp"
+#include "io/tcp_client_socket.hpp"
+#include "io/tcp_socket_poll_handler.hpp"
+#include "utils/utils.hpp"
+
+#include "external/popl.hpp"
+
+using namespace jetblack::io;
+
+// The resident set of a process in bytes, from /proc.
+std::size_t resident_set(int pid)
+{
+  std::ifstream status(std::format("/proc/{}/status", pid));
+  if (!status)
+    throw std::runtime_error(std::format("failed to open the status of process {}", pid));
+
+  std::string line;
+  while (std::getline(status, line))
+  {
+    if (line.starts_with("VmRSS:"))
+      return std::stoul(line.substr(6)) * 1024;
+  }
+  throw std::runtime_error("failed to find the resident set size");
+}
+
+int main(int argc, char** argv)
+{
+  std::uint16_t port = 22000;
+  std::size_t connections = 10000;
+  std::size_t batch = 10;
+  std::size_t message_size = 64;
+  int pid = 0;
+
+  popl::OptionParser op("options");
+  auto help_option = op.add<popl::Switch>("", "help", "produce help message");
+  op.add<popl::Value<std::uint16_t>>("p", "port", "port number", port, &port);
+  op.add<popl::Value<int>>("", "pid", "process id of the echo server", pid, &pid);
+  op.add<popl::Value<std::size_t>>("n", "connections", "number of connections", connections, &connections);
+  op.add<popl::Value<std::size_t>>("b", "batch", "connections made at once", batch, &batch);
+  op.add<popl::Value<std::size_t>>("s", "size", "message size", message_size, &message_size);
+  auto certfile_option = op.add<popl::Value<std::string>>("c", "certfile", "path to the server certificate, to connect with TLS");
+
+  try
+  {
+    op.parse(argc, argv);
+    if (help_option->is_set() || pid == 0)
+    {
+      print_line(stderr, op.help());
+      exit(1);
+    }
+
+    std::optional<std::shared_ptr<SslContext>> ssl_ctx;
+    if (certfile_option->is_set())
+    {
+      // The certificate is trusted directly, so it may be self signed.
+      auto ctx = std::make_shared<SslClientContext>();
+      ctx->load_verify_locations(certfile_option->value());
+      ssl_ctx = ctx;
+    }
+
+    auto poller = Poller();
+    std::size_t echoed = 0, closed = 0;
+    poller.on_read = [&](int, RingBuffer& input)
+    {
+      if (input.size() < message_size)
+        return;
+      input.consume(input.size());
+      ++echoed;
+    };
+    poller.on_close = [&](int) { ++closed; };
+
+    auto before = resident_set(pid);
+
+    auto message = Message(std::vector<char>(message_size, 'x'));
+    for (std::size_t made = 0; made < connections;)
+    {
+      auto count = std::min(batch, connections - made);
+      for (std::size_t i = 0; i < count; ++i)
+      {
+        auto socket = std::make_shared<TcpClientSocket>();
+        socket->connect("127.0.0.1", port);
+        socket->blocking(false);
+        auto handler = !ssl_ctx
+          ? std::make_unique<TcpSocketPollHandler>(socket, 1024, TcpSocketPollHandler::max_record_size)
+          : std::make_unique<TcpSocketPollHandler>(socket, *ssl_ctx, "localhost", 1024, TcpSocketPollHandler::max_record_size);
+        poller.add_handler(std::move(handler), "127.0.0.1", port);
+        poller.write(socket->fd(), message);
+      }
+      made += count;
+
+      while (echoed + closed < made)
+        poller.run_once();
+    }
+
+    if (closed != 0)
+      throw std::runtime_error(std::format("{} connections were closed", closed));
+
+    // Let the server settle before it is measured.
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    auto after = resident_set(pid);
+
+    print_line(std::format(
+      "{} connections={} rss_before={}KB rss_after={}KB per_connection={:.0f}B",
+      (ssl_ctx ? "tls" : "plain"),
+      connections,
+      before / 1024,
+      after / 1024,
+      static_cast<double>(after - before) / connections));
+  }
+  catch (const std::exception& error)
+  {
+    print_line(stderr, std::format("benchmark failed: {}", error.what()));
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,198 @@
+// Measure the server cpu time per gigabyte when serving a file over plain
+// TCP, user space TLS, and kernel TLS.
+//
+// The server writes the file as file regions from a poller on its own
+// thread, and the cpu time of that thread is measured, including the time
+// the kernel spends encrypting. The client reads with user space TLS on the
+// main thread. Kernel TLS needs the "tls" module and a supported cipher;
+// when either is missing the connection falls back to user space TLS, and
+// this is reported.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <format>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "io/file.hpp"
+#include "io/file_region.hpp"
+#include "io/poller.hpp"
+#include "io/ssl_ctx.hpp"
+#include "io/tcp_client_socket.hpp"
+#include "io/tcp_listener_socket.hpp"
+#include "io/tcp_socket_poll_handler.hpp"
+#include "utils/utils.hpp"
+
+#include "external/popl.hpp"
+
+using namespace jetblack::io;
+
+double thread_cpu_seconds()
+{
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+std::shared_ptr<File> make_file(std::size_t size)
+{
+  char path[] = "/tmp/ktls-bench-XXXXXX";
+  int fd = ::mkstemp(path);
+  if (fd == -1)
+    throw std::system_error(errno, std::generic_category(), "failed to create file");
+  ::unlink(path);
+  auto file = std::make_shared<File>(fd);
+
+  std::vector<char> block(65536);
+  for (std::size_t i = 0; i < block.size(); ++i)
+    block[i] = static_cast<char>(i * 7919 % 251);
+  for (std::size_t written = 0; written < size; written += block.size())
+  {
+    if (::write(fd, block.data(), std::min(block.size(), size - written)) == -1)
+      throw std::system_error(errno, std::generic_category(), "failed to write file");
+  }
+
+  return file;
+}
+
+void run(
+  const std::string& name,
+  std::optional<std::shared_ptr<SslContext>> server_ctx,
+  std::optional<std::shared_ptr<SslContext>> client_ctx,
+  std::shared_ptr<File> file,
+  std::size_t file_size,
+  std::size_t repeats)
+{
+  TcpListenerSocket listener;
+  listener.bind(htonl(INADDR_LOOPBACK), 0);
+  listener.listen();
+  sockaddr_in address;
+  socklen_t address_len = sizeof(address);
+  if (::getsockname(listener.fd(), reinterpret_cast<sockaddr*>(&address), &address_len) == -1)
+    throw std::system_error(errno, std::generic_category(), "getsockname failed");
+
+  auto client = std::make_shared<TcpClientSocket>();
+  client->connect(address);
+  std::shared_ptr<TcpSocket> server = listener.accept();
+  server->blocking(false);
+  client->blocking(false);
+
+  auto server_handler = server_ctx
+    ? std::make_unique<TcpSocketPollHandler>(server, *server_ctx, 8096, TcpSocketPollHandler::max_record_size)
+    : std::make_unique<TcpSocketPollHandler>(server, 8096, TcpSocketPollHandler::max_record_size);
+  auto server_state = server_handler.get();
+
+  auto server_poller = Poller();
+  server_poller.add_handler(std::move(server_handler), "local", 0);
+  for (std::size_t i = 0; i < repeats; ++i)
+    server_poller.write(server->fd(), FileRegion { file, 0, file_size });
+
+  double server_cpu = 0;
+  bool is_kernel_tls = false;
+  auto server_thread = std::thread(
+    [&]()
+    {
+      auto start = thread_cpu_seconds();
+      server_poller.event_loop();
+      server_cpu = thread_cpu_seconds() - start;
+      is_kernel_tls = server_state->is_kernel_tls();
+    });
+
+  auto client_handler = client_ctx
+    ? std::make_unique<TcpSocketPollHandler>(client, *client_ctx, "localhost", 65536, TcpSocketPollHandler::max_record_size)
+    : std::make_unique<TcpSocketPollHandler>(client, 65536, TcpSocketPollHandler::max_record_size);
+
+  const std::size_t total = file_size * repeats;
+  std::size_t received = 0;
+  auto poller = Poller();
+  poller.on_read = [&](int, RingBuffer& input)
+  {
+    received += input.size();
+    input.consume(input.size());
+    if (received >= total)
+      poller.stop();
+  };
+  poller.add_handler(std::move(client_handler), "local", 0);
+
+  auto start = std::chrono::steady_clock::now();
+  // A TLS client starts the handshake when it first writes.
+  if (client_ctx)
+    poller.write(client->fd(), std::vector<char> { 'x' });
+  poller.event_loop();
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  server_poller.stop();
+  server_thread.join();
+
+  auto gigabytes = total / 1e9;
+  print_line(std::format(
+    "{:10} kernel_tls={:3} server_cpu/GB={:6.3f}s throughput={:7.1f}MB/s",
+    name,
+    (is_kernel_tls ? "yes" : "no"),
+    server_cpu / gigabytes,
+    total / elapsed / 1e6));
+
+  server->close();
+  client->close();
+}
+
+int main(int argc, char** argv)
+{
+  std::size_t file_size = 64;
+  std::size_t repeats = 16;
+
+  popl::OptionParser op("options");
+  auto help_option = op.add<popl::Switch>("", "help", "produce help message");
+  op.add<popl::Value<std::size_t>>("s", "size", "file size in megabytes", file_size, &file_size);
+  op.add<popl::Value<std::size_t>>("r", "repeats", "number of times the file is sent", repeats, &repeats);
+  auto certfile_option = op.add<popl::Value<std::string>>("c", "certfile", "path to certificate file for TLS");
+  auto keyfile_option = op.add<popl::Value<std::string>>("k", "keyfile", "path to key file for TLS");
+
+  try
+  {
+    op.parse(argc, argv);
+    if (help_option->is_set())
+    {
+      print_line(stderr, op.help());
+      exit(1);
+    }
+
+    file_size *= 1024 * 1024;
+    auto file = make_file(file_size);
+
+    run("plain", std::nullopt, std::nullopt, file, file_size, repeats);
+
+    if (certfile_option->is_set() && keyfile_option->is_set())
+    {
+      // The certificate is trusted directly, so it may be self signed.
+      auto client_ctx = std::make_shared<SslClientContext>();
+      client_ctx->load_verify_locations(certfile_option->value());
+
+      for (bool use_ktls : {false, true})
+      {
+        auto server_ctx = std::make_shared<SslServerContext>();
+        server_ctx->use_certificate_file(certfile_option->value());
+        server_ctx->use_private_key_file(keyfile_option->value());
+        server_ctx->ktls(use_ktls);
+        run((use_ktls ? "kernel-tls" : "user-tls"), server_ctx, client_ctx, file, file_size, repeats);
+      }
+    }
+  }
+  catch (const std::exception& error)
+  {
+    print_line(stderr, std::format("benchmark failed: {}", error.what()));
+    return 1;
+  }
+
+  return 0;
+}
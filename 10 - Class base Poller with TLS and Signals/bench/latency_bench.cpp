@@ -0,0 +1,175 @@
+// Measure the echo round trip time with and without write through.
+//
+// The server end of a socket pair is handled by a poller on its own thread,
+// which echoes what it reads. The client end is handled by a poller on the
+// main thread, which sends the next message when the echo of the last one
+// has arrived. Only the server's write through setting is changed. With a
+// certificate and key the connection uses TLS.
+
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <format>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "io/message.hpp"
+#include "io/poller.hpp"
+#include "io/ssl_ctx.hpp"
+#include "io/tcp_socket.hpp"
+#include "io/tcp_socket_poll_handler.hpp"
+#include "utils/utils.hpp"
+
+#include "external/popl.hpp"
+
+using namespace jetblack::io;
+
+typedef std::chrono::steady_clock clock_type;
+
+std::unique_ptr<PollHandler> make_handler(
+  std::shared_ptr<TcpSocket> socket,
+  std::optional<std::shared_ptr<SslContext>> ssl_ctx,
+  bool is_client)
+{
+  if (!ssl_ctx)
+    return std::make_unique<TcpSocketPollHandler>(socket, 8096, TcpSocketPollHandler::max_record_size);
+  if (is_client)
+    return std::make_unique<TcpSocketPollHandler>(socket, *ssl_ctx, "localhost", 8096, TcpSocketPollHandler::max_record_size);
+  return std::make_unique<TcpSocketPollHandler>(socket, *ssl_ctx, 8096, TcpSocketPollHandler::max_record_size);
+}
+
+void run(
+  std::optional<std::shared_ptr<SslContext>> server_ctx,
+  std::optional<std::shared_ptr<SslContext>> client_ctx,
+  bool write_through,
+  std::size_t count,
+  std::size_t message_size)
+{
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    throw std::system_error(errno, std::generic_category(), "socketpair failed");
+  auto server = std::make_shared<TcpSocket>(fds[0]);
+  auto client = std::make_shared<TcpSocket>(fds[1]);
+  server->blocking(false);
+  client->blocking(false);
+
+  auto server_poller = Poller();
+  server_poller.write_through(write_through);
+  server_poller.on_read = [&](int fd, RingBuffer& input)
+  {
+    server_poller.write(fd, Message(input.read(input.size())));
+  };
+  server_poller.add_handler(make_handler(server, server_ctx, false), "local", 0);
+
+  auto server_thread = std::thread([&]() { server_poller.event_loop(); });
+
+  // The first messages complete any handshake and warm the caches, and are
+  // not timed.
+  const std::size_t warmup = 100;
+  auto message = Message(std::vector<char>(message_size, 'x'));
+  std::vector<double> rtts;
+  rtts.reserve(count);
+  std::size_t sent = 0, received = 0;
+  auto start = clock_type::now();
+
+  auto poller = Poller();
+  poller.on_read = [&](int fd, RingBuffer& input)
+  {
+    received += input.size();
+    input.consume(input.size());
+    if (received < message_size)
+      return;
+
+    received -= message_size;
+    if (sent > warmup)
+    {
+      auto rtt = std::chrono::duration<double, std::micro>(clock_type::now() - start);
+      rtts.push_back(rtt.count());
+    }
+
+    if (sent < count + warmup)
+    {
+      ++sent;
+      start = clock_type::now();
+      poller.write(fd, message);
+    }
+    else
+    {
+      poller.stop();
+    }
+  };
+  poller.add_handler(make_handler(client, client_ctx, true), "local", 0);
+
+  ++sent;
+  poller.write(client->fd(), message);
+  poller.event_loop();
+
+  server_poller.stop();
+  server_thread.join();
+
+  std::sort(rtts.begin(), rtts.end());
+  auto percentile = [&](double p) { return rtts[static_cast<std::size_t>(p * (rtts.size() - 1))]; };
+  print_line(std::format(
+    "{:5} write_through={:5} p50={:7.1f}us p99={:7.1f}us p99.9={:7.1f}us",
+    (server_ctx ? "tls" : "plain"), write_through, percentile(0.5), percentile(0.99), percentile(0.999)));
+
+  server->close();
+  client->close();
+}
+
+int main(int argc, char** argv)
+{
+  std::size_t count = 100000;
+  std::size_t message_size = 64;
+
+  popl::OptionParser op("options");
+  auto help_option = op.add<popl::Switch>("", "help", "produce help message");
+  op.add<popl::Value<std::size_t>>("n", "count", "number of round trips", count, &count);
+  op.add<popl::Value<std::size_t>>("s", "size", "message size", message_size, &message_size);
+  auto certfile_option = op.add<popl::Value<std::string>>("c", "certfile", "path to certificate file for TLS");
+  auto keyfile_option = op.add<popl::Value<std::string>>("k", "keyfile", "path to key file for TLS");
+
+  try
+  {
+    op.parse(argc, argv);
+    if (help_option->is_set())
+    {
+      print_line(stderr, op.help());
+      exit(1);
+    }
+
+    std::optional<std::shared_ptr<SslContext>> server_ctx;
+    std::optional<std::shared_ptr<SslContext>> client_ctx;
+    if (certfile_option->is_set() && keyfile_option->is_set())
+    {
+      auto server = std::make_shared<SslServerContext>();
+      server->use_certificate_file(certfile_option->value());
+      server->use_private_key_file(keyfile_option->value());
+      server_ctx = server;
+
+      // The certificate is trusted directly, so it may be self signed.
+      auto client = std::make_shared<SslClientContext>();
+      client->load_verify_locations(certfile_option->value());
+      client_ctx = client;
+    }
+
+    for (bool write_through : {false, true})
+    {
+      run(std::nullopt, std::nullopt, write_through, count, message_size);
+      if (server_ctx)
+        run(server_ctx, client_ctx, write_through, count, message_size);
+    }
+  }
+  catch (const std::exception& error)
+  {
+    print_line(stderr, std::format("benchmark failed: {}", error.what()));
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,319 @@
+// Measure the cost of rendering a record, the rate of log calls, and the
+// echo round trip time of a poller which logs each read, with the records
+// written on the calling thread, on a background thread, by the file
+// handler, and in the binary format.
+//
+// The text records are written to a file, a temporary one unless a path is
+// given, and those of the file handler and the binary records to files in
+// the temporary directory. The file handler rotates its file at 64MB. The
+// rate is of the calls made by the logging threads, so for the background
+// handlers it does not include the time to write the records still queued
+// when they finish, which is reported separately. The round
+// trips are made over a socket pair as in the latency benchmark, with the
+// server logging two records for each read as the echo server does.
+
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <format>
+#include <memory>
+#include <optional>
+#include <source_location>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "io/message.hpp"
+#include "io/poller.hpp"
+#include "io/tcp_socket.hpp"
+#include "io/tcp_socket_poll_handler.hpp"
+#include "logging/async_log_handler.hpp"
+#include "logging/binary_log_handler.hpp"
+#include "logging/file_log_handler.hpp"
+#include "logging/log.hpp"
+#include "utils/utils.hpp"
+
+#include "external/popl.hpp"
+
+namespace logging = jetblack::logging;
+
+using namespace jetblack::io;
+
+typedef std::chrono::steady_clock clock_type;
+
+const std::string format_string = "{time:%Y-%m-%d %X} {level:8} {message}";
+const std::string full_format_string = "{time:%Y-%m-%d %X} {level:8} {name} {message} {function} ({file}, {line})";
+
+struct Mode
+{
+  std::string name;
+  std::optional<logging::Overflow> overflow;
+  bool is_binary = false;
+  bool is_file = false;
+};
+
+std::shared_ptr<logging::LogHandler> make_handler(const Mode& mode, FILE* stream)
+{
+  if (mode.is_binary)
+    return std::make_shared<logging::BinaryLogHandler>((std::filesystem::temp_directory_path() / "log-bench.bin").string());
+  if (mode.is_file)
+  {
+    auto options = logging::FileLogOptions {};
+    options.max_size = 64 * 1024 * 1024;
+    options.max_files = 1;
+    return std::make_shared<logging::FileLogHandler>((std::filesystem::temp_directory_path() / "log-bench.log").string(), options);
+  }
+  if (!mode.overflow)
+    return std::make_shared<logging::StreamLogHandler>(stream);
+
+  auto options = logging::AsyncLogOptions {};
+  options.overflow = *mode.overflow;
+  return std::make_shared<logging::AsyncLogHandler>(
+    std::make_shared<logging::StreamLogHandler>(stream, 64 * 1024),
+    options);
+}
+
+void print_lost(const std::shared_ptr<logging::LogHandler>& handler)
+{
+  if (auto binary_handler = std::dynamic_pointer_cast<logging::BinaryLogHandler>(handler); binary_handler)
+  {
+    auto stats = binary_handler->stats();
+    print_line(std::format(
+      "    written={} dropped={} bytes={} buffers={}",
+      stats.written,
+      stats.dropped,
+      stats.bytes,
+      stats.buffers));
+    return;
+  }
+
+  if (auto file_handler = std::dynamic_pointer_cast<logging::FileLogHandler>(handler); file_handler)
+  {
+    auto stats = file_handler->stats();
+    print_line(std::format(
+      "    records={} bytes={} writes={} rotations={} fsyncs={} blocked={}",
+      stats.records,
+      stats.bytes,
+      stats.writes,
+      stats.rotations,
+      stats.fsyncs,
+      stats.blocked));
+    return;
+  }
+
+  auto async_handler = std::dynamic_pointer_cast<logging::AsyncLogHandler>(handler);
+  if (!async_handler)
+    return;
+
+  auto stats = async_handler->stats();
+  print_line(std::format(
+    "    written={} dropped={} sampled={} blocked={} high_water={}",
+    stats.written,
+    stats.dropped,
+    stats.sampled,
+    stats.blocked,
+    stats.high_water));
+}
+
+// The time for a buffered stream handler to render and hold a record.
+void run_emit(const std::string& format, FILE* stream, std::size_t count)
+{
+  auto handler = logging::StreamLogHandler(stream, 64 * 1024);
+  auto position_format = logging::make_format(format, logging::position_map);
+  auto log_record = logging::LogRecord {
+    .time = std::chrono::system_clock::now(),
+    .name = "bench",
+    .level = logging::Level::INFO,
+    .loc = std::source_location::current(),
+    .msg = std::format("on_read: received 0 0 {}", std::string(64, 'x'))
+  };
+
+  auto start = clock_type::now();
+  for (std::size_t i = 0; i < count; ++i)
+  {
+    log_record.time += std::chrono::microseconds(1);
+    handler.emit(log_record, position_format);
+  }
+  auto emit_time = std::chrono::duration<double>(clock_type::now() - start);
+
+  print_line(std::format("emit ns/record={:6.1f} format=\"{}\"", emit_time.count() * 1e9 / count, format));
+}
+
+void run_calls(const Mode& mode, FILE* stream, std::size_t threads, std::size_t count)
+{
+  auto handler = make_handler(mode, stream);
+  auto logger = logging::Logger("bench", logging::Level::INFO, format_string, handler);
+  auto payload = std::string(64, 'x');
+
+  auto start = clock_type::now();
+  std::vector<std::thread> workers;
+  for (std::size_t t = 0; t < threads; ++t)
+  {
+    workers.emplace_back(
+      [&, t]()
+      {
+        for (std::size_t i = 0; i < count; ++i)
+          logger.info("on_read: received {} {} {}", t, i, payload);
+      });
+  }
+  for (auto& worker : workers)
+    worker.join();
+  auto calls_time = std::chrono::duration<double>(clock_type::now() - start);
+  handler->flush();
+  auto total_time = std::chrono::duration<double>(clock_type::now() - start);
+
+  print_line(std::format(
+    "{:12} threads={} calls/s={:10.0f} ns/call={:6.1f} written_in={:7.1f}ms",
+    mode.name,
+    threads,
+    threads * count / calls_time.count(),
+    calls_time.count() * 1e9 / count,
+    std::chrono::duration<double, std::milli>(total_time).count()));
+  print_lost(handler);
+}
+
+void run_round_trips(const Mode& mode, FILE* stream, bool is_logging, std::size_t count)
+{
+  auto handler = make_handler(mode, stream);
+  auto logger = logging::Logger(
+    "bench",
+    is_logging ? logging::Level::INFO : logging::Level::WARNING,
+    format_string,
+    handler);
+
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    throw std::system_error(errno, std::generic_category(), "socketpair failed");
+  auto server = std::make_shared<TcpSocket>(fds[0]);
+  auto client = std::make_shared<TcpSocket>(fds[1]);
+  server->blocking(false);
+  client->blocking(false);
+
+  auto server_poller = Poller();
+  server_poller.on_read = [&](int fd, RingBuffer& input)
+  {
+    logger.info("on_read: {}", fd);
+    auto message = Message(input.read(input.size()));
+    logger.info("on_read: received {}", std::string_view(message.data(), message.size()));
+    server_poller.write(fd, message);
+  };
+  server_poller.add_handler(std::make_unique<TcpSocketPollHandler>(server, 8096, TcpSocketPollHandler::max_record_size), "local", 0);
+  auto server_thread = std::thread([&]() { server_poller.event_loop(); });
+
+  const std::size_t warmup = 100;
+  const std::size_t message_size = 64;
+  auto message = Message(std::vector<char>(message_size, 'x'));
+  std::vector<double> rtts;
+  rtts.reserve(count);
+  std::size_t sent = 0, received = 0;
+  auto start = clock_type::now();
+
+  auto poller = Poller();
+  poller.on_read = [&](int fd, RingBuffer& input)
+  {
+    received += input.size();
+    input.consume(input.size());
+    if (received < message_size)
+      return;
+
+    received -= message_size;
+    if (sent > warmup)
+      rtts.push_back(std::chrono::duration<double, std::micro>(clock_type::now() - start).count());
+
+    if (sent < count + warmup)
+    {
+      ++sent;
+      start = clock_type::now();
+      poller.write(fd, message);
+    }
+    else
+    {
+      poller.stop();
+    }
+  };
+  poller.add_handler(std::make_unique<TcpSocketPollHandler>(client, 8096, TcpSocketPollHandler::max_record_size), "local", 0);
+
+  ++sent;
+  poller.write(client->fd(), message);
+  poller.event_loop();
+
+  server_poller.stop();
+  server_thread.join();
+  handler->flush();
+
+  std::sort(rtts.begin(), rtts.end());
+  auto percentile = [&](double p) { return rtts[static_cast<std::size_t>(p * (rtts.size() - 1))]; };
+  print_line(std::format(
+    "{:12} round trips p50={:7.1f}us p99={:7.1f}us p99.9={:7.1f}us",
+    is_logging ? mode.name : "not-logging",
+    percentile(0.5),
+    percentile(0.99),
+    percentile(0.999)));
+  print_lost(handler);
+
+  server->close();
+  client->close();
+}
+
+int main(int argc, char** argv)
+{
+  std::size_t count = 200000;
+  std::size_t round_trips = 50000;
+  std::size_t max_threads = 4;
+
+  popl::OptionParser op("options");
+  auto help_option = op.add<popl::Switch>("", "help", "produce help message");
+  op.add<popl::Value<std::size_t>>("n", "count", "number of log calls by each thread", count, &count);
+  op.add<popl::Value<std::size_t>>("r", "round-trips", "number of round trips", round_trips, &round_trips);
+  op.add<popl::Value<std::size_t>>("t", "threads", "largest number of logging threads", max_threads, &max_threads);
+  auto output_option = op.add<popl::Value<std::string>>("o", "output", "file to write the records to");
+
+  try
+  {
+    op.parse(argc, argv);
+    if (help_option->is_set())
+    {
+      print_line(stderr, op.help());
+      exit(1);
+    }
+
+    auto stream = output_option->is_set()
+      ? fopen(output_option->value().c_str(), "w")
+      : tmpfile();
+    if (stream == nullptr)
+      throw std::system_error(errno, std::generic_category(), "failed to open the output");
+
+    auto modes = {
+      Mode { "sync", std::nullopt },
+      Mode { "async-block", logging::Overflow::BLOCK },
+      Mode { "async-drop", logging::Overflow::DROP },
+      Mode { "async-sample", logging::Overflow::SAMPLE },
+      Mode { "file", std::nullopt, false, true },
+      Mode { "binary", std::nullopt, true } };
+
+    run_emit(format_string, stream, count);
+    run_emit(full_format_string, stream, count);
+
+    for (std::size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+      for (const auto& mode : modes)
+        run_calls(mode, stream, threads, count);
+    }
+
+    run_round_trips(Mode { "sync", std::nullopt }, stream, false, round_trips);
+    for (const auto& mode : modes)
+      run_round_trips(mode, stream, true, round_trips);
+
+    fclose(stream);
+  }
+  catch (const std::exception& error)
+  {
+    print_line(stderr, std::format("benchmark failed: {}", error.what()));
+    return 1;
+  }
+
+  return 0;
+}
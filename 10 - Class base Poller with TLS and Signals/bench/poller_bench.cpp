@@ -0,0 +1,152 @@
+// Compare the poll and epoll multiplexers with many mostly idle connections.
+//
+// Each connection is one end of a socket pair registered with the poller,
+// with an echo handler. A small number of connections are kept active by
+// writing a message to the other end and waiting for the echo; the rest are
+// idle. The time per round trip shows how the wakeup cost scales with the
+// total number of connections.
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <format>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "io/poller.hpp"
+#include "io/poll_multiplexer.hpp"
+#include "io/epoll_multiplexer.hpp"
+#include "io/tcp_socket.hpp"
+#include "io/tcp_socket_poll_handler.hpp"
+#include "utils/utils.hpp"
+
+#include "external/popl.hpp"
+
+using namespace jetblack::io;
+
+bool ensure_fd_limit(std::size_t required)
+{
+  rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+    return false;
+  if (limit.rlim_cur >= required)
+    return true;
+  limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, required);
+  if (setrlimit(RLIMIT_NOFILE, &limit) != 0)
+    return false;
+  return limit.rlim_cur >= required;
+}
+
+double run(
+  const std::string& name,
+  std::function<std::unique_ptr<Multiplexer>()> make_multiplexer,
+  std::size_t connections,
+  std::size_t active,
+  std::size_t round_trips)
+{
+  auto poller = Poller(make_multiplexer());
+  poller.on_read = [&poller](int fd, RingBuffer& input)
+  {
+    for (auto data : input.data())
+    {
+      if (!data.empty())
+        poller.write(fd, data);
+    }
+    input.consume(input.size());
+  };
+
+  std::vector<std::shared_ptr<TcpSocket>> sockets;
+  std::vector<int> peers;
+  for (std::size_t i = 0; i < connections; ++i)
+  {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+      throw std::system_error(errno, std::generic_category(), "socketpair failed");
+    auto socket = std::make_shared<TcpSocket>(fds[0]);
+    socket->blocking(false);
+    poller.add_handler(std::make_unique<TcpSocketPollHandler>(socket, 8096, 8096), "local", 0);
+    sockets.push_back(socket);
+    peers.push_back(fds[1]);
+  }
+
+  const char message[64] = "ping";
+  char reply[64];
+
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < round_trips; ++i)
+  {
+    int peer = peers[(i % active) * (connections / active)];
+    if (::write(peer, message, sizeof(message)) != sizeof(message))
+      throw std::system_error(errno, std::generic_category(), "write failed");
+
+    // One iteration reads and enqueues the echo, the next writes it.
+    std::size_t received = 0;
+    while (received < sizeof(reply))
+    {
+      poller.run_once(-1);
+      auto result = ::recv(peer, reply + received, sizeof(reply) - received, MSG_DONTWAIT);
+      if (result > 0)
+        received += result;
+    }
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  for (auto& socket : sockets)
+    socket->close();
+  for (auto peer : peers)
+    ::close(peer);
+
+  auto usec = std::chrono::duration<double, std::micro>(elapsed).count() / round_trips;
+  print_line(std::format(
+    "{:6} connections={:6} active={:3} round_trips={:7} usec/round_trip={:9.2f}",
+    name, connections, active, round_trips, usec));
+  return usec;
+}
+
+int main(int argc, char** argv)
+{
+  std::size_t active = 10;
+  std::size_t round_trips = 10000;
+
+  popl::OptionParser op("options");
+  auto help_option = op.add<popl::Switch>("", "help", "produce help message");
+  op.add<popl::Value<std::size_t>>("a", "active", "number of active connections", active, &active);
+  op.add<popl::Value<std::size_t>>("r", "round-trips", "number of round trips per run", round_trips, &round_trips);
+
+  try
+  {
+    op.parse(argc, argv);
+    if (help_option->is_set())
+    {
+      print_line(stderr, op.help());
+      exit(1);
+    }
+
+    for (std::size_t connections : {100, 10000, 50000})
+    {
+      // Each connection uses two file descriptors.
+      if (!ensure_fd_limit(2 * connections + 64))
+      {
+        print_line(std::format("skipping {} connections: RLIMIT_NOFILE is too low", connections));
+        continue;
+      }
+
+      run("poll", [] { return std::make_unique<PollMultiplexer>(); }, connections, active, round_trips);
+#ifdef __linux__
+      run("epoll", [] { return std::make_unique<EpollMultiplexer>(); }, connections, active, round_trips);
+#endif
+    }
+  }
+  catch (const std::exception& error)
+  {
+    print_line(stderr, std::format("benchmark failed: {}", error.what()));
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,189 @@
+// Measure echo throughput as the number of reactor threads increases.
+//
+// For each thread count a reactor pool is started with a SO_REUSEPORT
+// listener per reactor. Client threads keep a message in flight on each of
+// their connections, and the number of echoed messages per second is
+// reported.
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <format>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "io/poller.hpp"
+#include "io/reactor_pool.hpp"
+#include "io/tcp_client_socket.hpp"
+#include "io/tcp_listener_poll_handler.hpp"
+#include "utils/utils.hpp"
+
+#include "external/popl.hpp"
+
+using namespace jetblack::io;
+
+std::size_t drive_connections(
+  std::uint16_t port,
+  std::size_t connections,
+  std::size_t message_size,
+  std::chrono::steady_clock::time_point deadline)
+{
+  std::vector<std::unique_ptr<TcpClientSocket>> sockets;
+  for (std::size_t i = 0; i < connections; ++i)
+  {
+    auto socket = std::make_unique<TcpClientSocket>();
+    socket->set_option(IPPROTO_TCP, TCP_NODELAY, true);
+    socket->connect("127.0.0.1", port);
+    sockets.push_back(std::move(socket));
+  }
+
+  std::vector<char> message(message_size, 'x');
+  std::vector<char> reply(message_size);
+  std::size_t messages = 0;
+
+  while (std::chrono::steady_clock::now() < deadline)
+  {
+    for (auto& socket : sockets)
+    {
+      if (::send(socket->fd(), message.data(), message.size(), 0) != static_cast<ssize_t>(message.size()))
+        throw std::system_error(errno, std::generic_category(), "send failed");
+    }
+
+    for (auto& socket : sockets)
+    {
+      std::size_t received = 0;
+      while (received < reply.size())
+      {
+        auto result = ::recv(socket->fd(), reply.data() + received, reply.size() - received, 0);
+        if (result <= 0)
+          throw std::system_error(errno, std::generic_category(), "recv failed");
+        received += result;
+      }
+      ++messages;
+    }
+  }
+
+  return messages;
+}
+
+double run(
+  std::size_t threads,
+  bool pin_cpus,
+  std::uint16_t port,
+  std::size_t connections,
+  std::size_t message_size,
+  std::chrono::seconds duration)
+{
+  auto reactors = ReactorPool(threads, pin_cpus);
+  std::atomic<std::size_t> ready = 0;
+
+  auto server = std::thread(
+    [&]()
+    {
+      reactors.run(
+        [&](Poller& poller, [[maybe_unused]] std::size_t index)
+        {
+          poller.add_handler(
+            std::make_unique<TcpListenerPollHandler>(port, std::nullopt, 128, true),
+            "0.0.0.0",
+            port);
+
+          poller.on_read = [&poller](int fd, RingBuffer& input)
+          {
+            for (auto data : input.data())
+            {
+              if (!data.empty())
+                poller.write(fd, data);
+            }
+            input.consume(input.size());
+          };
+
+          ++ready;
+        });
+    });
+
+  while (ready != threads)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + duration;
+
+  std::atomic<std::size_t> messages = 0;
+  std::vector<std::thread> clients;
+  for (std::size_t i = 0; i < threads; ++i)
+  {
+    auto count = connections / threads + (i < connections % threads ? 1 : 0);
+    clients.emplace_back(
+      [&, count]()
+      {
+        messages += drive_connections(port, count, message_size, deadline);
+      });
+  }
+  for (auto& client : clients)
+    client.join();
+
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  reactors.stop();
+  server.join();
+
+  return messages / elapsed;
+}
+
+int main(int argc, char** argv)
+{
+  std::size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+  std::size_t connections = 64;
+  std::size_t message_size = 64;
+  std::size_t seconds = 2;
+  std::uint16_t port = 22500;
+  bool pin_cpus = false;
+
+  popl::OptionParser op("options");
+  auto help_option = op.add<popl::Switch>("", "help", "produce help message");
+  op.add<popl::Value<std::size_t>>("t", "threads", "maximum number of reactor threads", max_threads, &max_threads);
+  op.add<popl::Value<std::size_t>>("c", "connections", "number of connections", connections, &connections);
+  op.add<popl::Value<std::size_t>>("s", "size", "message size", message_size, &message_size);
+  op.add<popl::Value<std::size_t>>("d", "duration", "seconds per run", seconds, &seconds);
+  op.add<popl::Value<std::uint16_t>>("p", "port", "port number", port, &port);
+  op.add<popl::Switch>("", "pin-cpus", "pin each reactor thread to a cpu", &pin_cpus);
+
+  try
+  {
+    op.parse(argc, argv);
+    if (help_option->is_set())
+    {
+      print_line(stderr, op.help());
+      exit(1);
+    }
+
+    std::vector<std::size_t> thread_counts;
+    for (std::size_t threads = 1; threads < max_threads; threads *= 2)
+      thread_counts.push_back(threads);
+    thread_counts.push_back(max_threads);
+
+    double baseline = 0;
+    for (auto threads : thread_counts)
+    {
+      auto rate = run(threads, pin_cpus, port, connections, message_size, std::chrono::seconds(seconds));
+      if (threads == 1)
+        baseline = rate;
+      print_line(std::format(
+        "threads={:3} messages/sec={:12.0f} scaling={:5.2f}",
+        threads, rate, rate / baseline));
+    }
+  }
+  catch (const std::exception& error)
+  {
+    print_line(stderr, std::format("benchmark failed: {}", error.what()));
+    return 1;
+  }
+
+  return 0;
+}
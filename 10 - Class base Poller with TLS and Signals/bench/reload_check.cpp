@@ -0,0 +1,186 @@
+// Check that a hangup reloads the TLS context of every listener while
+// several reactors are running.
+//
+// Each reactor has a listener on the shared port, as in the echo server,
+// and the reactors other than the first wake every millisecond on a timer,
+// so their waits return while signals arrive. The hangup is registered with
+// the first reactor's poller, which loads the context again and posts it to
+// each listener. A thread which blocks signals, as the other reactors do,
+// sends a hangup to the process and waits for the reload, a number of
+// times, and then checks each listener holds the last context. Any hangup
+// which is not reloaded, or is handled by another reactor, fails the check.
+
+#include <signal.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "io/poller.hpp"
+#include "io/reactor_pool.hpp"
+#include "io/ssl_ctx.hpp"
+#include "io/tcp_listener_poll_handler.hpp"
+#include "utils/utils.hpp"
+
+#include "external/popl.hpp"
+
+using namespace jetblack::io;
+
+// Wake the poller every millisecond.
+void keep_busy(Poller& poller)
+{
+  poller.schedule_after(
+    std::chrono::milliseconds(1),
+    [&poller]() { keep_busy(poller); });
+}
+
+int main(int argc, char** argv)
+{
+  std::size_t threads = 4;
+  std::size_t hangups = 100;
+  std::uint16_t port = 22300;
+
+  popl::OptionParser op("options");
+  auto help_option = op.add<popl::Switch>("", "help", "produce help message");
+  op.add<popl::Value<std::size_t>>("t", "threads", "number of reactor threads", threads, &threads);
+  op.add<popl::Value<std::size_t>>("n", "hangups", "number of hangups sent", hangups, &hangups);
+  op.add<popl::Value<std::uint16_t>>("p", "port", "port number", port, &port);
+  auto certfile_option = op.add<popl::Value<std::string>>("c", "certfile", "path to certificate file");
+  auto keyfile_option = op.add<popl::Value<std::string>>("k", "keyfile", "path to key file");
+
+  try
+  {
+    op.parse(argc, argv);
+    if (help_option->is_set() || !certfile_option->is_set() || !keyfile_option->is_set())
+    {
+      print_line(stderr, op.help());
+      exit(1);
+    }
+
+    auto load_ssl_context = [&]()
+    {
+      auto ctx = std::make_shared<SslServerContext>();
+      ctx->use_certificate_file(certfile_option->value());
+      ctx->use_private_key_file(keyfile_option->value());
+      return std::shared_ptr<SslContext>(ctx);
+    };
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<std::pair<Poller*, TcpListenerPollHandler*>> listeners;
+    std::shared_ptr<SslContext> last_ctx;
+    std::size_t reloads = 0;
+    std::atomic<std::size_t> stray { 0 };
+    bool is_passed = false;
+
+    auto reactors = ReactorPool(threads);
+
+    auto sender = std::thread(
+      [&]()
+      {
+        sigset_t signals;
+        sigfillset(&signals);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+        std::unique_lock lock(mutex);
+        changed.wait(lock, [&]() { return listeners.size() == reactors.threads(); });
+
+        std::size_t lost = 0;
+        for (std::size_t i = 0; i < hangups; ++i)
+        {
+          auto expected = reloads + 1;
+          kill(getpid(), SIGHUP);
+          if (!changed.wait_for(lock, std::chrono::seconds(1), [&]() { return reloads >= expected; }))
+          {
+            ++lost;
+            reloads = expected;
+          }
+        }
+
+        // The reloaded context is posted to each listener before the count
+        // changes, so a task posted now runs after it.
+        std::size_t updated = 0;
+        std::size_t checked = 0;
+        for (auto& [poller, listener] : listeners)
+        {
+          poller->post(
+            [&, listener]()
+            {
+              std::scoped_lock check_lock(mutex);
+              if (listener->ssl_ctx() && *listener->ssl_ctx() == last_ctx)
+                ++updated;
+              ++checked;
+              changed.notify_all();
+            });
+        }
+        changed.wait(lock, [&]() { return checked == listeners.size(); });
+
+        print_line(std::format(
+          "threads={} hangups={} reloads={} lost={} stray={} listeners updated={}/{}",
+          reactors.threads(),
+          hangups,
+          hangups - lost,
+          lost,
+          stray.load(),
+          updated,
+          listeners.size()));
+        is_passed = lost == 0 && stray == 0 && updated == listeners.size();
+        print_line(is_passed ? stdout : stderr, is_passed ? "check passed" : "check failed");
+
+        lock.unlock();
+        reactors.stop();
+      });
+
+    reactors.run(
+      [&](Poller& poller, std::size_t index)
+      {
+        auto listener = std::make_unique<TcpListenerPollHandler>(port, load_ssl_context(), 10, true);
+        auto listener_ptr = listener.get();
+        poller.add_handler(std::move(listener), "0.0.0.0", port);
+
+        if (index == 0)
+        {
+          poller.register_signal(SIGHUP);
+          poller.on_interrupt = [&]()
+          {
+            auto ctx = load_ssl_context();
+            std::scoped_lock lock(mutex);
+            for (auto& [listener_poller, listener] : listeners)
+            {
+              auto handler = listener;
+              listener_poller->post([handler, ctx]() { handler->ssl_ctx(ctx); });
+            }
+            last_ctx = ctx;
+            ++reloads;
+            changed.notify_all();
+          };
+        }
+        else
+        {
+          poller.on_interrupt = [&]() { ++stray; };
+          keep_busy(poller);
+        }
+
+        std::scoped_lock lock(mutex);
+        listeners.emplace_back(&poller, listener_ptr);
+        changed.notify_all();
+      });
+
+    sender.join();
+
+    return is_passed ? 0 : 1;
+  }
+  catch (const std::exception& error)
+  {
+    print_line(stderr, std::format("check failed: {}", error.what()));
+    return 1;
+  }
+}
@@ -0,0 +1,171 @@
+// Measure the time to connect, handshake and echo a message, with full
+// handshakes and with resumed sessions.
+//
+// An echo server runs on its own thread. The client makes its connections
+// one after another, as clients do when they reconnect after a deploy. The
+// resumed cases keep the sessions in a store keyed by endpoint, and resume
+// with a session ticket, from the server's session cache, with a ticket
+// after the server has rotated its ticket keys, and with the message sent as
+// TLS 1.3 early data.
+
+#include <chrono>
+#include <cstdio>
+#include <format>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "io/message.hpp"
+#include "io/poller.hpp"
+#include "io/ssl_ctx.hpp"
+#include "io/ssl_session_store.hpp"
+#include "io/ssl_ticket_keys.hpp"
+#include "io/tcp_client_socket.hpp"
+#include "io/tcp_listener_poll_handler.hpp"
+#include "io/tcp_socket_poll_handler.hpp"
+#include "utils/utils.hpp"
+
+#include "external/popl.hpp"
+
+using namespace jetblack::io;
+
+struct Scenario
+{
+  std::string name;
+  bool use_store;
+  bool use_tickets;
+  bool rotate_keys;
+  bool use_early_data;
+};
+
+void run(
+  const Scenario& scenario,
+  const std::string& certfile,
+  const std::string& keyfile,
+  std::uint16_t port,
+  std::size_t connections)
+{
+  auto server_ctx = std::make_shared<SslServerContext>();
+  server_ctx->use_certificate_file(certfile);
+  server_ctx->use_private_key_file(keyfile);
+  server_ctx->session_cache(connections);
+  server_ctx->tickets(scenario.use_tickets);
+  auto ticket_keys = std::make_shared<SslTicketKeys>();
+  server_ctx->ticket_keys(ticket_keys);
+  if (scenario.use_early_data)
+    server_ctx->early_data(16384);
+
+  auto client_ctx = std::make_shared<SslClientContext>();
+  client_ctx->load_verify_locations(certfile);
+  if (scenario.use_store)
+    client_ctx->session_store(std::make_shared<SslSessionStore>());
+  client_ctx->early_data(scenario.use_early_data);
+
+  auto server_poller = Poller();
+  server_poller.add_handler(
+    std::make_unique<TcpListenerPollHandler>(port, std::optional<std::shared_ptr<SslContext>>(server_ctx)),
+    "127.0.0.1",
+    port);
+  server_poller.on_read = [&](int fd, RingBuffer& input)
+  {
+    server_poller.write(fd, Message(input.read(input.size())));
+  };
+  auto server_thread = std::thread([&]() { server_poller.event_loop(); });
+
+  std::vector<double> times;
+  std::size_t resumed = 0;
+  for (std::size_t i = 0; i < connections; ++i)
+  {
+    if (scenario.rotate_keys)
+      ticket_keys->rotate();
+
+    auto start = std::chrono::steady_clock::now();
+
+    auto socket = std::make_shared<TcpClientSocket>();
+    socket->connect("127.0.0.1", port);
+    socket->blocking(false);
+
+    auto handler = std::make_unique<TcpSocketPollHandler>(socket, client_ctx, "localhost", 8096, 8096);
+    auto client = handler.get();
+
+    auto poller = Poller();
+    bool is_echoed = false;
+    poller.on_read = [&](int, RingBuffer& input)
+    {
+      input.consume(input.size());
+      is_echoed = true;
+    };
+    poller.add_handler(std::move(handler), "127.0.0.1", port);
+    poller.write(socket->fd(), Message(std::span<const char>("x", 1)));
+    while (!is_echoed && client->is_open())
+      poller.run_once();
+
+    times.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    if (client->is_resumed())
+      ++resumed;
+
+    poller.close(socket->fd());
+    poller.run_once(0);
+  }
+
+  server_poller.stop();
+  server_thread.join();
+
+  // The first connection always makes a full handshake.
+  double total = 0;
+  for (std::size_t i = 1; i < times.size(); ++i)
+    total += times[i];
+  auto server_stats = server_ctx->session_stats();
+  auto early_data_stats = server_ctx->early_data_stats();
+  print_line(std::format(
+    "{:16} mean={:7.1f}us resumed={}/{} server_hit_rate={:.3f} early_data_accepted={} rejected={}",
+    scenario.name,
+    total / (times.size() - 1),
+    resumed,
+    connections,
+    server_stats.hit_rate(),
+    early_data_stats.accepted,
+    early_data_stats.rejected));
+}
+
+int main(int argc, char** argv)
+{
+  std::size_t connections = 500;
+  std::uint16_t port = 22100;
+
+  popl::OptionParser op("options");
+  auto help_option = op.add<popl::Switch>("", "help", "produce help message");
+  op.add<popl::Value<std::size_t>>("n", "connections", "number of connections", connections, &connections);
+  op.add<popl::Value<std::uint16_t>>("p", "port", "port number", port, &port);
+  auto certfile_option = op.add<popl::Value<std::string>>("c", "certfile", "path to certificate file");
+  auto keyfile_option = op.add<popl::Value<std::string>>("k", "keyfile", "path to key file");
+
+  try
+  {
+    op.parse(argc, argv);
+    if (help_option->is_set() || !certfile_option->is_set() || !keyfile_option->is_set())
+    {
+      print_line(stderr, op.help());
+      exit(1);
+    }
+
+    for (const auto& scenario : {
+        Scenario { "full", false, true, false, false },
+        Scenario { "ticket", true, true, false, false },
+        Scenario { "session-cache", true, false, false, false },
+        Scenario { "rotated-ticket", true, true, true, false },
+        Scenario { "early-data", true, true, false, true } })
+    {
+      run(scenario, certfile_option->value(), keyfile_option->value(), port, connections);
+    }
+  }
+  catch (const std::exception& error)
+  {
+    print_line(stderr, std::format("benchmark failed: {}", error.what()));
+    return 1;
+  }
+
+  return 0;
+}
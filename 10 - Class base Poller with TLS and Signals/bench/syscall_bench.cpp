@@ -0,0 +1,152 @@
+// Count the system calls the poller makes per echoed message for each
+// multiplexer.
+//
+// The calls are counted by interposing the C library functions (and the
+// generic syscall entry used for io_uring), but only while the poller is
+// running, so the calls the benchmark makes to drive the connections are
+// excluded.
+//
+// Each message is sent before the poller runs, and its reply is collected
+// afterwards. Under io_uring a reply is sent by the next wait, along with
+// the read of the next message, so a reply can arrive an iteration late.
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <format>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "io/poller.hpp"
+#include "io/tcp_socket.hpp"
+#include "io/tcp_socket_poll_handler.hpp"
+#include "utils/utils.hpp"
+
+#include "external/popl.hpp"
+
+#include "bench/syscall_counter.hpp"
+
+using namespace jetblack::io;
+
+void run(const std::string& backend, std::size_t connections, std::size_t messages, std::size_t message_size)
+{
+  auto poller = Poller(make_multiplexer(backend));
+  std::size_t bytes_read = 0;
+  poller.on_read = [&poller, &bytes_read](int fd, RingBuffer& input)
+  {
+    bytes_read += input.size();
+    for (auto data : input.data())
+    {
+      if (!data.empty())
+        poller.write(fd, data);
+    }
+    input.consume(input.size());
+  };
+
+  std::vector<std::shared_ptr<TcpSocket>> sockets;
+  std::vector<int> peers;
+  for (std::size_t i = 0; i < connections; ++i)
+  {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+      throw std::system_error(errno, std::generic_category(), "socketpair failed");
+    auto socket = std::make_shared<TcpSocket>(fds[0]);
+    socket->blocking(false);
+    poller.add_handler(std::make_unique<TcpSocketPollHandler>(socket, 8096, 8096), "local", 0);
+    sockets.push_back(socket);
+    peers.push_back(fds[1]);
+  }
+
+  std::vector<char> message(message_size, 'x');
+  std::vector<char> reply(message_size);
+
+  // Take whatever replies have arrived on the peer.
+  std::size_t received = 0;
+  auto receive = [&](int peer)
+  {
+    ssize_t result;
+    while ((result = ::recv(peer, reply.data(), reply.size(), MSG_DONTWAIT)) > 0)
+      received += result;
+  };
+
+  syscall_counter::start();
+  syscall_counter::stop();
+  for (std::size_t i = 0; i < messages; ++i)
+  {
+    int peer = peers[i % connections];
+    if (::send(peer, message.data(), message.size(), 0) != static_cast<ssize_t>(message.size()))
+      throw std::system_error(errno, std::generic_category(), "send failed");
+
+    while (bytes_read < (i + 1) * message.size())
+    {
+      syscall_counter::resume();
+      poller.run_once(-1);
+      syscall_counter::stop();
+    }
+
+    if (i > 0)
+      receive(peers[(i - 1) % connections]);
+    receive(peer);
+  }
+
+  // Collect the replies still to be sent.
+  while (received < messages * message.size())
+  {
+    syscall_counter::resume();
+    poller.run_once(0);
+    syscall_counter::stop();
+
+    for (auto peer : peers)
+      receive(peer);
+  }
+
+  for (auto& socket : sockets)
+    socket->close();
+  for (auto peer : peers)
+    ::close(peer);
+
+  std::size_t total = syscall_counter::total().calls;
+  std::string details;
+  for (auto& [name, count] : syscall_counter::counts)
+    details += std::format(" {}={:.2f}", name, static_cast<double>(count.calls) / messages);
+  print_line(std::format(
+    "{:6} syscalls/message={:.2f} ({})",
+    backend, static_cast<double>(total) / messages, details.substr(1)));
+}
+
+int main(int argc, char** argv)
+{
+  std::size_t connections = 100;
+  std::size_t messages = 10000;
+  std::size_t message_size = 64;
+
+  popl::OptionParser op("options");
+  auto help_option = op.add<popl::Switch>("", "help", "produce help message");
+  op.add<popl::Value<std::size_t>>("c", "connections", "number of connections", connections, &connections);
+  op.add<popl::Value<std::size_t>>("m", "messages", "number of messages", messages, &messages);
+  op.add<popl::Value<std::size_t>>("s", "size", "message size", message_size, &message_size);
+
+  try
+  {
+    op.parse(argc, argv);
+    if (help_option->is_set())
+    {
+      print_line(stderr, op.help());
+      exit(1);
+    }
+
+    for (auto backend : {"poll", "epoll", "uring"})
+    {
+      run(backend, connections, messages, message_size);
+    }
+  }
+  catch (const std::exception& error)
+  {
+    print_line(stderr, std::format("benchmark failed: {}", error.what()));
+    return 1;
+  }
+
+  return 0;
+}
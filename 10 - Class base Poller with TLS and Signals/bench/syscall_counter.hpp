@@ -0,0 +1,206 @@
+#ifndef SQUAWKBUS_BENCH_SYSCALL_COUNTER_HPP
+#define SQUAWKBUS_BENCH_SYSCALL_COUNTER_HPP
+
+// Count the system calls a benchmark makes, by interposing the C library
+// functions (and the generic syscall entry used for io_uring).
+//
+// Calls are only counted between start and stop, either for a single
+// descriptor, or for every call when no descriptor is given. Calls which
+// take no descriptor, such as poll, are only counted for every call.
+//
+// The wrappers are defined here, so the header must be included by a
+// single source file in the program, which must link with libdl.
+
+#include <dlfcn.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cstdarg>
+#include <cstddef>
+#include <initializer_list>
+#include <map>
+#include <string>
+#include <type_traits>
+
+namespace syscall_counter
+{
+  struct Count
+  {
+    std::size_t calls { 0 };
+    // The bytes read or written.
+    std::size_t bytes { 0 };
+  };
+
+  inline bool is_counting = false;
+  inline int counted_fd = -1;
+  inline std::map<std::string, Count> counts;
+
+  // Start counting, from zero, the calls on the descriptor, or every call
+  // for -1.
+  inline void start(int fd = -1)
+  {
+    counts.clear();
+    counted_fd = fd;
+    is_counting = true;
+  }
+
+  // Stop counting. The counts are kept until the next start.
+  inline void stop()
+  {
+    is_counting = false;
+  }
+
+  // Resume counting without clearing the counts.
+  inline void resume()
+  {
+    is_counting = true;
+  }
+
+  // The total of the named calls.
+  inline Count total(std::initializer_list<const char*> names)
+  {
+    Count sum;
+    for (auto name : names)
+    {
+      if (auto i = counts.find(name); i != counts.end())
+      {
+        sum.calls += i->second.calls;
+        sum.bytes += i->second.bytes;
+      }
+    }
+    return sum;
+  }
+
+  // The total of all the calls.
+  inline Count total()
+  {
+    Count sum;
+    for (auto& [name, count] : counts)
+    {
+      sum.calls += count.calls;
+      sum.bytes += count.bytes;
+    }
+    return sum;
+  }
+
+  inline void count(const char* name)
+  {
+    if (is_counting && counted_fd == -1)
+      ++counts[name].calls;
+  }
+
+  inline ssize_t count(const char* name, int fd, ssize_t result)
+  {
+    if (is_counting && (counted_fd == -1 || fd == counted_fd))
+    {
+      auto& count = counts[name];
+      ++count.calls;
+      if (result > 0)
+        count.bytes += static_cast<std::size_t>(result);
+    }
+    return result;
+  }
+
+  template<typename Func>
+  Func next(const char* name)
+  {
+    static_assert(std::is_pointer_v<Func>);
+    return reinterpret_cast<Func>(dlsym(RTLD_NEXT, name));
+  }
+}
+
+extern "C"
+{
+  ssize_t read(int fd, void* buf, size_t count)
+  {
+    static auto real = syscall_counter::next<decltype(&::read)>("read");
+    return syscall_counter::count("read", fd, real(fd, buf, count));
+  }
+
+  ssize_t write(int fd, const void* buf, size_t count)
+  {
+    static auto real = syscall_counter::next<decltype(&::write)>("write");
+    return syscall_counter::count("write", fd, real(fd, buf, count));
+  }
+
+  ssize_t readv(int fd, const iovec* iov, int iovcnt)
+  {
+    static auto real = syscall_counter::next<decltype(&::readv)>("readv");
+    return syscall_counter::count("readv", fd, real(fd, iov, iovcnt));
+  }
+
+  ssize_t writev(int fd, const iovec* iov, int iovcnt)
+  {
+    static auto real = syscall_counter::next<decltype(&::writev)>("writev");
+    return syscall_counter::count("writev", fd, real(fd, iov, iovcnt));
+  }
+
+  ssize_t recv(int fd, void* buf, size_t len, int flags)
+  {
+    static auto real = syscall_counter::next<decltype(&::recv)>("recv");
+    return syscall_counter::count("recv", fd, real(fd, buf, len, flags));
+  }
+
+  ssize_t send(int fd, const void* buf, size_t len, int flags)
+  {
+    static auto real = syscall_counter::next<decltype(&::send)>("send");
+    return syscall_counter::count("send", fd, real(fd, buf, len, flags));
+  }
+
+  ssize_t recvmsg(int fd, msghdr* msg, int flags)
+  {
+    static auto real = syscall_counter::next<decltype(&::recvmsg)>("recvmsg");
+    return syscall_counter::count("recvmsg", fd, real(fd, msg, flags));
+  }
+
+  ssize_t sendmsg(int fd, const msghdr* msg, int flags)
+  {
+    static auto real = syscall_counter::next<decltype(&::sendmsg)>("sendmsg");
+    return syscall_counter::count("sendmsg", fd, real(fd, msg, flags));
+  }
+
+  int poll(pollfd* fds, nfds_t nfds, int timeout)
+  {
+    static auto real = syscall_counter::next<decltype(&::poll)>("poll");
+    syscall_counter::count("poll");
+    return real(fds, nfds, timeout);
+  }
+
+  int epoll_wait(int epfd, epoll_event* events, int maxevents, int timeout)
+  {
+    static auto real = syscall_counter::next<decltype(&::epoll_wait)>("epoll_wait");
+    syscall_counter::count("epoll_wait");
+    return real(epfd, events, maxevents, timeout);
+  }
+
+  int epoll_ctl(int epfd, int op, int fd, epoll_event* event)
+  {
+    static auto real = syscall_counter::next<decltype(&::epoll_ctl)>("epoll_ctl");
+    syscall_counter::count("epoll_ctl");
+    return real(epfd, op, fd, event);
+  }
+
+  long syscall(long number, ...)
+  {
+    static auto real = syscall_counter::next<long (*)(long, ...)>("syscall");
+
+    va_list args;
+    va_start(args, number);
+    long a[6];
+    for (auto& arg : a)
+      arg = va_arg(args, long);
+    va_end(args);
+
+#ifdef __NR_io_uring_enter
+    if (number == __NR_io_uring_enter)
+      syscall_counter::count("io_uring_enter");
+#endif
+    return real(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+  }
+}
+
+#endif // SQUAWKBUS_BENCH_SYSCALL_COUNTER_HPP
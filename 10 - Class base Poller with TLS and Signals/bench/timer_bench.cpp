@@ -0,0 +1,92 @@
+// Measure the timer wheel with a large number of pending timers.
+//
+// Timers are scheduled with random delays of up to ten minutes, half of
+// them are cancelled, and the wheel is advanced through the remainder in
+// one millisecond steps for a while. The cost per operation should not
+// depend on the number of pending timers.
+
+#include <chrono>
+#include <cstdio>
+#include <format>
+#include <random>
+#include <vector>
+
+#include "io/timer_wheel.hpp"
+#include "utils/utils.hpp"
+
+#include "external/popl.hpp"
+
+using namespace jetblack::io;
+
+template <typename Func>
+double nsec_per_op(std::size_t count, Func&& func)
+{
+  auto start = std::chrono::steady_clock::now();
+  func();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, std::nano>(elapsed).count() / count;
+}
+
+void run(std::size_t timers, std::size_t steps)
+{
+  auto start = TimerWheel::clock_type::now();
+  TimerWheel wheel(start);
+  std::mt19937_64 rng(timers);
+  std::uniform_int_distribution<long> delay(1, 600000);
+  std::size_t fired = 0;
+
+  std::vector<TimerWheel::timer_id> ids;
+  ids.reserve(timers);
+
+  auto schedule = nsec_per_op(timers, [&]() {
+    for (std::size_t i = 0; i < timers; ++i)
+    {
+      ids.push_back(wheel.schedule_at(
+        start + std::chrono::milliseconds(delay(rng)),
+        [&fired]() { ++fired; }));
+    }
+  });
+
+  auto cancel = nsec_per_op(timers / 2, [&]() {
+    for (std::size_t i = 0; i < timers; i += 2)
+      wheel.cancel(ids[i]);
+  });
+
+  auto advance = nsec_per_op(steps, [&]() {
+    for (std::size_t i = 1; i <= steps; ++i)
+      wheel.advance(start + std::chrono::milliseconds(i));
+  });
+
+  print_line(std::format(
+    "timers={:8} nsec/schedule={:7.1f} nsec/cancel={:7.1f} nsec/advance={:9.1f} fired={}",
+    timers, schedule, cancel, advance, fired));
+}
+
+int main(int argc, char** argv)
+{
+  std::size_t steps = 10000;
+
+  popl::OptionParser op("options");
+  auto help_option = op.add<popl::Switch>("", "help", "produce help message");
+  op.add<popl::Value<std::size_t>>("s", "steps", "number of millisecond steps to advance", steps, &steps);
+
+  try
+  {
+    op.parse(argc, argv);
+    if (help_option->is_set())
+    {
+      print_line(stderr, op.help());
+      exit(1);
+    }
+
+    for (std::size_t timers : {1000, 100000, 1000000})
+      run(timers, steps);
+  }
+  catch (const std::exception& error)
+  {
+    print_line(stderr, std::format("benchmark failed: {}", error.what()));
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,275 @@
+// Measure the TLS receive throughput, and the read system calls made by the
+// receiver, with and without read ahead.
+//
+// The server and client ends of a socket pair are both handled by the
+// poller, and the server writes to the client. The bulk case queues the
+// whole transfer at once, so full sized records arrive back to back. The
+// message case writes one message at a time, and waits for it to arrive,
+// as an interactive connection does. The calls are counted by interposing
+// the C library functions, for the client's descriptor only.
+//
+// The baseline client reads through an SSL BIO pushed over a socket BIO, as
+// the stream did before it drove the SSL connection itself, without read
+// ahead. Each BIO read returns at most one record, and the handler reads
+// until the BIO asks to retry.
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/bio.h>
+#include <openssl/ssl.h>
+
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <format>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "io/message.hpp"
+#include "io/poller.hpp"
+#include "io/ssl_ctx.hpp"
+#include "io/tcp_socket.hpp"
+#include "io/tcp_socket_poll_handler.hpp"
+#include "utils/utils.hpp"
+
+#include "external/popl.hpp"
+
+#include "bench/syscall_counter.hpp"
+
+using namespace jetblack::io;
+
+// The client end of the connection, read through a chain of BIOs.
+class BioClientPollHandler : public PollHandler
+{
+private:
+  std::shared_ptr<TcpSocket> socket_;
+  BIO* bio_;
+  RingBuffer input_;
+  std::deque<Message> writes_;
+  std::size_t offset_ { 0 };
+
+public:
+  BioClientPollHandler(std::shared_ptr<TcpSocket> socket, SslContext& ssl_ctx, std::size_t read_bufsiz)
+    : socket_(socket),
+      bio_(BIO_new_ssl(ssl_ctx.ptr(), 1)),
+      input_(read_bufsiz)
+  {
+    BIO_push(bio_, BIO_new_socket(socket_->fd(), BIO_NOCLOSE));
+  }
+  ~BioClientPollHandler() override
+  {
+    // The socket is closed, so no close notify is sent.
+    SSL* ssl = nullptr;
+    BIO_get_ssl(bio_, &ssl);
+    SSL_set_quiet_shutdown(ssl, 1);
+    BIO_free_all(bio_);
+  }
+  BioClientPollHandler(const BioClientPollHandler&) = delete;
+  BioClientPollHandler& operator=(const BioClientPollHandler&) = delete;
+
+  void attach([[maybe_unused]] Poller& poller) override {}
+  void detach([[maybe_unused]] Poller& poller) override {}
+  bool is_listener() const noexcept override { return false; }
+  int fd() const noexcept override { return socket_->fd(); }
+  bool is_open() const noexcept override { return socket_->is_open(); }
+  bool want_read() const noexcept override { return is_open() && !input_.full(); }
+  bool want_write() const noexcept override
+  {
+    return is_open() && (!writes_.empty() || BIO_should_write(bio_));
+  }
+
+  bool read([[maybe_unused]] Poller& poller) override
+  {
+    while (is_open() && !input_.full())
+    {
+      auto buf = input_.free_space()[0];
+      std::size_t nbytes_read = 0;
+      if (BIO_read_ex(bio_, buf.data(), buf.size(), &nbytes_read) == 0)
+      {
+        if (!BIO_should_retry(bio_))
+          socket_->is_open(false);
+        break;
+      }
+      input_.commit(nbytes_read);
+    }
+    return is_open();
+  }
+
+  bool write() override
+  {
+    while (is_open() && !writes_.empty())
+    {
+      auto& message = writes_.front();
+      std::size_t written = 0;
+      if (BIO_write_ex(bio_, message.data() + offset_, message.size() - offset_, &written) == 0)
+      {
+        if (!BIO_should_retry(bio_))
+          socket_->is_open(false);
+        break;
+      }
+      offset_ += written;
+      if (offset_ == message.size())
+      {
+        writes_.pop_front();
+        offset_ = 0;
+      }
+    }
+    return is_open();
+  }
+
+  void close() override { socket_->is_open(false); }
+
+  void enqueue(Message message) noexcept override
+  {
+    if (!message.empty())
+      writes_.push_back(std::move(message));
+  }
+
+  RingBuffer& input() noexcept override { return input_; }
+};
+
+struct Scenario
+{
+  std::string name;
+  bool read_ahead;
+  std::size_t read_buffer_size;
+  bool is_bio_chain { false };
+};
+
+void run(
+  const Scenario& scenario,
+  const std::string& certfile,
+  const std::string& keyfile,
+  std::size_t megabytes,
+  std::size_t messages,
+  std::size_t message_size)
+{
+  auto server_ctx = std::make_shared<SslServerContext>();
+  server_ctx->use_certificate_file(certfile);
+  server_ctx->use_private_key_file(keyfile);
+
+  // The certificate is trusted directly, so it may be self signed.
+  auto client_ctx = std::make_shared<SslClientContext>();
+  client_ctx->load_verify_locations(certfile);
+  client_ctx->read_ahead(scenario.read_ahead);
+  if (scenario.read_buffer_size != 0)
+    client_ctx->read_buffer_size(scenario.read_buffer_size);
+
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    throw std::system_error(errno, std::generic_category(), "socketpair failed");
+  auto server = std::make_shared<TcpSocket>(fds[0]);
+  auto client = std::make_shared<TcpSocket>(fds[1]);
+  server->blocking(false);
+  client->blocking(false);
+
+  auto poller = Poller();
+  poller.add_handler(
+    std::make_unique<TcpSocketPollHandler>(server, server_ctx, 8096, TcpSocketPollHandler::max_record_size),
+    "local", 0);
+  if (scenario.is_bio_chain)
+  {
+    poller.add_handler(std::make_unique<BioClientPollHandler>(client, *client_ctx, 65536), "local", 0);
+  }
+  else
+  {
+    poller.add_handler(
+      std::make_unique<TcpSocketPollHandler>(client, client_ctx, "localhost", 65536, TcpSocketPollHandler::max_record_size),
+      "local", 0);
+  }
+
+  std::size_t received = 0;
+  poller.on_read = [&](int fd, RingBuffer& input)
+  {
+    if (fd == client->fd())
+      received += input.size();
+    input.consume(input.size());
+  };
+
+  // A TLS client starts the handshake when it first writes. The first
+  // message completes the handshake, and is not counted.
+  poller.write(client->fd(), std::vector<char> { 'x' });
+  poller.write(server->fd(), std::vector<char> { 'x' });
+  while (received < 1)
+    poller.run_once(-1);
+
+  // The bulk transfer.
+  auto chunk = Message(std::vector<char>(TcpSocketPollHandler::max_record_size, 'x'));
+  auto total = megabytes * 1024 * 1024;
+  received = 0;
+  syscall_counter::start(client->fd());
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t sent = 0; sent < total; sent += chunk.size())
+    poller.write(server->fd(), chunk);
+  while (received < total)
+    poller.run_once(-1);
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+  syscall_counter::stop();
+  auto bulk_calls = syscall_counter::total({ "read", "readv", "recv", "recvmsg" }).calls;
+
+  // The messages, one at a time.
+  auto message = Message(std::vector<char>(message_size, 'x'));
+  syscall_counter::start(client->fd());
+  for (std::size_t i = 0; i < messages; ++i)
+  {
+    received = 0;
+    poller.write(server->fd(), message);
+    while (received < message_size)
+      poller.run_once(-1);
+  }
+  syscall_counter::stop();
+  auto message_calls = syscall_counter::total({ "read", "readv", "recv", "recvmsg" }).calls;
+
+  print_line(std::format(
+    "{:18} bulk={:7.1f}MB/s reads/MB={:7.1f} reads/message={:5.2f}",
+    scenario.name,
+    megabytes / elapsed.count(),
+    static_cast<double>(bulk_calls) / megabytes,
+    static_cast<double>(message_calls) / messages));
+
+  server->close();
+  client->close();
+}
+
+int main(int argc, char** argv)
+{
+  std::size_t megabytes = 256;
+  std::size_t messages = 10000;
+  std::size_t message_size = 1024;
+
+  popl::OptionParser op("options");
+  auto help_option = op.add<popl::Switch>("", "help", "produce help message");
+  op.add<popl::Value<std::size_t>>("m", "megabytes", "size of the bulk transfer", megabytes, &megabytes);
+  op.add<popl::Value<std::size_t>>("n", "messages", "number of messages", messages, &messages);
+  op.add<popl::Value<std::size_t>>("s", "size", "message size", message_size, &message_size);
+  auto certfile_option = op.add<popl::Value<std::string>>("c", "certfile", "path to certificate file");
+  auto keyfile_option = op.add<popl::Value<std::string>>("k", "keyfile", "path to key file");
+
+  try
+  {
+    op.parse(argc, argv);
+    if (help_option->is_set() || !certfile_option->is_set() || !keyfile_option->is_set())
+    {
+      print_line(stderr, op.help());
+      exit(1);
+    }
+
+    for (const auto& scenario : {
+        Scenario { "bio-chain", false, 0, true },
+        Scenario { "no-read-ahead", false, 0 },
+        Scenario { "read-ahead", true, 0 },
+        Scenario { "read-ahead-64k", true, 65536 } })
+    {
+      run(scenario, certfile_option->value(), keyfile_option->value(), megabytes, messages, message_size);
+    }
+  }
+  catch (const std::exception& error)
+  {
+    print_line(stderr, std::format("benchmark failed: {}", error.what()));
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,158 @@
+// Count the write system calls and the bytes on the wire per message when
+// bursts of small messages are queued on a connection, as a chat server
+// does when several clients send at once.
+//
+// The server and client ends of a socket pair are both handled by the
+// poller. The calls are counted by interposing the C library functions, for
+// the server's descriptor only. With a certificate and key the connection
+// uses TLS, and the bytes include the record overhead.
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <format>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "io/message.hpp"
+#include "io/poller.hpp"
+#include "io/ssl_ctx.hpp"
+#include "io/tcp_socket.hpp"
+#include "io/tcp_socket_poll_handler.hpp"
+#include "utils/utils.hpp"
+
+#include "external/popl.hpp"
+
+#include "bench/syscall_counter.hpp"
+
+using namespace jetblack::io;
+
+void run(
+  std::optional<std::shared_ptr<SslContext>> server_ctx,
+  std::optional<std::shared_ptr<SslContext>> client_ctx,
+  std::size_t burst,
+  std::size_t bursts,
+  std::size_t message_size)
+{
+  auto poller = Poller();
+
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    throw std::system_error(errno, std::generic_category(), "socketpair failed");
+  auto server = std::make_shared<TcpSocket>(fds[0]);
+  auto client = std::make_shared<TcpSocket>(fds[1]);
+  server->blocking(false);
+  client->blocking(false);
+
+  if (server_ctx)
+  {
+    poller.add_handler(
+      std::make_unique<TcpSocketPollHandler>(server, *server_ctx, 8096, TcpSocketPollHandler::max_record_size),
+      "local", 0);
+    poller.add_handler(
+      std::make_unique<TcpSocketPollHandler>(client, *client_ctx, "localhost", 8096, TcpSocketPollHandler::max_record_size),
+      "local", 0);
+  }
+  else
+  {
+    poller.add_handler(
+      std::make_unique<TcpSocketPollHandler>(server, 8096, TcpSocketPollHandler::max_record_size),
+      "local", 0);
+    poller.add_handler(
+      std::make_unique<TcpSocketPollHandler>(client, 8096, TcpSocketPollHandler::max_record_size),
+      "local", 0);
+  }
+
+  std::size_t received = 0;
+  poller.on_read = [&](int fd, RingBuffer& input)
+  {
+    if (fd == client->fd())
+      received += input.size();
+    input.consume(input.size());
+  };
+
+  auto message = Message(std::vector<char>(message_size, 'x'));
+
+  auto send_burst = [&]()
+  {
+    received = 0;
+    for (std::size_t i = 0; i < burst; ++i)
+      poller.write(server->fd(), message);
+    while (received < burst * message_size)
+      poller.run_once(-1);
+  };
+
+  // A TLS client starts the handshake when it first writes. The first burst
+  // completes the handshake, and is not counted.
+  poller.write(client->fd(), std::vector<char> { 'x' });
+  send_burst();
+
+  syscall_counter::start(server->fd());
+  for (std::size_t i = 0; i < bursts; ++i)
+    send_burst();
+  syscall_counter::stop();
+  auto writes = syscall_counter::total({ "write", "writev", "send", "sendmsg" });
+
+  auto messages = static_cast<double>(burst * bursts);
+  print_line(std::format(
+    "{:5} burst={:4} message_size={:5} writes/message={:7.3f} bytes/message={:8.2f}",
+    (server_ctx ? "tls" : "plain"), burst, message_size, writes.calls / messages, writes.bytes / messages));
+
+  server->close();
+  client->close();
+}
+
+int main(int argc, char** argv)
+{
+  std::size_t bursts = 1000;
+  std::size_t message_size = 64;
+
+  popl::OptionParser op("options");
+  auto help_option = op.add<popl::Switch>("", "help", "produce help message");
+  op.add<popl::Value<std::size_t>>("b", "bursts", "number of bursts", bursts, &bursts);
+  op.add<popl::Value<std::size_t>>("s", "size", "message size", message_size, &message_size);
+  auto certfile_option = op.add<popl::Value<std::string>>("c", "certfile", "path to certificate file for TLS");
+  auto keyfile_option = op.add<popl::Value<std::string>>("k", "keyfile", "path to key file for TLS");
+
+  try
+  {
+    op.parse(argc, argv);
+    if (help_option->is_set())
+    {
+      print_line(stderr, op.help());
+      exit(1);
+    }
+
+    std::optional<std::shared_ptr<SslContext>> server_ctx;
+    std::optional<std::shared_ptr<SslContext>> client_ctx;
+    if (certfile_option->is_set() && keyfile_option->is_set())
+    {
+      auto server = std::make_shared<SslServerContext>();
+      server->use_certificate_file(certfile_option->value());
+      server->use_private_key_file(keyfile_option->value());
+      server_ctx = server;
+
+      // The certificate is trusted directly, so it may be self signed.
+      auto client = std::make_shared<SslClientContext>();
+      client->load_verify_locations(certfile_option->value());
+      client_ctx = client;
+    }
+
+    for (std::size_t burst : {1, 8, 64})
+    {
+      run(std::nullopt, std::nullopt, burst, bursts, message_size);
+      if (server_ctx)
+        run(server_ctx, client_ctx, burst, bursts, message_size);
+    }
+  }
+  catch (const std::exception& error)
+  {
+    print_line(stderr, std::format("benchmark failed: {}", error.what()));
+    return 1;
+  }
+
+  return 0;
+}
@@ -1,11 +1,13 @@
 #include <signal.h>
 
+#include <chrono>
 #include <format>
 #include <set>
 
 #include "io/poller.hpp"
 #include "io/tcp_listener_poll_handler.hpp"
 #include "io/ssl_ctx.hpp"
+#include "io/ssl_ticket_keys.hpp"
 #include "logging/log.hpp"
 #include "utils/utils.hpp"
 
@@ -15,12 +17,31 @@ namespace logging = jetblack::logging;
 
 using namespace jetblack::io;
 
-std::shared_ptr<SslContext> make_ssl_context(const std::string& certfile, const std::string& keyfile)
+TcpTimeouts make_timeouts(
+  std::shared_ptr<popl::Value<unsigned int>> idle_option,
+  std::shared_ptr<popl::Value<unsigned int>> handshake_option,
+  std::shared_ptr<popl::Value<unsigned int>> write_option)
+{
+  TcpTimeouts timeouts;
+  if (idle_option->is_set())
+    timeouts.idle = std::chrono::seconds(idle_option->value());
+  if (handshake_option->is_set())
+    timeouts.handshake = std::chrono::seconds(handshake_option->value());
+  if (write_option->is_set())
+    timeouts.write_stall = std::chrono::seconds(write_option->value());
+  return timeouts;
+}
+
+std::shared_ptr<SslContext> make_ssl_context(
+  const std::string& certfile,
+  const std::string& keyfile,
+  std::shared_ptr<SslTicketKeys> ticket_keys)
 {
   auto ctx = std::make_shared<SslServerContext>();
   ctx->min_proto_version(TLS1_2_VERSION);
   ctx->use_certificate_file(certfile);
   ctx->use_private_key_file(keyfile);
+  ctx->ticket_keys(ticket_keys);
   return ctx;
 }
 
@@ -34,6 +55,10 @@ int main(int argc, char** argv)
   op.add<popl::Value<decltype(port)>>("p", "port", "port number", port, &port);
   auto certfile_option = op.add<popl::Value<std::string>>("c", "certfile", "path to certificate file");
   auto keyfile_option = op.add<popl::Value<std::string>>("k", "keyfile", "path to key file");
+  auto backend_option = op.add<popl::Value<std::string>>("b", "backend", "event multiplexer (poll, epoll or uring)");
+  auto idle_option = op.add<popl::Value<unsigned int>>("", "idle-timeout", "seconds before an idle connection is closed");
+  auto handshake_option = op.add<popl::Value<unsigned int>>("", "handshake-timeout", "seconds allowed for the TLS handshake");
+  auto write_option = op.add<popl::Value<unsigned int>>("", "write-timeout", "seconds before a connection which accepts no writes is closed");
 
   try
   {
@@ -51,12 +76,16 @@ int main(int argc, char** argv)
     }
 
     logging::info(
-      std::format(
-        "starting chat server on port {}{}.",
-        static_cast<int>(port),
-        (use_tls ? " with TLS" : "")));
+      "starting chat server on port {}{}.",
+      static_cast<int>(port),
+      (use_tls ? " with TLS" : ""));
+
+    auto timeouts = make_timeouts(idle_option, handshake_option, write_option);
 
     std::optional<std::shared_ptr<SslContext>> ssl_ctx;
+    // The ticket keys outlive the context, so tickets stay valid when it is
+    // reloaded.
+    auto ticket_keys = std::make_shared<SslTicketKeys>();
 
     if (use_tls)
     {
@@ -72,58 +101,77 @@ int main(int argc, char** argv)
     		std::cout << op << "\n";
         exit(1);
       }
-      ssl_ctx = make_ssl_context(certfile_option->value(), keyfile_option->value());
+      ssl_ctx = make_ssl_context(certfile_option->value(), keyfile_option->value(), ticket_keys);
     }
 
-    auto poller = Poller();
+    auto poller = backend_option->is_set()
+      ? Poller(make_multiplexer(backend_option->value()))
+      : Poller();
 
-    poller.add_handler(
-      std::make_unique<TcpListenerPollHandler>(port, ssl_ctx),
-      "0.0.0.0",
-      port);
+    auto listener = std::make_unique<TcpListenerPollHandler>(port, ssl_ctx, 10, false, timeouts);
+    auto& listener_ref = *listener;
+    poller.add_handler(std::move(listener), "0.0.0.0", port);
 
     std::set<int> clients;
 
     poller.on_open = [&clients](int fd, const std::string& host, std::uint16_t port)
     {
-      logging::info(std::format("Add client {} ({}:{})", fd, host, port));
+      logging::info("Add client {} ({}:{})", fd, host, port);
       clients.insert(fd);
     };
     poller.on_close = [&clients](int fd)
     {
-      logging::info(std::format("Removing client {}", fd));
+      logging::info("Removing client {}", fd);
       clients.erase(fd);
     };
-    poller.on_read = [&poller, &clients](int fd, std::vector<std::vector<char>>&& bufs)
+    poller.on_read = [&poller, &clients](int fd, RingBuffer& input)
     {
-      logging::info(std::format("Read from client {}", fd));
+      logging::info("Read from client {}", fd);
 
-      for (auto& buf : bufs)
+      // The message is shared by all the clients.
+      auto message = Message(input.read(input.size()));
+      logging::info("received {}", to_string(message.span()));
+      for (auto client_fd : clients)
       {
-        logging::info(std::format("received {}", to_string(buf)));
-        for (auto client_fd : clients)
+        if (client_fd != fd)
         {
-          if (client_fd != fd)
-          {
-            logging::info(std::format("sending to {}", client_fd));
-            poller.write(client_fd, buf);
-          }
+          logging::info("sending to {}", client_fd);
+          poller.write(client_fd, message);
         }
       }
     };
     poller.on_error = [](int fd, std::exception error)
     {
-      logging::info(std::format("Error from client {}: {}", fd, error.what()));
+      logging::info("Error from client {}: {}", fd, error.what());
     };
 
+    // A hangup reloads the certificate and key. New connections use them,
+    // and those already made keep the context they were made with.
     poller.register_signal(SIGHUP);
-    poller.on_interrupt = []() { logging::info("interrupt!!!"); };
+    poller.on_interrupt = [&]()
+    {
+      if (!ssl_ctx)
+      {
+        logging::info("interrupt!!!");
+        return;
+      }
+
+      logging::info("reloading the tls context");
+      try
+      {
+        listener_ref.ssl_ctx(make_ssl_context(certfile_option->value(), keyfile_option->value(), ticket_keys));
+      }
+      catch (const std::exception& error)
+      {
+        logging::error("failed to reload the tls context, keeping the current one: {}", error.what());
+      }
+    };
 
     poller.event_loop();
   }
   catch(const std::exception& error)
   {
-    logging::error(std::format("Server failed: {}", error.what()));
+    logging::error("Server failed: {}", error.what());
   }
 
   return 0;
@@ -16,6 +16,7 @@
 #include "io/tcp_socket_poll_handler.hpp"
 #include "io/tcp_stream.hpp"
 #include "io/ssl_ctx.hpp"
+#include "io/ssl_session_store.hpp"
 #include "logging/log.hpp"
 #include "utils/match.hpp"
 #include "utils/utils.hpp"
@@ -25,7 +26,7 @@
 using namespace jetblack::io;
 namespace logging = jetblack::logging;
 
-std::shared_ptr<SslContext> make_ssl_context(std::optional<std::string> capath)
+std::shared_ptr<SslContext> make_ssl_context(std::optional<std::string> capath, bool use_early_data)
 {
   print_line("making ssl client context");
   auto ctx = std::make_shared<SslClientContext>();
@@ -43,6 +44,13 @@ std::shared_ptr<SslContext> make_ssl_context(std::optional<std::string> capath)
   print_line("require ssl verification");
   ctx->verify();
 
+  // Sessions are kept for the life of the process, so a reconnect (see
+  // --reconnect) to the same endpoint resumes them.
+  ctx->session_store(std::make_shared<SslSessionStore>());
+  // On a resumed connection the first message is sent with the hello. Only
+  // a reconnect can resume, so this has no effect on the first connection.
+  ctx->early_data(use_early_data);
+
   return ctx;
 }
 
@@ -65,54 +73,56 @@ private:
 
   void on_open([[maybe_unused]] Poller& poller, int fd, const std::string& host, std::uint16_t port) override
   {
-    logging::info(std::format("on_open: {} ({}:{})", fd, host, port));
+    logging::info("on_open: {} ({}:{})", fd, host, port);
   }
 
   void on_close([[maybe_unused]] Poller& poller, int fd) override
   {
-    logging::info(std::format("on_close: {}", fd));
+    logging::info("on_close: {}", fd);
   }
 
-  void on_read(Poller& poller, int fd, std::vector<std::vector<char>>&& bufs) override
+  void on_read(Poller& poller, int fd, RingBuffer& input) override
   {
-    logging::info(std::format("on_read: {}", fd));
+    logging::info("on_read: {}", fd);
 
-    for (auto& buf : bufs)
+    auto message = Message(input.read(input.size()));
+    std::string s {message.begin(), message.end()};
+    logging::info("on_read: received {}", s);
+    if (fd == STDIN_FILENO)
     {
-      std::string s {buf.begin(), buf.end()};
-      logging::info(std::format("on_read: received {}", s));
-      if (fd == STDIN_FILENO)
+      if (s == "CLOSE\n")
       {
-        if (s == "CLOSE\n")
-        {
-          poller.close(client_fd_);
-        }
-        else
-        {
-          poller.write(client_fd_, buf);
-        }
+        poller.close(client_fd_);
       }
-      else if (fd == client_fd_)
+      else
       {
-        poller.write(STDOUT_FILENO, buf);
+        poller.write(client_fd_, message);
       }
     }
+    else if (fd == client_fd_)
+    {
+      poller.write(STDOUT_FILENO, message);
+    }
   }
 
   void on_error([[maybe_unused]] Poller& poller, int fd, std::exception error) override
   {
-    logging::info(std::format("on_error: {}, {}", fd, error.what()));
+    logging::info("on_error: {}, {}", fd, error.what());
   }
 };
 
 int main(int argc, char** argv)
 {
   bool use_tls = false;
+  bool use_early_data = false;
+  bool use_reconnect = false;
   std::uint16_t port = 22000;
   std::string host = "localhost";
 
   popl::OptionParser op("options");
   op.add<popl::Switch>("s", "ssl", "Connect with TLS", &use_tls);
+  op.add<popl::Switch>("", "early-data", "Send the first message as TLS 1.3 early data when resuming (with --reconnect)", &use_early_data);
+  op.add<popl::Switch>("", "reconnect", "After the connection closes, reconnect with the next line typed", &use_reconnect);
   auto help_option = op.add<popl::Switch>("", "help", "produce help message");
   op.add<popl::Value<decltype(port)>>("p", "port", "port number", port, &port);
   op.add<popl::Value<decltype(host)>>("h", "host", "host name or ip address (use fqdn for tls)", host, &host);
@@ -140,35 +150,46 @@ int main(int argc, char** argv)
       std::optional<std::string> capath;
       if (capath_option->is_set())
         capath = capath_option->value();
-      ssl_ctx = make_ssl_context(capath);
+      ssl_ctx = make_ssl_context(capath, use_early_data);
     }
 
-    print_line(std::format(
-      "connecting to host {} on port {}{}.",
-      host,
-      port,
-      (use_tls ? " using tls" : "")));
-
-    auto client_socket = std::make_shared<TcpClientSocket>();
-    client_socket->connect(host, port);
-    client_socket->blocking(false);
-
     auto poller = Poller();
 
-    if (!ssl_ctx)
-    {
-      poller.add_handler(
-        std::make_unique<TcpSocketPollHandler>(client_socket, 8096, 8096),
-        host,
-        port);
-    }
-    else
+    // The connection to the server, or -1 once it has closed.
+    int client_fd = -1;
+
+    // Connect to the server. The context, with its session store, is kept
+    // between connections, so a reconnect resumes the session.
+    auto connect = [&]()
     {
-      poller.add_handler(
-        std::make_unique<TcpSocketPollHandler>(client_socket, *ssl_ctx, host, 8096, 8096),
+      print_line(std::format(
+        "connecting to host {} on port {}{}.",
         host,
-        port);
-    }
+        port,
+        (use_tls ? " using tls" : "")));
+
+      auto client_socket = std::make_shared<TcpClientSocket>();
+      client_socket->connect(host, port);
+      client_socket->blocking(false);
+      client_fd = client_socket->fd();
+
+      if (!ssl_ctx)
+      {
+        poller.add_handler(
+          std::make_unique<TcpSocketPollHandler>(client_socket, 8096, 8096),
+          host,
+          port);
+      }
+      else
+      {
+        poller.add_handler(
+          std::make_unique<TcpSocketPollHandler>(client_socket, *ssl_ctx, host, 8096, 8096),
+          host,
+          port);
+      }
+    };
+
+    connect();
 
     auto console_input = std::make_shared<File>(STDIN_FILENO, O_RDONLY);
     console_input->blocking(false);
@@ -178,37 +199,62 @@ int main(int argc, char** argv)
     console_output->blocking(false);
     poller.add_handler(std::make_unique<FilePollHandler>(console_output, 1024, 1024), "localhost", 2);
 
-    poller.on_read = [&poller, &client_socket](int fd, std::vector<std::vector<char>>&& bufs)
+    poller.on_read = [&poller, &client_fd, &connect, use_reconnect](int fd, RingBuffer& input)
     {
-      logging::info(std::format("on_read: {}", fd));
+      logging::info("on_read: {}", fd);
 
-      for (auto& buf : bufs)
+      auto message = Message(input.read(input.size()));
+      std::string s {message.begin(), message.end()};
+      logging::info("on_read: received {}", s);
+      if (fd == STDIN_FILENO)
       {
-        std::string s {buf.begin(), buf.end()};
-        logging::info(std::format("on_read: received {}", s));
-        if (fd == STDIN_FILENO)
+        if (s == "CLOSE\n")
         {
-          if (s == "CLOSE\n")
-          {
-            poller.close(client_socket->fd());
-          }
-          else
-          {
-            poller.write(client_socket->fd(), buf);
-          }
+          if (client_fd != -1)
+            poller.close(client_fd);
         }
-        else if (fd == client_socket->fd())
+        else
         {
-          poller.write(STDOUT_FILENO, buf);
+          // The message is queued before the handshake completes, so it
+          // is sent as early data when the session allows it.
+          if (client_fd == -1 && use_reconnect)
+            connect();
+          if (client_fd != -1)
+            poller.write(client_fd, message);
         }
       }
+      else if (fd == client_fd)
+      {
+        poller.write(STDOUT_FILENO, message);
+      }
+    };
+
+    poller.on_close = [&client_fd, &ssl_ctx](int fd)
+    {
+      if (fd != client_fd)
+        return;
+
+      logging::info("on_close: {}", fd);
+      client_fd = -1;
+
+      if (ssl_ctx)
+      {
+        auto stats = (*ssl_ctx)->session_stats();
+        auto early_data_stats = (*ssl_ctx)->early_data_stats();
+        logging::info(
+          "tls sessions: handshakes={} resumed={} early_data_accepted={} early_data_rejected={}",
+          stats.handshakes,
+          stats.resumed,
+          early_data_stats.accepted,
+          early_data_stats.rejected);
+      }
     };
 
     poller.event_loop();
   }
   catch(const std::exception& error)
   {
-    logging::error(std::format("Server failed: {}", error.what()));
+    logging::error("Server failed: {}", error.what());
   }
   catch (...)
   {
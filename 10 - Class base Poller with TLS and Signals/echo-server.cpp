@@ -1,10 +1,22 @@
+#include <signal.h>
+
 #include <cstdio>
+#include <chrono>
 #include <format>
+#include <functional>
+#include <mutex>
 #include <set>
+#include <vector>
 
+#include "io/handshake_pool.hpp"
 #include "io/poller.hpp"
+#include "io/reactor_pool.hpp"
 #include "io/tcp_listener_poll_handler.hpp"
 #include "io/ssl_ctx.hpp"
+#include "io/ssl_ticket_keys.hpp"
+#include "logging/async_log_handler.hpp"
+#include "logging/binary_log_handler.hpp"
+#include "logging/file_log_handler.hpp"
 #include "logging/log.hpp"
 #include "utils/utils.hpp"
 
@@ -14,15 +26,272 @@ namespace logging = jetblack::logging;
 
 using namespace jetblack::io;
 
-std::shared_ptr<SslContext> make_ssl_context(const std::string& certfile, const std::string& keyfile)
+// Log the buffer pool statistics of the reactor's thread periodically.
+void log_pool_stats(Poller& poller, std::size_t index, std::chrono::seconds interval)
+{
+  poller.schedule_after(
+    interval,
+    [&poller, index, interval]()
+    {
+      const auto& stats = BufferPool::local().stats();
+      logging::info(
+        "reactor {} buffers: allocations={} hit_rate={:.3f} in_use={} high_water={} cached={}",
+        index,
+        stats.allocations,
+        stats.hit_rate(),
+        stats.bytes_in_use,
+        stats.high_water,
+        stats.bytes_cached);
+      log_pool_stats(poller, index, interval);
+    });
+}
+
+// Log the handshakes held back by the budget of each reactor periodically.
+void log_handshake_stats(Poller& poller, std::size_t index, std::chrono::seconds interval)
+{
+  poller.schedule_after(
+    interval,
+    [&poller, index, interval]()
+    {
+      auto stats = poller.handshake_stats();
+      logging::info(
+        "reactor {} handshakes: deferred={} queued={} high_water={} mean_wait={}us max_wait={}us",
+        index,
+        stats.deferred,
+        stats.queued,
+        stats.high_water,
+        std::chrono::duration_cast<std::chrono::microseconds>(stats.mean_wait()).count(),
+        std::chrono::duration_cast<std::chrono::microseconds>(stats.max_wait).count());
+      log_handshake_stats(poller, index, interval);
+    });
+}
+
+// Log the TLS session resumption counts of the listener's context
+// periodically. The counts start again when the context is reloaded.
+void log_session_stats(Poller& poller, TcpListenerPollHandler& listener, std::chrono::seconds interval)
+{
+  poller.schedule_after(
+    interval,
+    [&poller, &listener, interval]()
+    {
+      auto& ctx = *listener.ssl_ctx();
+      auto stats = ctx->session_stats();
+      auto early_data_stats = ctx->early_data_stats();
+      logging::info(
+        "tls sessions: handshakes={} resumed={} hit_rate={:.3f} misses={} timeouts={} cache_full={} early_data_accepted={} early_data_rejected={}",
+        stats.handshakes,
+        stats.resumed,
+        stats.hit_rate(),
+        stats.misses,
+        stats.timeouts,
+        stats.cache_full,
+        early_data_stats.accepted,
+        early_data_stats.rejected);
+      log_session_stats(poller, listener, interval);
+    });
+}
+
+// Rotate the session ticket keys periodically. Tickets encrypted with the
+// previous keys can still be resumed.
+void rotate_ticket_keys(Poller& poller, std::shared_ptr<SslTicketKeys> keys, std::chrono::seconds interval)
+{
+  poller.schedule_after(
+    interval,
+    [&poller, keys, interval]()
+    {
+      logging::info("rotating session ticket keys");
+      keys->rotate();
+      rotate_ticket_keys(poller, keys, interval);
+    });
+}
+
+// Log the records written and lost by the asynchronous log handler
+// periodically.
+void log_logging_stats(Poller& poller, std::shared_ptr<logging::AsyncLogHandler> handler, std::chrono::seconds interval)
+{
+  poller.schedule_after(
+    interval,
+    [&poller, handler, interval]()
+    {
+      auto stats = handler->stats();
+      logging::info(
+        "log records: written={} dropped={} sampled={} blocked={} high_water={}",
+        stats.written,
+        stats.dropped,
+        stats.sampled,
+        stats.blocked,
+        stats.high_water);
+      log_logging_stats(poller, handler, interval);
+    });
+}
+
+// Log the records and writes of the file log handler periodically.
+void log_logging_stats(Poller& poller, std::shared_ptr<logging::FileLogHandler> handler, std::chrono::seconds interval)
+{
+  poller.schedule_after(
+    interval,
+    [&poller, handler, interval]()
+    {
+      auto stats = handler->stats();
+      logging::info(
+        "log file: records={} bytes={} writes={} rotations={} fsyncs={} blocked={} errors={}",
+        stats.records,
+        stats.bytes,
+        stats.writes,
+        stats.rotations,
+        stats.fsyncs,
+        stats.blocked,
+        stats.errors);
+      log_logging_stats(poller, handler, interval);
+    });
+}
+
+// Write the log records on a background thread, for the root logger and
+// the library's logger.
+std::shared_ptr<logging::AsyncLogHandler> use_async_logging(const std::string& overflow)
+{
+  auto options = logging::AsyncLogOptions {};
+  if (overflow == "block")
+    options.overflow = logging::Overflow::BLOCK;
+  else if (overflow == "drop")
+    options.overflow = logging::Overflow::DROP;
+  else if (overflow == "sample")
+    options.overflow = logging::Overflow::SAMPLE;
+  else
+    throw std::runtime_error(std::format("unknown log overflow \"{}\"", overflow));
+
+  auto handler = std::make_shared<logging::AsyncLogHandler>(
+    std::make_shared<logging::StreamLogHandler>(stderr, 64 * 1024),
+    options);
+  logging::log_handler(handler);
+  jetblack::io::log.log_handler(handler);
+  return handler;
+}
+
+// Write the log records to a file in the binary format, for the root logger
+// and the library's logger. The file is read with logdecode.
+void use_binary_logging(const std::string& path)
+{
+  auto handler = std::make_shared<logging::BinaryLogHandler>(path);
+  logging::log_handler(handler);
+  jetblack::io::log.log_handler(handler);
+}
+
+// Write the log records to a file, which is rotated by size or age, for
+// the loggers of the log manager and the library's logger.
+std::shared_ptr<logging::FileLogHandler> use_file_logging(
+  const std::string& path,
+  std::size_t rotate_size,
+  unsigned int rotate_age,
+  const std::string& fsync)
+{
+  auto options = logging::FileLogOptions {};
+  options.max_size = rotate_size * 1024 * 1024;
+  options.max_age = std::chrono::seconds(rotate_age);
+  if (fsync == "never")
+    options.fsync = logging::Fsync::NEVER;
+  else if (fsync == "rotate")
+    options.fsync = logging::Fsync::ROTATE;
+  else if (fsync == "interval")
+    options.fsync = logging::Fsync::INTERVAL;
+  else if (fsync == "batch")
+    options.fsync = logging::Fsync::BATCH;
+  else
+    throw std::runtime_error(std::format("unknown log fsync policy \"{}\"", fsync));
+
+  auto handler = std::make_shared<logging::FileLogHandler>(path, options);
+  logging::log_handler(handler);
+  jetblack::io::log.log_handler(handler);
+  return handler;
+}
+
+// The listener of each reactor, with the task queue of its poller, so a
+// reloaded TLS context can be handed to each on its own thread.
+struct Listeners
+{
+  std::mutex mutex;
+  std::vector<std::pair<std::weak_ptr<TaskQueue>, TcpListenerPollHandler*>> items;
+};
+
+// Load the certificate and key again, and give the new context to every
+// listener. New connections use it, and those already made keep the
+// context they were made with. The ticket keys are shared by the contexts,
+// so sessions still resume.
+void reload_ssl_context(Listeners& listeners, const std::function<std::shared_ptr<SslContext>()>& load)
+{
+  std::shared_ptr<SslContext> ctx;
+  try
+  {
+    ctx = load();
+  }
+  catch (const std::exception& error)
+  {
+    logging::error("failed to reload the tls context, keeping the current one: {}", error.what());
+    return;
+  }
+
+  std::scoped_lock lock(listeners.mutex);
+  for (auto& [tasks, listener] : listeners.items)
+  {
+    if (auto queue = tasks.lock(); queue)
+    {
+      auto handler = listener;
+      queue->post([handler, ctx]() { handler->ssl_ctx(ctx); });
+    }
+  }
+  logging::info("reloaded the tls context");
+}
+
+TcpTimeouts make_timeouts(
+  std::shared_ptr<popl::Value<unsigned int>> idle_option,
+  std::shared_ptr<popl::Value<unsigned int>> handshake_option,
+  std::shared_ptr<popl::Value<unsigned int>> write_option)
+{
+  TcpTimeouts timeouts;
+  if (idle_option->is_set())
+    timeouts.idle = std::chrono::seconds(idle_option->value());
+  if (handshake_option->is_set())
+    timeouts.handshake = std::chrono::seconds(handshake_option->value());
+  if (write_option->is_set())
+    timeouts.write_stall = std::chrono::seconds(write_option->value());
+  return timeouts;
+}
+
+std::shared_ptr<SslContext> make_ssl_context(
+  const std::string& certfile,
+  const std::string& keyfile,
+  bool use_ktls,
+  bool is_low_memory,
+  std::optional<std::size_t> session_cache,
+  std::shared_ptr<SslTicketKeys> ticket_keys,
+  std::uint32_t early_data)
 {
   logging::info("making ssl server context");
   auto ctx = std::make_shared<SslServerContext>();
   ctx->min_proto_version(TLS1_2_VERSION);
-  logging::info(std::format("Adding certificate file \"{}\"", certfile));
+  if (use_ktls)
+  {
+    logging::info("enabling kernel TLS");
+    ctx->ktls(true);
+  }
+  if (is_low_memory)
+    ctx->release_buffers(true);
+  logging::info("Adding certificate file \"{}\"", certfile);
   ctx->use_certificate_file(certfile);
-  logging::info(std::format("Adding key file \"{}\"", keyfile));
+  logging::info("Adding key file \"{}\"", keyfile);
   ctx->use_private_key_file(keyfile);
+  if (session_cache)
+  {
+    logging::info("setting the session cache size to {}", *session_cache);
+    ctx->session_cache(*session_cache);
+  }
+  if (ticket_keys)
+    ctx->ticket_keys(ticket_keys);
+  if (early_data != 0)
+  {
+    logging::info("accepting up to {} bytes of early data", early_data);
+    ctx->early_data(early_data);
+  }
   return ctx;
 }
 
@@ -31,13 +300,41 @@ int main(int argc, char** argv)
   // signal(SIGPIPE,SIG_IGN);
 
   bool use_tls = false;
+  bool use_ktls = false;
+  bool pin_cpus = false;
+  bool is_low_memory = false;
+  bool use_dynamic_records = false;
   uint16_t port = 22000;
+  std::size_t threads = 1;
+  std::size_t handshake_threads = 0;
+  unsigned int handshake_budget = 0;
   popl::OptionParser op("options");
   op.add<popl::Switch>("s", "ssl", "Connect with TLS", &use_tls);
+  op.add<popl::Switch>("", "ktls", "use kernel TLS when available", &use_ktls);
   auto help_option = op.add<popl::Switch>("", "help", "produce help message");
   op.add<popl::Value<decltype(port)>>("p", "port", "port number", port, &port);
   auto certfile_option = op.add<popl::Value<std::string>>("c", "certfile", "path to certificate file");
   auto keyfile_option = op.add<popl::Value<std::string>>("k", "keyfile", "path to key file");
+  auto backend_option = op.add<popl::Value<std::string>>("b", "backend", "event multiplexer (poll, epoll or uring)");
+  auto idle_option = op.add<popl::Value<unsigned int>>("", "idle-timeout", "seconds before an idle connection is closed");
+  auto handshake_option = op.add<popl::Value<unsigned int>>("", "handshake-timeout", "seconds allowed for the TLS handshake");
+  auto write_option = op.add<popl::Value<unsigned int>>("", "write-timeout", "seconds before a connection which accepts no writes is closed");
+  auto stats_option = op.add<popl::Value<unsigned int>>("", "stats-interval", "seconds between buffer pool and tls session statistics");
+  auto session_cache_option = op.add<popl::Value<std::size_t>>("", "session-cache", "number of tls sessions cached, or 0 for none");
+  auto ticket_rotation_option = op.add<popl::Value<unsigned int>>("", "ticket-rotation", "seconds between tls session ticket key rotations");
+  auto early_data_option = op.add<popl::Value<std::uint32_t>>("", "early-data", "bytes of tls 1.3 early data accepted from resuming clients", 0);
+  auto async_logging_option = op.add<popl::Value<std::string>>("", "async-logging", "write log records on a background thread, and block, drop or sample when it falls behind");
+  auto binary_log_option = op.add<popl::Value<std::string>>("", "binary-log", "write log records to this file in the binary format");
+  auto log_file_option = op.add<popl::Value<std::string>>("", "log-file", "write log records to this file");
+  auto log_rotate_size_option = op.add<popl::Value<std::size_t>>("", "log-rotate-size", "megabytes at which the log file is rotated, or 0 for never", 0);
+  auto log_rotate_age_option = op.add<popl::Value<unsigned int>>("", "log-rotate-age", "seconds after which the log file is rotated, or 0 for never", 0);
+  auto log_fsync_option = op.add<popl::Value<std::string>>("", "log-fsync", "when the log file is synced: never, rotate, interval or batch", "rotate");
+  op.add<popl::Value<decltype(threads)>>("t", "threads", "number of reactor threads", threads, &threads);
+  op.add<popl::Value<decltype(handshake_threads)>>("", "handshake-threads", "number of threads for tls handshakes, or 0 to handshake on the reactors", handshake_threads, &handshake_threads);
+  op.add<popl::Value<decltype(handshake_budget)>>("", "handshake-budget", "microseconds of tls handshakes in each reactor iteration, or 0 for no limit", handshake_budget, &handshake_budget);
+  op.add<popl::Switch>("", "pin-cpus", "pin each reactor thread to a cpu", &pin_cpus);
+  op.add<popl::Switch>("", "low-memory", "free the buffers of idle connections", &is_low_memory);
+  op.add<popl::Switch>("", "dynamic-records", "start tls writes with small records", &use_dynamic_records);
 
   try
   {
@@ -54,13 +351,30 @@ int main(int argc, char** argv)
       exit(1);
     }
 
+    std::shared_ptr<logging::AsyncLogHandler> async_log_handler;
+    std::shared_ptr<logging::FileLogHandler> file_log_handler;
+    if (binary_log_option->is_set())
+      use_binary_logging(binary_log_option->value());
+    else if (log_file_option->is_set())
+      file_log_handler = use_file_logging(
+        log_file_option->value(),
+        log_rotate_size_option->value(),
+        log_rotate_age_option->value(),
+        log_fsync_option->value());
+    else if (async_logging_option->is_set())
+      async_log_handler = use_async_logging(async_logging_option->value());
+
     logging::info(
-      std::format(
-        "starting echo server on port {}{}.",
-        static_cast<int>(port),
-        (use_tls ? " with TLS" : "")));
+      "starting echo server on port {}{} with {} thread(s).",
+      static_cast<int>(port),
+      (use_tls ? " with TLS" : ""),
+      threads);
+
+    auto timeouts = make_timeouts(idle_option, handshake_option, write_option);
 
     std::optional<std::shared_ptr<SslContext>> ssl_ctx;
+    std::shared_ptr<SslTicketKeys> ticket_keys;
+    std::function<std::shared_ptr<SslContext>()> load_ssl_context;
 
     if (use_tls)
     {
@@ -76,53 +390,127 @@ int main(int argc, char** argv)
         print_line(stderr, op.help());
         exit(1);
       }
-      ssl_ctx = make_ssl_context(certfile_option->value(), keyfile_option->value());
+      std::optional<std::size_t> session_cache;
+      if (session_cache_option->is_set())
+        session_cache = session_cache_option->value();
+      // The ticket keys outlive the context, so tickets stay valid when it
+      // is reloaded.
+      ticket_keys = std::make_shared<SslTicketKeys>();
+      load_ssl_context = [=]()
+      {
+        return make_ssl_context(
+          certfile_option->value(),
+          keyfile_option->value(),
+          use_ktls,
+          is_low_memory,
+          session_cache,
+          ticket_keys,
+          early_data_option->value());
+      };
+      ssl_ctx = load_ssl_context();
     }
 
-    auto poller = Poller();
-
-    poller.add_handler(
-      std::make_unique<TcpListenerPollHandler>(port, ssl_ctx),
-      "0.0.0.0",
-      port);
+    Listeners listeners;
 
-    poller.on_open = [](int fd, const std::string& host, std::uint16_t port) {
-      logging::info(std::format("on_open: {}:{} (P{})", host, port, fd));
-    };
-    poller.on_close = [](int fd) {
-      logging::info(std::format("on_close: {}", fd));
+    auto make_poller_multiplexer = [&backend_option]()
+    {
+      return backend_option->is_set()
+        ? make_multiplexer(backend_option->value())
+        : make_default_multiplexer();
     };
-    poller.on_read = [&poller](int fd, std::vector<std::vector<char>>&& bufs) {
-      logging::info(std::format("on_read: {}", fd));
 
-      for (auto& buf : bufs)
+    // The handshake pool hands connections back to the reactors, so it is
+    // made first and stopped last.
+    std::shared_ptr<HandshakePool> handshake_pool;
+    if (ssl_ctx && handshake_threads > 0)
+    {
+      logging::info("running tls handshakes on {} thread(s)", handshake_threads);
+      handshake_pool = std::make_shared<HandshakePool>(handshake_threads, make_poller_multiplexer);
+    }
+
+    auto reactors = ReactorPool(threads, pin_cpus, make_poller_multiplexer);
+
+    reactors.run([&](Poller& poller, std::size_t index) {
+
+      if (stats_option->is_set())
+        log_pool_stats(poller, index, std::chrono::seconds(stats_option->value()));
+
+      // The log handler is shared, so only the first reactor reports.
+      if (index == 0 && async_log_handler && stats_option->is_set())
+        log_logging_stats(poller, async_log_handler, std::chrono::seconds(stats_option->value()));
+      if (index == 0 && file_log_handler && stats_option->is_set())
+        log_logging_stats(poller, file_log_handler, std::chrono::seconds(stats_option->value()));
+
+      // Handshakes on the reactor wait behind established connections.
+      if (ssl_ctx && handshake_budget > 0)
       {
-        std::string s {buf.begin(), buf.end()};
-        logging::info(std::format("on_read: received {}", s));
+        poller.handshake_budget(std::chrono::microseconds(handshake_budget));
+        if (stats_option->is_set())
+          log_handshake_stats(poller, index, std::chrono::seconds(stats_option->value()));
+      }
+
+      // Each reactor has its own listener on the shared port.
+      auto listener = std::make_unique<TcpListenerPollHandler>(port, ssl_ctx, 10, reactors.threads() > 1, timeouts, handshake_pool);
+      listener->low_memory(is_low_memory);
+      if (use_dynamic_records)
+        listener->record_sizing(TlsRecordSizing {});
+      auto& listener_ref = *listener;
+      {
+        std::scoped_lock lock(listeners.mutex);
+        listeners.items.emplace_back(poller.tasks(), listener.get());
+      }
+      poller.add_handler(std::move(listener), "0.0.0.0", port);
+
+      // The context is shared, so only the first reactor reports, rotates
+      // and reloads. The hangup belongs to the first reactor's poller.
+      if (index == 0 && ssl_ctx && stats_option->is_set())
+        log_session_stats(poller, listener_ref, std::chrono::seconds(stats_option->value()));
+      if (index == 0 && ssl_ctx && ticket_rotation_option->is_set())
+        rotate_ticket_keys(poller, ticket_keys, std::chrono::seconds(ticket_rotation_option->value()));
+      if (index == 0 && ssl_ctx)
+      {
+        poller.register_signal(SIGHUP);
+        poller.on_interrupt = [&listeners, &load_ssl_context]()
+        {
+          logging::info("reloading the tls context");
+          reload_ssl_context(listeners, load_ssl_context);
+        };
+      }
+
+      poller.on_open = [](int fd, const std::string& host, std::uint16_t port) {
+        logging::info("on_open: {}:{} (P{})", host, port, fd);
+      };
+      poller.on_close = [](int fd) {
+        logging::info("on_close: {}", fd);
+      };
+      poller.on_read = [&poller](int fd, RingBuffer& input) {
+        logging::info("on_read: {}", fd);
+
+        auto message = Message(input.read(input.size()));
+        std::string s {message.begin(), message.end()};
+        logging::info("on_read: received {}", s);
         if (s == "KILLME")
         {
-          logging::info(std::format("closing {}", fd));
+          logging::info("closing {}", fd);
           poller.close(fd);
         }
         else
         {
-          poller.write(fd, buf);
+          poller.write(fd, message);
         }
-      }
-    };
-    poller.on_error = [](int fd, std::exception error) {
-      logging::info(std::format("on_error: {}, {}", fd, error.what()));
-    };
-
-    poller.event_loop();
+      };
+      poller.on_error = [](int fd, std::exception error) {
+        logging::info("on_error: {}, {}", fd, error.what());
+      };
+    });
   }
   catch(const std::exception& error)
   {
-    logging::error(std::format("Server failed: {}", error.what()));
+    logging::error("Server failed: {}", error.what());
   }
   catch (...)
   {
-    logging::error(std::format("unknown error"));
+    logging::error("unknown error");
   }
 
   logging::info("server stopped");
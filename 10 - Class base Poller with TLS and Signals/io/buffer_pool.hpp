@@ -0,0 +1,267 @@
+#ifndef SQUAWKBUS_IO_BUFFER_POOL_HPP
+#define SQUAWKBUS_IO_BUFFER_POOL_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace jetblack::io
+{
+  class BufferPool;
+
+  // The header of a block of memory. The data follows the header.
+  struct BufferBlock
+  {
+    std::atomic<std::uint32_t> refs { 1 };
+    std::uint32_t size_class;
+    std::size_t capacity;
+
+    char* data() noexcept { return reinterpret_cast<char*>(this + 1); }
+  };
+
+  // A reference counted handle to a block of memory from a buffer pool.
+  //
+  // Copies share the same memory, so a buffer received from a read can be
+  // passed to any number of writes without copying the data. The size
+  // belongs to the handle, and can be changed up to the capacity of the
+  // block.
+  class Buffer
+  {
+  private:
+    BufferBlock* block_ { nullptr };
+    std::size_t size_ { 0 };
+
+    friend class BufferPool;
+
+    Buffer(BufferBlock* block, std::size_t size) noexcept
+      : block_(block),
+        size_(size)
+    {
+    }
+
+  public:
+    Buffer() noexcept = default;
+    Buffer(const Buffer& other) noexcept
+      : block_(other.block_),
+        size_(other.size_)
+    {
+      if (block_ != nullptr)
+        block_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    Buffer(Buffer&& other) noexcept
+      : block_(std::exchange(other.block_, nullptr)),
+        size_(std::exchange(other.size_, 0))
+    {
+    }
+    ~Buffer()
+    {
+      reset();
+    }
+
+    Buffer& operator=(const Buffer& other) noexcept
+    {
+      if (this != &other)
+      {
+        Buffer copy(other);
+        *this = std::move(copy);
+      }
+      return *this;
+    }
+    Buffer& operator=(Buffer&& other) noexcept
+    {
+      if (this != &other)
+      {
+        reset();
+        block_ = std::exchange(other.block_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+      }
+      return *this;
+    }
+
+    char* data() noexcept { return block_ == nullptr ? nullptr : block_->data(); }
+    const char* data() const noexcept { return block_ == nullptr ? nullptr : block_->data(); }
+    std::size_t size() const noexcept { return size_; }
+    std::size_t capacity() const noexcept { return block_ == nullptr ? 0 : block_->capacity; }
+    bool empty() const noexcept { return size_ == 0; }
+    std::uint32_t use_count() const noexcept
+    {
+      return block_ == nullptr ? 0 : block_->refs.load(std::memory_order_relaxed);
+    }
+
+    char* begin() noexcept { return data(); }
+    char* end() noexcept { return data() + size_; }
+    const char* begin() const noexcept { return data(); }
+    const char* end() const noexcept { return data() + size_; }
+
+    std::span<char> span() noexcept { return { data(), size_ }; }
+    std::span<const char> span() const noexcept { return { data(), size_ }; }
+
+    void resize(std::size_t size)
+    {
+      if (size > capacity())
+        throw std::length_error("buffer size exceeds capacity");
+      size_ = size;
+    }
+
+    void reset() noexcept;
+  };
+
+  // A pool of uninitialized buffers in power of two size classes, from 64
+  // bytes to 64 kilobytes. Larger buffers are allocated directly.
+  //
+  // Each thread has its own pool, so no locks are taken. A buffer released
+  // on another thread is returned to that thread's pool.
+  class BufferPool
+  {
+  public:
+    struct Stats
+    {
+      std::size_t allocations { 0 };
+      std::size_t hits { 0 };
+      std::size_t bytes_in_use { 0 };
+      std::size_t high_water { 0 };
+      std::size_t bytes_cached { 0 };
+
+      double hit_rate() const noexcept
+      {
+        return allocations == 0 ? 0.0 : static_cast<double>(hits) / allocations;
+      }
+    };
+
+    static constexpr std::size_t min_class_bits = 6;
+    static constexpr std::size_t max_class_bits = 16;
+    static constexpr std::size_t size_classes = max_class_bits - min_class_bits + 1;
+    static constexpr std::uint32_t unpooled = size_classes;
+
+  private:
+    std::array<std::vector<BufferBlock*>, size_classes> free_;
+    std::size_t max_cached_;
+    Stats stats_;
+
+  public:
+    // At most max_cached free blocks are held for each size class.
+    explicit BufferPool(std::size_t max_cached = 256) noexcept
+      : max_cached_(max_cached)
+    {
+    }
+    ~BufferPool()
+    {
+      for (auto& blocks : free_)
+      {
+        for (auto block : blocks)
+          destroy(block);
+      }
+    }
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    static BufferPool& local() noexcept
+    {
+      thread_local BufferPool pool;
+      return pool;
+    }
+
+    const Stats& stats() const noexcept { return stats_; }
+
+    // Allocate a buffer of the given size. The contents are uninitialized.
+    Buffer allocate(std::size_t size)
+    {
+      auto size_class = class_of(size);
+      BufferBlock* block = nullptr;
+
+      ++stats_.allocations;
+      if (size_class != unpooled && !free_[size_class].empty())
+      {
+        ++stats_.hits;
+        block = free_[size_class].back();
+        free_[size_class].pop_back();
+        stats_.bytes_cached -= block->capacity;
+        block->refs.store(1, std::memory_order_relaxed);
+      }
+      else
+      {
+        auto capacity = size_class == unpooled ? size : std::size_t{1} << (size_class + min_class_bits);
+        block = create(size_class, capacity);
+      }
+
+      stats_.bytes_in_use += block->capacity;
+      stats_.high_water = std::max(stats_.high_water, stats_.bytes_in_use);
+
+      return Buffer(block, size);
+    }
+
+    // Allocate a buffer holding a copy of the data.
+    Buffer copy(std::span<const char> data)
+    {
+      auto buf = allocate(data.size());
+      if (!data.empty())
+        std::memcpy(buf.data(), data.data(), data.size());
+      return buf;
+    }
+
+    void release(BufferBlock* block) noexcept
+    {
+      // Blocks released on another thread may not have been counted here.
+      stats_.bytes_in_use -= std::min(stats_.bytes_in_use, block->capacity);
+
+      if (block->size_class == unpooled || free_[block->size_class].size() >= max_cached_)
+      {
+        destroy(block);
+        return;
+      }
+
+      try
+      {
+        free_[block->size_class].push_back(block);
+        stats_.bytes_cached += block->capacity;
+      }
+      catch (...)
+      {
+        destroy(block);
+      }
+    }
+
+  private:
+    static std::uint32_t class_of(std::size_t size) noexcept
+    {
+      if (size > (std::size_t{1} << max_class_bits))
+        return unpooled;
+      auto bits = static_cast<std::size_t>(std::bit_width(size <= 1 ? 0 : size - 1));
+      return static_cast<std::uint32_t>(std::max(bits, min_class_bits) - min_class_bits);
+    }
+
+    static BufferBlock* create(std::uint32_t size_class, std::size_t capacity)
+    {
+      auto memory = ::operator new(sizeof(BufferBlock) + capacity);
+      auto block = new (memory) BufferBlock;
+      block->size_class = size_class;
+      block->capacity = capacity;
+      return block;
+    }
+
+    static void destroy(BufferBlock* block) noexcept
+    {
+      block->~BufferBlock();
+      ::operator delete(block);
+    }
+  };
+
+  inline void Buffer::reset() noexcept
+  {
+    if (block_ != nullptr && block_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      BufferPool::local().release(block_);
+    block_ = nullptr;
+    size_ = 0;
+  }
+}
+
+#endif // SQUAWKBUS_IO_BUFFER_POOL_HPP
@@ -1,6 +1,7 @@
 #ifndef SQUAWKBUS_IO_ENDPOINT_HPP
 #define SQUAWKBUS_IO_ENDPOINT_HPP
 
+#include <compare>
 #include <cstdint>
 #include <format>
 #include <limits>
@@ -35,6 +36,8 @@ namespace jetblack::io
 
     bool empty() const noexcept { return host_.empty() && port_ == 0; }
 
+    auto operator<=>(const Endpoint&) const = default;
+
     static Endpoint parse(const std::string& text)
     {
       auto colon = text.find(':');
@@ -0,0 +1,140 @@
+#ifndef SQUAWKBUS_IO_EPOLL_MULTIPLEXER_HPP
+#define SQUAWKBUS_IO_EPOLL_MULTIPLEXER_HPP
+
+#ifdef __linux__
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+#include <vector>
+
+#include "io/logger.hpp"
+#include "io/multiplexer.hpp"
+
+namespace jetblack::io
+{
+  // A multiplexer using epoll(7).
+  //
+  // File descriptors are registered with the kernel once, so the cost of a
+  // wait depends on the number of active file descriptors rather than the
+  // number registered. The interest list is level triggered, which gives the
+  // same semantics as poll.
+  class EpollMultiplexer : public Multiplexer
+  {
+  private:
+    int epfd_;
+    std::vector<epoll_event> events_;
+
+  public:
+    EpollMultiplexer(std::size_t max_events = 1024)
+      : epfd_(::epoll_create1(EPOLL_CLOEXEC)),
+        events_(max_events)
+    {
+      if (epfd_ == -1)
+      {
+        throw std::system_error(errno, std::generic_category(), "epoll_create1 failed");
+      }
+    }
+    ~EpollMultiplexer() override
+    {
+      ::close(epfd_);
+    }
+    EpollMultiplexer(const EpollMultiplexer&) = delete;
+    EpollMultiplexer& operator=(const EpollMultiplexer&) = delete;
+
+    void add(int fd, std::int16_t events) override
+    {
+      if (control(EPOLL_CTL_ADD, fd, events) == -1)
+      {
+        // The file descriptor number may have been reused before the
+        // previous registration was removed.
+        if (errno != EEXIST || control(EPOLL_CTL_MOD, fd, events) == -1)
+          throw std::system_error(errno, std::generic_category(), "epoll_ctl failed to add");
+      }
+    }
+
+    void modify(int fd, std::int16_t events) override
+    {
+      if (control(EPOLL_CTL_MOD, fd, events) == -1)
+      {
+        throw std::system_error(errno, std::generic_category(), "epoll_ctl failed to modify");
+      }
+    }
+
+    void remove(int fd) noexcept override
+    {
+      // Closing a file descriptor removes it from the interest list, so
+      // failure here is expected and ignored.
+      control(EPOLL_CTL_DEL, fd, 0);
+    }
+
+    int wait(std::vector<pollfd>& active, int timeout) override
+    {
+      active.clear();
+
+      log.trace("polling");
+
+      int active_fd_count = ::epoll_wait(epfd_, events_.data(), static_cast<int>(events_.size()), timeout);
+      if (active_fd_count < 0)
+      {
+        if (errno == EINTR)
+          return 0; // raising a caught signal causes this behaviour.
+        throw std::system_error(errno, std::generic_category(), "epoll_wait failed");
+      }
+
+      for (int i = 0; i < active_fd_count; ++i)
+      {
+        active.push_back(pollfd{
+          events_[i].data.fd,
+          0,
+          static_cast<std::int16_t>(to_poll_events(events_[i].events))});
+      }
+
+      return active_fd_count;
+    }
+
+  private:
+    int control(int op, int fd, std::int16_t events) noexcept
+    {
+      epoll_event event {};
+      event.events = to_epoll_events(events);
+      event.data.fd = fd;
+      return ::epoll_ctl(epfd_, op, fd, &event);
+    }
+
+    static std::uint32_t to_epoll_events(std::int16_t events) noexcept
+    {
+      std::uint32_t flags = 0;
+      if (events & POLLIN)
+        flags |= EPOLLIN;
+      if (events & POLLPRI)
+        flags |= EPOLLPRI;
+      if (events & POLLOUT)
+        flags |= EPOLLOUT;
+      return flags; // EPOLLERR and EPOLLHUP are always reported.
+    }
+
+    static std::uint32_t to_poll_events(std::uint32_t events) noexcept
+    {
+      std::uint32_t flags = 0;
+      if (events & EPOLLIN)
+        flags |= POLLIN;
+      if (events & EPOLLPRI)
+        flags |= POLLPRI;
+      if (events & EPOLLOUT)
+        flags |= POLLOUT;
+      if (events & EPOLLERR)
+        flags |= POLLERR;
+      if (events & EPOLLHUP)
+        flags |= POLLHUP;
+      return flags;
+    }
+  };
+}
+
+#endif // __linux__
+
+#endif // SQUAWKBUS_IO_EPOLL_MULTIPLEXER_HPP
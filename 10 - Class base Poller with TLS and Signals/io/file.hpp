@@ -16,6 +16,7 @@ namespace jetblack::io
     int fd_;
     int oflag_;
     bool is_open_ { true };
+    bool is_closed_ { false };
 
   public:
     explicit File(int fd, int oflag = O_RDWR) noexcept
@@ -35,7 +36,9 @@ namespace jetblack::io
     File& operator = (File&& other)
     {
       fd_ = other.fd_;
+      oflag_ = other.oflag_;
       is_open_ = other.is_open_;
+      is_closed_ = other.is_closed_;
 
       other.fd_ = -1;
       other.is_open_ = false;
@@ -45,7 +48,10 @@ namespace jetblack::io
 
     ~File()
     {
-      if (!is_open_)
+      // A file marked as not open may still hold its descriptor, but one
+      // which has been closed must not be closed again, as the number may
+      // have been reused.
+      if (fd_ != -1 && !is_closed_)
       {
         try
         {
@@ -71,6 +77,7 @@ namespace jetblack::io
         throw std::system_error(errno, std::generic_category(), "failed to close socket");
       }
       is_open_ = false;
+      is_closed_ = true;
     }
 
     int fcntl_flags() const
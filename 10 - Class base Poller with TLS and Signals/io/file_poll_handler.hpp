@@ -17,6 +17,8 @@
 #include "io/poller.hpp"
 #include "io/file.hpp"
 #include "io/file_stream.hpp"
+#include "io/message.hpp"
+#include "io/ring_buffer.hpp"
 
 namespace jetblack::io
 {
@@ -26,8 +28,9 @@ namespace jetblack::io
   {
   private:
     FileStream stream_;
-    std::deque<std::vector<char>> read_queue_;
-    std::deque<std::pair<std::vector<char>, std::size_t>> write_queue_;
+    RingBuffer input_;
+    // The messages waiting to be written, with the offset written so far.
+    std::deque<std::pair<Message, std::size_t>> write_queue_;
 
   public:
     const std::size_t read_bufsiz;
@@ -39,6 +42,7 @@ namespace jetblack::io
       std::size_t read_bufsiz,
       std::size_t write_bufsiz)
       : stream_(file),
+        input_(read_bufsiz),
         read_bufsiz(read_bufsiz),
         write_bufsiz(write_bufsiz)
     {
@@ -47,10 +51,13 @@ namespace jetblack::io
     {
     }
 
+    void attach([[maybe_unused]] Poller& poller) override {}
+    void detach([[maybe_unused]] Poller& poller) override {}
+
     bool is_listener() const noexcept override { return false; }
     int fd() const noexcept override { return stream_.file->fd(); }
     bool is_open() const noexcept override { return stream_.file->is_open(); }
-    bool want_read() const noexcept override { return stream_.file->can_read(); }
+    bool want_read() const noexcept override { return stream_.file->can_read() && !input_.full(); }
     bool want_write() const noexcept override { return stream_.file->can_write() && !write_queue_.empty(); }
 
     bool read([[maybe_unused]] Poller& poller) override
@@ -71,14 +78,13 @@ namespace jetblack::io
               return false;
             },
 
-            [&](std::vector<char>&& buf) mutable
+            [&](std::size_t&&) mutable
             {
-              read_queue_.push_back(std::move(buf));
-              return true;
+              return !input_.full();
             }
 
           },
-          stream_.read(read_bufsiz));
+          stream_.read(input_));
         }
       }
       catch (...)
@@ -99,7 +105,7 @@ namespace jetblack::io
 
           auto& [orig_buf, offset] = write_queue_.front();
           std::size_t count = std::min(orig_buf.size() - offset, write_bufsiz);
-          const auto& buf = std::span<char>(orig_buf).subspan(offset, count);
+          const auto& buf = orig_buf.span().subspan(offset, count);
 
           can_write = std::visit(match {
             
@@ -148,21 +154,13 @@ namespace jetblack::io
       }
     }
 
-    bool has_reads() const noexcept { return !read_queue_.empty(); }
+    bool has_reads() const noexcept { return !input_.empty(); }
 
-    std::optional<std::vector<char>> dequeue() noexcept override
-    {
-      if (read_queue_.empty())
-        return std::nullopt;
-
-      auto buf { std::move(read_queue_.front()) };
-      read_queue_.pop_front();
-      return buf;
-    }
+    RingBuffer& input() noexcept override { return input_; }
 
-    void enqueue(const std::vector<char>& buf) noexcept override
+    void enqueue(Message message) noexcept override
     {
-      write_queue_.push_back(std::make_pair(std::move(buf), 0));
+      write_queue_.emplace_back(std::move(message), 0);
     }
   };
 }
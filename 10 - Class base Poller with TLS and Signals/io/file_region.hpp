@@ -0,0 +1,50 @@
+#ifndef SQUAWKBUS_IO_FILE_REGION_HPP
+#define SQUAWKBUS_IO_FILE_REGION_HPP
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+
+#include "io/buffer_pool.hpp"
+#include "io/file.hpp"
+
+namespace jetblack::io
+{
+  // A region of a file to be written to a connection. The file is shared, so
+  // it stays open until the region has been written.
+  struct FileRegion
+  {
+    std::shared_ptr<File> file;
+    off_t offset { 0 };
+    std::size_t size { 0 };
+
+    // Read part of the region, starting at an offset from the start of the
+    // region, into a pooled buffer.
+    Buffer read(std::size_t start, std::size_t len) const
+    {
+      auto buf = BufferPool::local().allocate(len);
+      std::size_t count = 0;
+      while (count < len)
+      {
+        auto result = ::pread(file->fd(), buf.data() + count, len - count, offset + start + count);
+        if (result == -1)
+        {
+          if (errno == EINTR)
+            continue;
+          throw std::system_error(errno, std::generic_category(), "failed to read file");
+        }
+        if (result == 0)
+          throw std::runtime_error("the file is shorter than the region");
+        count += static_cast<std::size_t>(result);
+      }
+      return buf;
+    }
+  };
+}
+
+#endif // SQUAWKBUS_IO_FILE_REGION_HPP
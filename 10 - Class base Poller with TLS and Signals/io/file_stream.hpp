@@ -6,8 +6,10 @@
 #include <string.h>
 #include <sys/file.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <array>
 #include <cerrno>
 #include <cstddef>
 
@@ -20,7 +22,9 @@
 #include <variant>
 #include <vector>
 
+#include "io/buffer_pool.hpp"
 #include "io/file.hpp"
+#include "io/ring_buffer.hpp"
 #include "io/file_types.hpp"
 
 namespace jetblack::io
@@ -38,9 +42,9 @@ namespace jetblack::io
 
     file_pointer file;
 
-    std::variant<std::vector<char>, eof, blocked> read(std::size_t len)
+    std::variant<Buffer, eof, blocked> read(std::size_t len)
     {
-      std::vector<char> buf(len);
+      auto buf = BufferPool::local().allocate(len);
       int result = ::read(file->fd(), buf.data(), len);
       if (result == -1) {
         // Check if it's flow control.
@@ -66,7 +70,39 @@ namespace jetblack::io
       return buf;
     }
 
-    std::variant<ssize_t, eof, blocked> write(const std::span<char>& buf)
+    // Read into the free space of a ring buffer, committing the bytes read.
+    std::variant<std::size_t, eof, blocked> read(RingBuffer& buf)
+    {
+      if (buf.full())
+        return blocked {};
+
+      std::array<iovec, 2> iov;
+      auto count = buf.free_space(iov);
+      auto result = ::readv(file->fd(), iov.data(), count);
+      if (result == -1) {
+        // Check if it's flow control.
+        if (!(errno == EAGAIN || errno == EWOULDBLOCK)) {
+          // Not a flow control error; the file has faulted.
+          file->is_open(false);
+          throw std::system_error(
+            errno, std::generic_category(), "client file failed to read");
+        }
+
+        // The file is ok, but nothing has been read due to blocking.
+        return blocked {};
+      }
+
+      if (result == 0) {
+        // A read of zero bytes indicates file has closed.
+        file->is_open(false);
+        return eof {};
+      }
+
+      buf.commit(static_cast<std::size_t>(result));
+      return static_cast<std::size_t>(result);
+    }
+
+    std::variant<ssize_t, eof, blocked> write(const std::span<const char>& buf)
     {
       int result = ::write(file->fd(), buf.data(), buf.size());
       if (result == -1)
@@ -0,0 +1,182 @@
+#ifndef SQUAWKBUS_IO_HANDSHAKE_POOL_HPP
+#define SQUAWKBUS_IO_HANDSHAKE_POOL_HPP
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <format>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "io/logger.hpp"
+#include "io/multiplexer.hpp"
+#include "io/poller.hpp"
+#include "io/task_queue.hpp"
+#include "io/tcp_socket_poll_handler.hpp"
+
+namespace jetblack::io
+{
+  // Run TLS handshakes on a small pool of worker threads, so the signing
+  // for a burst of new connections does not stall the established
+  // connections of the poller which accepted them.
+  //
+  // Each worker has its own poller. A connection is handed to a worker when
+  // it is accepted, and posted back to the poller which accepted it when
+  // the handshake completes, where on_open is called. A connection which
+  // fails its handshake is closed by the worker, and the accepting poller
+  // never sees it.
+  class HandshakePool
+  {
+  public:
+    typedef std::function<std::unique_ptr<Multiplexer>()> multiplexer_factory;
+
+  private:
+    struct Worker
+    {
+      Poller poller;
+      std::thread thread;
+
+      Worker(std::unique_ptr<Multiplexer> multiplexer)
+        : poller(std::move(multiplexer))
+      {
+      }
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<std::size_t> next_ { 0 };
+
+  public:
+    HandshakePool(std::size_t threads, multiplexer_factory make_multiplexer = make_default_multiplexer)
+    {
+      for (std::size_t index = 0; index < (threads == 0 ? 1 : threads); ++index)
+      {
+        auto worker = std::make_unique<Worker>(make_multiplexer());
+        worker->poller.on_error = [](int fd, std::exception error)
+        {
+          log.debug("handshake failed for {}: {}", fd, error.what());
+        };
+        workers_.push_back(std::move(worker));
+      }
+
+      for (std::size_t index = 0; index < workers_.size(); ++index)
+      {
+        auto worker = workers_[index].get();
+        worker->thread = std::thread(
+          [worker, index]()
+          {
+            // Signals are left to the reactors.
+            sigset_t signals;
+            sigfillset(&signals);
+            pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+            log.debug("starting handshake worker {}", index);
+            try
+            {
+              worker->poller.event_loop();
+            }
+            catch (const std::exception& error)
+            {
+              log.error("handshake worker {} failed: {}", index, error.what());
+            }
+          });
+      }
+    }
+    ~HandshakePool()
+    {
+      for (auto& worker : workers_)
+        worker->poller.stop();
+      for (auto& worker : workers_)
+        worker->thread.join();
+    }
+    HandshakePool(const HandshakePool&) = delete;
+    HandshakePool& operator=(const HandshakePool&) = delete;
+
+    std::size_t threads() const noexcept { return workers_.size(); }
+
+    // Run the handshake of a connection accepted by the owner. This is
+    // called on the owner's thread.
+    void handshake(
+      Poller& owner,
+      std::unique_ptr<TcpSocketPollHandler> handler,
+      const std::string& host,
+      std::uint16_t port)
+    {
+      auto worker = &workers_[next_.fetch_add(1, std::memory_order_relaxed) % workers_.size()]->poller;
+      auto owner_tasks = owner.tasks();
+      auto owner_poller = &owner;
+      int fd = handler->fd();
+
+      handler->on_handshake(
+        [worker, owner_tasks, owner_poller, fd, host, port]()
+        {
+          // The handler is released after the event which completed the
+          // handshake has been handled.
+          worker->post(
+            [worker, owner_tasks, owner_poller, fd, host, port]()
+            {
+              hand_back(*worker, owner_tasks, owner_poller, fd, host, port);
+            });
+        });
+
+      auto moved = std::make_shared<Poller::handler_pointer>(std::move(handler));
+      worker->post(
+        [worker, moved, host, port]()
+        {
+          add_handler(*worker, std::move(*moved), host, port);
+        });
+    }
+
+  private:
+    static void hand_back(
+      Poller& worker,
+      std::weak_ptr<TaskQueue> owner_tasks,
+      Poller* owner,
+      int fd,
+      const std::string& host,
+      std::uint16_t port)
+    {
+      auto handler = worker.release_handler(fd);
+      if (!handler)
+        return; // closed since the handshake completed.
+
+      // If the owner has gone the handler is dropped, closing the
+      // connection.
+      auto tasks = owner_tasks.lock();
+      if (!tasks)
+        return;
+
+      // The owner only runs the function while it exists.
+      auto moved = std::make_shared<Poller::handler_pointer>(std::move(handler));
+      tasks->post(
+        [owner, moved, host, port]()
+        {
+          add_handler(*owner, std::move(*moved), host, port);
+        });
+    }
+
+    static void add_handler(
+      Poller& poller,
+      Poller::handler_pointer handler,
+      const std::string& host,
+      std::uint16_t port) noexcept
+    {
+      try
+      {
+        poller.add_handler(std::move(handler), host, port);
+      }
+      catch (const std::exception& error)
+      {
+        log.error("failed to add handler for {}:{}: {}", host, port, error.what());
+      }
+    }
+  };
+}
+
+#endif // SQUAWKBUS_IO_HANDSHAKE_POOL_HPP
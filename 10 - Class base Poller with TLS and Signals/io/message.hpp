@@ -0,0 +1,48 @@
+#ifndef SQUAWKBUS_IO_MESSAGE_HPP
+#define SQUAWKBUS_IO_MESSAGE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+
+#include "io/buffer_pool.hpp"
+
+namespace jetblack::io
+{
+  // An immutable, reference counted message for writing.
+  //
+  // Copies share the same data, so a message can be queued on any number of
+  // connections with a single allocation. Each write queue holds its own
+  // offset into the message.
+  class Message
+  {
+  private:
+    Buffer buf_;
+
+  public:
+    Message() noexcept = default;
+    // The message takes the buffer, which must not be changed afterwards.
+    Message(Buffer buf) noexcept
+      : buf_(std::move(buf))
+    {
+    }
+    // Copy the data into a pooled buffer.
+    explicit Message(std::span<const char> data)
+      : buf_(BufferPool::local().copy(data))
+    {
+    }
+
+    const char* data() const noexcept { return buf_.data(); }
+    std::size_t size() const noexcept { return buf_.size(); }
+    bool empty() const noexcept { return buf_.empty(); }
+    std::uint32_t use_count() const noexcept { return buf_.use_count(); }
+
+    const char* begin() const noexcept { return buf_.begin(); }
+    const char* end() const noexcept { return buf_.end(); }
+
+    std::span<const char> span() const noexcept { return buf_.span(); }
+  };
+}
+
+#endif // SQUAWKBUS_IO_MESSAGE_HPP
@@ -0,0 +1,94 @@
+#ifndef SQUAWKBUS_IO_MULTIPLEXER_HPP
+#define SQUAWKBUS_IO_MULTIPLEXER_HPP
+
+#include <poll.h>
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "io/message.hpp"
+
+namespace jetblack::io
+{
+  // Data a multiplexer has read for a descriptor. Empty data is the end of
+  // the stream, or an error, as with a read.
+  struct Received
+  {
+    int fd;
+    std::span<const char> data;
+  };
+
+  // A connection a multiplexer has accepted for a listener.
+  struct Accepted
+  {
+    int listener_fd;
+    int fd;
+  };
+
+  // The result of a send a multiplexer has made for a descriptor: the
+  // bytes sent, or a negative error number, as with a write.
+  struct Sent
+  {
+    int fd;
+    long result;
+  };
+
+  // The interface to the operating system's readiness notification.
+  //
+  // File descriptors are registered once with the events they are interested
+  // in (using the poll flags), and the registration is only modified when the
+  // interest changes. The wait call fills in the active file descriptors.
+  class Multiplexer
+  {
+  public:
+    virtual ~Multiplexer() {}
+    virtual void add(int fd, std::int16_t events) = 0;
+    virtual void modify(int fd, std::int16_t events) = 0;
+    virtual void remove(int fd) noexcept = 0;
+    virtual int wait(std::vector<pollfd>& active, int timeout) = 0;
+
+    // Register a descriptor the multiplexer may read itself. Its data is
+    // returned by received, rather than being reported with POLLIN, while
+    // the interest includes POLLIN. By default it is registered for
+    // readiness.
+    virtual void add_receiver(int fd, std::int16_t events) { add(fd, events); }
+    // The data read during the last wait, in order, which is valid until
+    // the next wait.
+    virtual std::span<const Received> received() const noexcept { return {}; }
+
+    // Register a listener the multiplexer may accept connections for
+    // itself. They are returned by accepted, rather than being reported with
+    // POLLIN. By default it is registered for readiness.
+    virtual void add_acceptor(int fd, std::int16_t events) { add(fd, events); }
+    // The connections accepted during the last wait. They belong to the
+    // caller, who must close them.
+    virtual std::span<const Accepted> accepted() const noexcept { return {}; }
+
+    // True when the multiplexer can send data for its descriptors.
+    virtual bool can_send() const noexcept { return false; }
+    // Send the data with the next wait, rather than the caller writing it.
+    // The messages hold the data until the send is made. A send does not
+    // wait for the socket, so it can be short, as with a non-blocking write.
+    // Returns false when the data cannot be sent.
+    virtual bool send(
+      [[maybe_unused]] int fd,
+      [[maybe_unused]] std::span<const iovec> iov,
+      [[maybe_unused]] std::span<const Message> messages)
+    {
+      return false;
+    }
+    // The results of the sends made during the last wait.
+    virtual std::span<const Sent> sent() const noexcept { return {}; }
+    // There is more to send once the queued sends have been made, so the
+    // next wait returns without waiting for events.
+    virtual void send_more() {}
+    // Make the queued sends now, rather than with the next wait. This must
+    // be done before a descriptor with a queued send is closed, as its
+    // number may be reused.
+    virtual void submit() {}
+  };
+}
+
+#endif // SQUAWKBUS_IO_MULTIPLEXER_HPP
@@ -1,8 +1,14 @@
 #ifndef SQUAWKBUS_IO_POLL_HANDLER_HPP
 #define SQUAWKBUS_IO_POLL_HANDLER_HPP
 
+#include <algorithm>
+#include <cstddef>
 #include <optional>
-#include <vector>
+#include <span>
+
+#include "io/file_region.hpp"
+#include "io/message.hpp"
+#include "io/ring_buffer.hpp"
 
 namespace jetblack::io
 {
@@ -12,16 +18,47 @@ namespace jetblack::io
   {
   public:
     virtual ~PollHandler() {};
+    // Called when the handler has been added to the poller.
+    virtual void attach(Poller& poller) = 0;
+    // Called when the handler is released from the poller, to be added to
+    // another.
+    virtual void detach(Poller& poller) = 0;
     virtual bool is_listener() const noexcept = 0;
+    // True while a TLS handshake is in progress.
+    virtual bool is_handshaking() const noexcept { return false; }
     virtual int fd() const noexcept = 0;
     virtual bool is_open() const noexcept = 0;
     virtual bool want_read() const noexcept = 0;
     virtual bool want_write() const noexcept = 0;
     virtual bool read(Poller& poller) = 0;
+    // True when the handler can take data read for it by the multiplexer,
+    // in place of reading the descriptor itself.
+    virtual bool can_receive() const noexcept { return false; }
+    // Take as much of the data read by the multiplexer as the input has
+    // room for, returning the count taken. Empty data is the end of the
+    // stream.
+    virtual std::size_t receive([[maybe_unused]] Poller& poller, [[maybe_unused]] std::span<const char> data) { return 0; }
+    // True when the listener can take connections accepted for it by the
+    // multiplexer, in place of accepting them itself.
+    virtual bool can_accept() const noexcept { return false; }
+    // Take a connection the multiplexer accepted.
+    virtual void accept([[maybe_unused]] Poller& poller, [[maybe_unused]] int fd) {}
+    // Called with the result of a send the handler asked the poller to
+    // make: the bytes sent, or a negative error number.
+    virtual void sent([[maybe_unused]] Poller& poller, [[maybe_unused]] long result) {}
     virtual bool write() = 0;
     virtual void close() = 0;
-    virtual void enqueue(const std::vector<char>& buf) noexcept = 0;
-    virtual std::optional<std::vector<char>> dequeue() noexcept = 0;
+    virtual void enqueue(Message message) noexcept = 0;
+    // By default the region is read into messages. Handlers which can copy
+    // the file straight to their descriptor override this.
+    virtual void enqueue(FileRegion region)
+    {
+      const std::size_t chunk_size = 65536;
+      for (std::size_t start = 0; start < region.size; start += chunk_size)
+        enqueue(Message(region.read(start, std::min(chunk_size, region.size - start))));
+    }
+    // The data read and not yet consumed.
+    virtual RingBuffer& input() noexcept = 0;
   };
 }
 
@@ -0,0 +1,104 @@
+#ifndef SQUAWKBUS_IO_POLL_MULTIPLEXER_HPP
+#define SQUAWKBUS_IO_POLL_MULTIPLEXER_HPP
+
+#include <poll.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include "io/logger.hpp"
+#include "io/multiplexer.hpp"
+
+namespace jetblack::io
+{
+  inline int poll(std::vector<pollfd> &fds, int timeout = -1)
+  {
+    log.trace("polling");
+
+    int active_fd_count = ::poll(fds.data(), fds.size(), timeout);
+    if (active_fd_count < 0)
+    {
+      if (errno == EINTR)
+        return 0; // raising a caught signal causes this behaviour.
+      throw std::system_error(errno, std::generic_category(), "poll failed");
+    }
+    return active_fd_count;
+  }
+
+  // A multiplexer using poll(2).
+  //
+  // The pollfd array is kept between calls and updated in place, so it is no
+  // longer rebuilt on every iteration, however the kernel still has to scan
+  // every registered file descriptor on each wait.
+  class PollMultiplexer : public Multiplexer
+  {
+  private:
+    std::vector<pollfd> fds_;
+    std::unordered_map<int, std::size_t> index_;
+
+  public:
+    void add(int fd, std::int16_t events) override
+    {
+      if (auto i = index_.find(fd); i != index_.end())
+      {
+        fds_[i->second] = pollfd{fd, events, 0};
+        return;
+      }
+
+      index_[fd] = fds_.size();
+      fds_.push_back(pollfd{fd, events, 0});
+    }
+
+    void modify(int fd, std::int16_t events) override
+    {
+      if (auto i = index_.find(fd); i != index_.end())
+      {
+        fds_[i->second].events = events;
+      }
+    }
+
+    void remove(int fd) noexcept override
+    {
+      auto i = index_.find(fd);
+      if (i == index_.end())
+        return;
+
+      // Move the last entry into the hole.
+      auto position = i->second;
+      index_.erase(i);
+      if (position != fds_.size() - 1)
+      {
+        fds_[position] = fds_.back();
+        index_[fds_[position].fd] = position;
+      }
+      fds_.pop_back();
+    }
+
+    int wait(std::vector<pollfd>& active, int timeout) override
+    {
+      active.clear();
+
+      int active_fd_count = poll(fds_, timeout);
+
+      for (auto& poll_state : fds_)
+      {
+        if (active_fd_count == 0)
+          break;
+
+        if (poll_state.revents == 0)
+          continue; // no events for file descriptor.
+
+        active.push_back(poll_state);
+        poll_state.revents = 0;
+        --active_fd_count;
+      }
+
+      return static_cast<int>(active.size());
+    }
+  };
+}
+
+#endif // SQUAWKBUS_IO_POLL_MULTIPLEXER_HPP
@@ -3,34 +3,78 @@
 
 #include <poll.h>
 #include <signal.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
 #include <csignal>
+#include <cstdint>
 #include <deque>
 #include <format>
 #include <functional>
-#include <map>
 #include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
 #include <system_error>
 #include <utility>
 #include <vector>
 
+#include "io/buffer_pool.hpp"
+#include "io/file_region.hpp"
 #include "io/logger.hpp"
+#include "io/message.hpp"
+#include "io/multiplexer.hpp"
+#include "io/poll_multiplexer.hpp"
+#include "io/epoll_multiplexer.hpp"
+#include "io/uring_multiplexer.hpp"
 #include "io/poll_handler.hpp"
+#include "io/ring_buffer.hpp"
+#include "io/task_queue.hpp"
+#include "io/timer_wheel.hpp"
 
 namespace jetblack::io
 {
-  inline int poll(std::vector<pollfd> &fds, int timeout = -1)
+  inline std::unique_ptr<Multiplexer> make_default_multiplexer()
   {
-    log.trace("polling");
+#ifdef __linux__
+    return std::make_unique<EpollMultiplexer>();
+#else
+    return std::make_unique<PollMultiplexer>();
+#endif
+  }
 
-    int active_fd_count = ::poll(fds.data(), fds.size(), timeout);
-    if (active_fd_count < 0)
+  // Make a multiplexer by name: "poll", "epoll" or "uring". When io_uring is
+  // not available the poll multiplexer is used.
+  inline std::unique_ptr<Multiplexer> make_multiplexer(const std::string& name)
+  {
+    if (name == "poll")
+      return std::make_unique<PollMultiplexer>();
+#ifdef __linux__
+    if (name == "epoll")
+      return std::make_unique<EpollMultiplexer>();
+#endif
+    if (name == "uring")
     {
-      if (errno == EINTR)
-        return 0; // raising a caught signal causes this behaviour.
-      throw std::system_error(errno, std::generic_category(), "poll failed");
+#ifdef JETBLACK_IO_HAS_URING
+      try
+      {
+        return std::make_unique<UringMultiplexer>();
+      }
+      catch (const std::exception& error)
+      {
+        log.warning("io_uring unavailable ({}), falling back to poll", error.what());
+      }
+#else
+      log.warning("io_uring unavailable, falling back to poll");
+#endif
+      return std::make_unique<PollMultiplexer>();
     }
-    return active_fd_count;
+    throw std::invalid_argument(std::format("unknown multiplexer \"{}\"", name));
   }
 
   struct PollClient
@@ -40,7 +84,7 @@ namespace jetblack::io
     virtual void on_interrupt(Poller& poller) = 0;
     virtual void on_open(Poller& poller, int fd, const std::string& host, std::uint16_t port) = 0;
     virtual void on_close(Poller& poller, int fd) = 0;
-    virtual void on_read(Poller& poller, int fd, std::vector<std::vector<char>>&& bufs) = 0;
+    virtual void on_read(Poller& poller, int fd, RingBuffer& input) = 0;
     virtual void on_error(Poller& poller, int fd, std::exception error) = 0;
   };
 
@@ -48,95 +92,362 @@ namespace jetblack::io
   {
   public:
     typedef std::unique_ptr<PollHandler> handler_pointer;
-    typedef std::map<int, handler_pointer> handler_map;
     typedef std::shared_ptr<PollClient> client_pointer;
+    typedef TimerWheel::clock_type clock_type;
+    typedef TimerWheel::time_point time_point;
+    typedef TimerWheel::duration duration;
+    typedef TimerWheel::timer_id timer_id;
+
+    // The handshake events deferred by the handshake budget, and how long
+    // they waited.
+    struct HandshakeStats
+    {
+      std::size_t deferred { 0 };
+      std::size_t handled { 0 };
+      std::size_t queued { 0 };
+      std::size_t high_water { 0 };
+      duration total_wait { 0 };
+      duration max_wait { 0 };
+
+      duration mean_wait() const noexcept
+      {
+        return handled == 0 ? duration { 0 } : total_wait / static_cast<duration::rep>(handled);
+      }
+    };
 
   private:
-    handler_map handlers_;
-
-    inline static sig_atomic_t last_signal_ = 0;
+    // Handlers are held in a table indexed by file descriptor. The
+    // generation distinguishes successive handlers for a reused descriptor.
+    struct Slot
+    {
+      handler_pointer handler;
+      std::int16_t events { 0 };
+      std::uint32_t generation { 0 };
+      bool is_closing { false };
+      bool is_dirty { false };
+      // The events of a handshake waiting for the budget.
+      std::int16_t pending_events { 0 };
+    };
+
+    struct PendingHandshake
+    {
+      int fd;
+      std::uint32_t generation;
+      time_point queued_at;
+    };
+
+    // The timers are declared before the handlers, as handlers cancel their
+    // timers when they are destroyed.
+    TimerWheel timers_;
+    time_point now_ { clock_type::now() };
+    std::vector<Slot> slots_;
+    std::vector<std::pair<int, std::uint32_t>> closed_;
+    std::vector<std::pair<int, std::uint32_t>> dirty_;
+    bool is_write_through_ { true };
+    std::size_t max_input_size_ { 1024 * 1024 };
+    std::unique_ptr<Multiplexer> multiplexer_;
+    std::vector<pollfd> active_;
+    std::shared_ptr<TaskQueue> tasks_ { std::make_shared<TaskQueue>() };
+    std::atomic<bool> is_stopping_ { false };
+    std::optional<duration> handshake_budget_;
+    std::deque<PendingHandshake> pending_handshakes_;
+    HandshakeStats handshake_stats_;
+
+    // The signal received since the last iteration, and the poller each
+    // signal was registered with.
+    std::atomic<int> last_signal_ { 0 };
+    inline static std::array<std::atomic<Poller*>, NSIG> signal_pollers_ {};
 
   public:
     std::optional<std::function<void()>> on_startup;
     std::optional<std::function<void()>> on_interrupt;
     std::optional<std::function<void(int fd, const std::string& host, std::uint16_t port)>> on_open;
     std::optional<std::function<void(int fd)>> on_close;
-    std::optional<std::function<void(int fd, std::vector<std::vector<char>>&& bufs)>> on_read;
+    // The handler consumes the data it uses from the input.
+    std::optional<std::function<void(int fd, RingBuffer& input)>> on_read;
     std::optional<std::function<void(int fd, std::exception error)>> on_error;
 
   public:
-    Poller()
+    Poller(std::unique_ptr<Multiplexer> multiplexer = make_default_multiplexer())
+      : multiplexer_(std::move(multiplexer))
     {
+      multiplexer_->add(tasks_->waker().fd(), POLLIN);
     }
+    ~Poller()
+    {
+      for (auto& signal_poller : signal_pollers_)
+      {
+        auto self = this;
+        signal_poller.compare_exchange_strong(self, nullptr);
+      }
+    }
+    Poller(const Poller&) = delete;
+    Poller& operator=(const Poller&) = delete;
 
-    void add_handler(handler_pointer handler, const std::string& host, std::uint16_t port) noexcept
+    void add_handler(handler_pointer handler, const std::string& host, std::uint16_t port)
     {
       int fd = handler->fd();
       bool is_listener = handler->is_listener();
-      handlers_[fd] = std::move(handler);
+
+      if (static_cast<std::size_t>(fd) >= slots_.size())
+      {
+        slots_.resize(fd + 1);
+      }
+      else if (slots_[fd].handler)
+      {
+        // The descriptor was closed and reused before the old handler was
+        // removed.
+        remove_handler(fd);
+      }
+
+      auto events = interest(handler.get());
+      if (handler->can_accept())
+        multiplexer_->add_acceptor(fd, events);
+      else if (handler->can_receive())
+        multiplexer_->add_receiver(fd, events);
+      else
+        multiplexer_->add(fd, events);
+
+      auto& slot = slots_[fd];
+      slot.handler = std::move(handler);
+      slot.events = events;
+      slot.is_closing = false;
+      slot.is_dirty = false;
+      slot.pending_events = 0;
+      ++slot.generation;
+
+      slot.handler->attach(*this);
+
       if (!is_listener && on_open)
         (*on_open)(fd, host, port);
+
+      // A handler moved from another poller may already hold data. The slot
+      // is found again as on_open may have added handlers.
+      if (!is_listener && find(fd) != nullptr && !slots_[fd].handler->input().empty())
+      {
+        handle_read(slots_[fd].handler.get());
+        update(fd);
+      }
+    }
+
+    // Remove an open handler without closing it, so it can be added to
+    // another poller. Returns nullptr when there is no open handler. Data
+    // waiting to be written stays with the handler. Data a multiplexer has
+    // received for the handler, but not yet returned, is dropped, as is the
+    // result of a send it is making, so only handlers which read and write
+    // for themselves, such as TLS handlers, should be moved.
+    handler_pointer release_handler(int fd)
+    {
+      if (find(fd) == nullptr)
+        return nullptr;
+
+      auto& slot = slots_[fd];
+      auto handler = std::move(slot.handler);
+      slot.is_dirty = false;
+      slot.pending_events = 0;
+      multiplexer_->remove(fd);
+      handler->detach(*this);
+      return handler;
+    }
+
+    // The message is shared, not copied, so the same message can be written
+    // to many handlers.
+    //
+    // With write through the handler is written at the end of the current
+    // batch of events, rather than waiting for the next poll to report it
+    // writable. The writes made while handling a batch are still sent
+    // together.
+    void write(int fd, Message message) noexcept
+    {
+      if (auto handler = find(fd); handler != nullptr)
+      {
+        handler->enqueue(std::move(message));
+        written(fd);
+      }
     }
 
-    void write(int fd, const std::vector<char>& buf) noexcept
+    // Write a region of a file. Where the handler supports it the kernel
+    // copies the file to the socket. This throws if the file cannot be read.
+    void write(int fd, FileRegion region)
     {
-      if (auto i = handlers_.find(fd); i != handlers_.end())
+      if (auto handler = find(fd); handler != nullptr)
       {
-        i->second->enqueue(buf);
+        handler->enqueue(std::move(region));
+        written(fd);
       }
     }
 
+    void write(int fd, std::span<const char> data) noexcept
+    {
+      write(fd, Message(data));
+    }
+
+    // Handlers can have the multiplexer send their data with the next wait,
+    // rather than writing it themselves. The result is passed to the
+    // handler's sent.
+    bool can_send() const noexcept { return multiplexer_->can_send(); }
+
+    bool send(int fd, std::span<const iovec> iov, std::span<const Message> messages)
+    {
+      return multiplexer_->send(fd, iov, messages);
+    }
+
+    // A handler with more to send after its queued send calls this, so the
+    // next wait does not block before the send is passed to sent.
+    void send_more() { multiplexer_->send_more(); }
+
+    // Make the queued sends now. A handler with a queued send must do this
+    // before it closes its descriptor.
+    void submit() { multiplexer_->submit(); }
+
     void close(int fd) noexcept
     {
-      if (auto i = handlers_.find(fd); i != handlers_.end())
+      if (auto handler = find(fd); handler != nullptr)
       {
-        i->second->close();
+        handler->close();
+        update(fd);
       }
     }
 
+    // Limit the time each iteration spends on TLS handshakes. Events for
+    // connections still handshaking are queued, and handled after the
+    // events of established connections, oldest first, until the budget is
+    // spent. At least one is handled each iteration, and the poller does not
+    // wait while any are queued. Without a budget events are handled in the
+    // order they arrive.
+    void handshake_budget(std::optional<duration> budget) noexcept { handshake_budget_ = budget; }
+    const std::optional<duration>& handshake_budget() const noexcept { return handshake_budget_; }
+
+    HandshakeStats handshake_stats() const noexcept
+    {
+      auto stats = handshake_stats_;
+      stats.queued = pending_handshakes_.size();
+      return stats;
+    }
+
+    // A handler's input grows, up to this size, when it fills with data
+    // on_read does not consume. A handler whose input is full at this size
+    // is closed with an error.
+    std::size_t max_input_size() const noexcept { return max_input_size_; }
+    void max_input_size(std::size_t size) noexcept { max_input_size_ = size; }
+
+    bool write_through() const noexcept { return is_write_through_; }
+    void write_through(bool value) noexcept { is_write_through_ = value; }
+
+    // The time the current batch of events was received.
+    time_point now() const noexcept { return now_; }
+
+    timer_id schedule_at(time_point when, std::function<void()> callback)
+    {
+      return timers_.schedule_at(when, std::move(callback));
+    }
+
+    timer_id schedule_after(duration delay, std::function<void()> callback)
+    {
+      return timers_.schedule_at(clock_type::now() + delay, std::move(callback));
+    }
+
+    // Returns false if the timer has already fired or been cancelled.
+    bool cancel(timer_id id) noexcept
+    {
+      return timers_.cancel(id);
+    }
+
     void event_loop()
     {
       if (on_startup)
         (*on_startup)();
 
-      while (true) {
+      while (!is_stopping_) {
+        run_once();
+      }
+    }
 
-        std::vector<pollfd> fds = make_poll_fds();
+    // Ask the event loop to return. This may be called from another thread.
+    void stop() noexcept
+    {
+      is_stopping_ = true;
+      tasks_->waker().wake();
+    }
+
+    // Run a function on the poller's thread. This may be called from another
+    // thread.
+    void post(TaskQueue::task_type task)
+    {
+      tasks_->post(std::move(task));
+    }
+
+    // The queue behind post, which may be kept by other threads. Posting to
+    // it after the poller has gone is safe, but the function is not run.
+    std::weak_ptr<TaskQueue> tasks() const noexcept { return tasks_; }
+
+    // Wait for, and process, a single batch of events. The wait ends when the
+    // next timer is due, and a timeout of -1 waits until then. Signals
+    // interrupt the wait.
+    void run_once(int timeout = -1)
+    {
+      // Writes made before the loop started, or between calls, are sent
+      // before waiting.
+      flush_dirty_handlers();
+
+      multiplexer_->wait(active_, pending_handshakes_.empty() ? wait_timeout(timeout) : 0);
+      now_ = clock_type::now();
+
+      // The sends complete first, so handlers know what is still queued.
+      for (const auto& sent : multiplexer_->sent())
+      {
+        handle_sent(sent);
+      }
+
+      for (const auto& poll_state : active_)
+      {
+        handle_event(poll_state);
+      }
+
+      for (const auto& received : multiplexer_->received())
+      {
+        handle_received(received);
+      }
 
-        int active_fd_count = poll(fds, 1000);
+      for (const auto& accepted : multiplexer_->accepted())
+      {
+        handle_accepted(accepted);
+      }
 
-        if (Poller::last_signal_ != 0)
+      // The signal is taken after the waker has been drained, so one which
+      // arrives later wakes the next wait.
+      if (last_signal_.exchange(0, std::memory_order_acquire) != 0)
+      {
+        try
         {
-          Poller::last_signal_ = 0;
-          try
-          {
-            if (on_interrupt)
-              (*on_interrupt)();
-          }
-          catch (...)
-          {
-          }
+          if (on_interrupt)
+            (*on_interrupt)();
         }
-
-        for (const auto& poll_state : fds)
+        catch (...)
         {
-          if (poll_state.revents == 0)
-          {
-            continue; // no events for file descriptor.
-          }
+        }
+      }
 
-          handle_event(poll_state);
+      handle_pending_handshakes();
 
-          if (--active_fd_count == 0)
-            break;
-        }
+      timers_.advance(now_);
 
-        remove_closed_handlers();
-      }
+      tasks_->run();
+
+      flush_dirty_handlers();
+
+      remove_closed_handlers();
     }
 
-    static void register_signal(int signum)
+    // Call on_interrupt on this poller when the signal is received, on
+    // whichever thread the signal is delivered to. A signal belongs to the
+    // last poller it was registered with.
+    void register_signal(int signum)
     {
+      if (signum <= 0 || signum >= NSIG)
+        throw std::invalid_argument("invalid signal");
+      signal_pollers_[signum].store(this, std::memory_order_release);
+
       struct sigaction action;
       action.sa_handler = &handle_signal;
       sigemptyset(&action.sa_mask);
@@ -147,11 +458,56 @@ namespace jetblack::io
 
   private:
 
+    int wait_timeout(int timeout) const noexcept
+    {
+      auto next = timers_.timeout(clock_type::now());
+      if (next == -1)
+        return timeout;
+      if (timeout == -1)
+        return next;
+      return std::min(next, timeout);
+    }
+
+    // Find an open handler. Handlers waiting to be removed are not returned.
+    PollHandler* find(int fd) noexcept
+    {
+      if (fd < 0 || static_cast<std::size_t>(fd) >= slots_.size())
+        return nullptr;
+
+      auto& slot = slots_[fd];
+      if (!slot.handler || slot.is_closing)
+        return nullptr;
+
+      return slot.handler.get();
+    }
+
     void handle_event(const pollfd& poll_state)
     {
-      auto handler = handlers_[poll_state.fd].get();
+      if (poll_state.fd == tasks_->waker().fd())
+      {
+        // The posted functions are run after the events.
+        tasks_->waker().drain();
+        return;
+      }
+
+      auto handler = find(poll_state.fd);
+      if (handler == nullptr)
+        return; // the handler was closed by an earlier event.
+
+      if (handshake_budget_ && handler->is_handshaking())
+      {
+        defer_handshake(poll_state.fd, poll_state.revents);
+        return;
+      }
+
+      handle_event(handler, poll_state.revents);
+      // The slot is found again as the handlers may have been added.
+      update(poll_state.fd);
+    }
 
-      if ((poll_state.revents & POLLIN) == POLLIN)
+    void handle_event(PollHandler* handler, std::int16_t revents)
+    {
+      if ((revents & POLLIN) == POLLIN)
       {
         if (handler->is_listener())
         {
@@ -163,34 +519,137 @@ namespace jetblack::io
           return;
       }
 
-      if ((poll_state.revents & POLLOUT) == POLLOUT)
+      if ((revents & POLLOUT) == POLLOUT)
       {
         if (!handle_write(handler))
           return;
       }
     }
 
-    bool handle_read(PollHandler* handler) noexcept
+    void handle_received(const Received& received)
     {
-      log.trace(std::format("handling read for {}", handler->fd()));
+      auto handler = find(received.fd);
+      if (handler == nullptr)
+        return; // the handler was closed by an earlier event.
+
+      handle_receive(handler, received.data);
+      update(received.fd);
+    }
+
+    void handle_accepted(const Accepted& accepted)
+    {
+      auto handler = find(accepted.listener_fd);
+      if (handler == nullptr)
+      {
+        // The listener was closed by an earlier event.
+        ::close(accepted.fd);
+        return;
+      }
 
       try
       {
-        auto can_continue = handler->read(*this);
+        handler->accept(*this, accepted.fd);
+      }
+      catch(const std::exception& error)
+      {
+        log.warning("failed to add connection {} from {}: {}", accepted.fd, accepted.listener_fd, error.what());
+      }
+      update(accepted.listener_fd);
+    }
 
-        std::vector<std::vector<char>> bufs;
-        auto buf = handler->dequeue();
-        while (buf)
-        {
-          bufs.push_back(*buf);
-          buf = handler->dequeue();
-        }
+    void handle_sent(const Sent& sent)
+    {
+      auto handler = find(sent.fd);
+      if (handler == nullptr)
+        return; // the handler was closed after the send was queued.
+
+      try
+      {
+        handler->sent(*this, sent.result);
+      }
+      catch(const std::exception& error)
+      {
+        if (on_error)
+          (*on_error)(sent.fd, error);
+      }
+      update(sent.fd);
+    }
+
+    // Queue the events of a handshake. A handler already queued keeps its
+    // place, and the events are combined.
+    void defer_handshake(int fd, std::int16_t revents)
+    {
+      auto& slot = slots_[fd];
+      if (slot.pending_events == 0)
+      {
+        pending_handshakes_.push_back(PendingHandshake { fd, slot.generation, now_ });
+        ++handshake_stats_.deferred;
+        handshake_stats_.high_water = std::max(handshake_stats_.high_water, pending_handshakes_.size());
+      }
+      slot.pending_events |= revents;
+    }
 
-        if (!bufs.empty())
+    void handle_pending_handshakes()
+    {
+      if (pending_handshakes_.empty())
+        return;
+
+      // When the budget has been removed the queue is emptied.
+      auto deadline = handshake_budget_ ? clock_type::now() + *handshake_budget_ : time_point::max();
+      bool is_first = true;
+      while (!pending_handshakes_.empty() && (is_first || clock_type::now() < deadline))
+      {
+        auto pending = pending_handshakes_.front();
+        pending_handshakes_.pop_front();
+
+        auto& slot = slots_[pending.fd];
+        if (slot.generation != pending.generation)
+          continue; // the handler was replaced.
+
+        auto revents = std::exchange(slot.pending_events, 0);
+        auto handler = find(pending.fd);
+        if (handler == nullptr || revents == 0)
+          continue; // the handler was closed or released.
+
+        auto wait = clock_type::now() - pending.queued_at;
+        ++handshake_stats_.handled;
+        handshake_stats_.total_wait += wait;
+        handshake_stats_.max_wait = std::max(handshake_stats_.max_wait, wait);
+
+        is_first = false;
+        handle_event(handler, revents);
+        update(pending.fd);
+      }
+    }
+
+    bool handle_read(PollHandler* handler) noexcept
+    {
+      log.trace("handling read for {}", handler->fd());
+
+      try
+      {
+        // The data is passed to on_read in place. Anything not consumed is
+        // kept for the next read. When the input fills up reading stops
+        // until space is consumed, so TLS data already decrypted is read
+        // again here rather than waiting for the socket.
+        bool can_continue = true;
+        bool was_full = false;
+        auto& input = handler->input();
+        do
         {
-          if (on_read)
-            (*on_read)(handler->fd(), std::move(bufs));
+          can_continue = handler->read(*this);
+          was_full = input.full();
+
+          auto size = input.size();
+          if (!input.empty() && on_read)
+            (*on_read)(handler->fd(), input);
+
+          // A full input which on_read left untouched holds the start of a
+          // message which cannot complete, and reading would stop for good.
+          if (can_continue && input.full() && input.size() == size)
+            grow_input(handler, input);
         }
+        while (can_continue && was_full && !input.full());
 
         return can_continue;
       }
@@ -202,9 +661,56 @@ namespace jetblack::io
       }
     }
 
+    // Pass the data the multiplexer read to on_read, as handle_read does
+    // with the data a handler reads itself. The data is all taken, so the
+    // input grows while on_read consumes none of it.
+    void handle_receive(PollHandler* handler, std::span<const char> data) noexcept
+    {
+      log.trace("handling received data for {}", handler->fd());
+
+      try
+      {
+        auto& input = handler->input();
+        if (data.empty())
+          handler->receive(*this, data);
+
+        while (!data.empty() && handler->is_open())
+        {
+          data = data.subspan(handler->receive(*this, data));
+
+          auto size = input.size();
+          if (!input.empty() && on_read)
+            (*on_read)(handler->fd(), input);
+
+          if (input.full() && input.size() == size)
+            grow_input(handler, input);
+        }
+      }
+      catch(const std::exception& error)
+      {
+        if (on_error)
+          (*on_error)(handler->fd(), error);
+      }
+    }
+
+    // Double the input, up to the largest size, or close the handler.
+    void grow_input(PollHandler* handler, RingBuffer& input)
+    {
+      if (input.capacity() >= max_input_size_)
+      {
+        log.warning("closing {}: the input is full at {} bytes and nothing was consumed", handler->fd(), input.capacity());
+        handler->close();
+        throw std::length_error(std::format("input full at {} bytes with nothing consumed", input.capacity()));
+      }
+
+      auto capacity = std::min(input.capacity() * 2, max_input_size_);
+      log.debug("growing the input of {} to {} bytes", handler->fd(), capacity);
+      input.grow(capacity);
+    }
+
     bool handle_write(PollHandler* handler) noexcept
     {
-      log.trace(std::format("handling write for {}", handler->fd()));
+      log.trace("handling write for {}", handler->fd());
 
       try
       {
@@ -218,63 +724,139 @@ namespace jetblack::io
       }
     }
 
-    std::vector<pollfd> make_poll_fds()
+    static std::int16_t interest(const PollHandler* handler) noexcept
     {
-      std::vector<pollfd> fds;
+      std::int16_t flags = POLLPRI | POLLERR | POLLHUP | POLLNVAL;
 
-      for (auto& [fd, handler] : handlers_)
+      if (handler->want_read())
       {
-        int16_t flags = POLLPRI | POLLERR | POLLHUP | POLLNVAL;
+          flags |= POLLIN;
+      }
 
-        if (handler->want_read())
-        {
-            flags |= POLLIN;
-        }
+      if (handler->want_write())
+      {
+          flags |= POLLOUT;
+      }
 
-        if (handler->want_write())
-        {
-            flags |= POLLOUT;
-        }
+      return flags;
+    }
 
-        fds.push_back(pollfd{fd, flags, 0});
+    // Called when data has been queued on a handler.
+    void written(int fd) noexcept
+    {
+      auto& slot = slots_[fd];
+      if (is_write_through_ && !slot.is_dirty)
+      {
+        slot.is_dirty = true;
+        dirty_.emplace_back(fd, slot.generation);
       }
 
-      return fds;
+      update(fd);
     }
 
-    void remove_closed_handlers()
+    // Write the handlers with queued data. Only the data the socket will not
+    // take is left for the poller to report writable.
+    void flush_dirty_handlers() noexcept
     {
-      auto closed_fds = find_closed_handler_fds();
-      remove_closed_handlers(closed_fds);
+      // Writing can fail and close handlers, which can write to others
+      // through the callbacks.
+      while (!dirty_.empty())
+      {
+        std::vector<std::pair<int, std::uint32_t>> dirty;
+        dirty.swap(dirty_);
+
+        for (auto [fd, generation] : dirty)
+        {
+          auto& slot = slots_[fd];
+          if (!slot.is_dirty || slot.generation != generation)
+            continue;
+
+          slot.is_dirty = false;
+          if (auto handler = find(fd); handler != nullptr)
+          {
+            handle_write(handler);
+            update(fd);
+          }
+        }
+      }
     }
 
-    std::vector<int> find_closed_handler_fds()
+    // Called after a handler has been used. A closed handler is put on the
+    // closed list, otherwise the multiplexer is told if the interest has
+    // changed. The interest of a handler waiting to be flushed is left until
+    // it has been written.
+    void update(int fd) noexcept
     {
-      std::vector<int> closed_fds;
-      for (auto& [fd, handler] : handlers_)
+      auto& slot = slots_[fd];
+
+      if (!slot.handler->is_open())
       {
-        if (!handler->is_open())
+        if (!slot.is_closing)
         {
-          closed_fds.push_back(fd);
+          slot.is_closing = true;
+          closed_.emplace_back(fd, slot.generation);
         }
+        return;
+      }
+
+      if (slot.is_dirty)
+        return;
+
+      auto events = interest(slot.handler.get());
+      if (events == slot.events)
+        return;
+
+      try
+      {
+        multiplexer_->modify(fd, events);
+        slot.events = events;
+      }
+      catch (const std::exception& error)
+      {
+        log.error("failed to update interest for {}: {}", fd, error.what());
+        slot.handler->close();
+        update(fd);
       }
-      return closed_fds;
     }
 
-    void remove_closed_handlers(const std::vector<int>& closed_fds)
+    void remove_closed_handlers()
     {
-      for (auto fd : closed_fds)
+      // Removing a handler can close others through the callbacks.
+      while (!closed_.empty())
       {
-        auto handler = std::move(handlers_[fd]);
-        handlers_.erase(fd);
-        if (!handler->is_listener() && on_close)
-          (*on_close)(fd);
+        std::vector<std::pair<int, std::uint32_t>> closed;
+        closed.swap(closed_);
+
+        for (auto [fd, generation] : closed)
+        {
+          auto& slot = slots_[fd];
+          if (slot.handler && slot.generation == generation)
+            remove_handler(fd);
+        }
       }
     }
 
+    void remove_handler(int fd)
+    {
+      auto handler = std::move(slots_[fd].handler);
+      slots_[fd].is_closing = false;
+      slots_[fd].pending_events = 0;
+      multiplexer_->remove(fd);
+      if (!handler->is_listener() && on_close)
+        (*on_close)(fd);
+    }
+
     static void handle_signal(int signum)
     {
-      Poller::last_signal_ = signum;
+      auto poller = signal_pollers_[signum].load(std::memory_order_acquire);
+      if (poller == nullptr)
+        return;
+
+      // The waker writes to a descriptor, which is safe in a handler.
+      auto saved_errno = errno;
+      poller->last_signal_.store(signum, std::memory_order_release);
+      poller->tasks_->waker().wake();
+      errno = saved_errno;
     }
 
   };
@@ -0,0 +1,175 @@
+#ifndef SQUAWKBUS_IO_REACTOR_POOL_HPP
+#define SQUAWKBUS_IO_REACTOR_POOL_HPP
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+
+#include <cstddef>
+#include <exception>
+#include <format>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "io/logger.hpp"
+#include "io/multiplexer.hpp"
+#include "io/poller.hpp"
+
+namespace jetblack::io
+{
+  // Run a number of reactors, each with its own thread and poller.
+  //
+  // The setup function is called on each reactor's thread to add its
+  // handlers and callbacks. Typically each reactor adds a listener bound to
+  // the same port with SO_REUSEPORT, so the kernel spreads the connections
+  // across the threads.
+  //
+  // The first reactor runs on the calling thread. The others block all
+  // signals, so the signal handlers run on the first reactor's thread. A
+  // signal is handled by the poller it was registered with, which wakes
+  // for it whichever thread it arrives on.
+  class ReactorPool
+  {
+  public:
+    typedef std::function<void(Poller& poller, std::size_t index)> setup_function;
+    typedef std::function<std::unique_ptr<Multiplexer>()> multiplexer_factory;
+
+  private:
+    std::size_t threads_;
+    bool pin_cpus_;
+    multiplexer_factory make_multiplexer_;
+    std::mutex key_;
+    std::vector<Poller*> pollers_;
+    bool is_stopping_ { false };
+
+  public:
+    ReactorPool(
+      std::size_t threads,
+      bool pin_cpus = false,
+      multiplexer_factory make_multiplexer = make_default_multiplexer)
+      : threads_(threads == 0 ? 1 : threads),
+        pin_cpus_(pin_cpus),
+        make_multiplexer_(std::move(make_multiplexer))
+    {
+    }
+    ReactorPool(const ReactorPool&) = delete;
+    ReactorPool& operator=(const ReactorPool&) = delete;
+
+    std::size_t threads() const noexcept { return threads_; }
+
+    // Run the reactors until they are all stopped. An exception from any
+    // reactor stops the others and is rethrown.
+    void run(setup_function setup)
+    {
+      std::vector<std::exception_ptr> errors(threads_);
+      std::vector<std::thread> threads;
+
+      for (std::size_t index = 1; index < threads_; ++index)
+      {
+        threads.emplace_back(
+          [this, index, &setup, &errors]()
+          {
+            sigset_t signals;
+            sigfillset(&signals);
+            pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+            errors[index] = run_reactor(setup, index);
+          });
+      }
+
+      errors[0] = run_reactor(setup, 0);
+
+      for (auto& thread : threads)
+        thread.join();
+
+      for (auto& error : errors)
+      {
+        if (error)
+          std::rethrow_exception(error);
+      }
+    }
+
+    void stop() noexcept
+    {
+      std::scoped_lock lock(key_);
+      is_stopping_ = true;
+      for (auto poller : pollers_)
+        poller->stop();
+    }
+
+  private:
+    std::exception_ptr run_reactor(setup_function& setup, std::size_t index) noexcept
+    {
+      try
+      {
+        if (pin_cpus_)
+          pin_cpu(index);
+
+        auto poller = Poller(make_multiplexer_());
+        setup(poller, index);
+
+        if (!attach(poller))
+          return nullptr;
+
+        log.debug("starting reactor {}", index);
+        try
+        {
+          poller.event_loop();
+        }
+        catch (...)
+        {
+          detach(poller);
+          throw;
+        }
+        log.debug("stopped reactor {}", index);
+
+        detach(poller);
+        return nullptr;
+      }
+      catch (...)
+      {
+        stop();
+        return std::current_exception();
+      }
+    }
+
+    bool attach(Poller& poller)
+    {
+      std::scoped_lock lock(key_);
+      if (is_stopping_)
+        return false;
+      pollers_.push_back(&poller);
+      return true;
+    }
+
+    void detach(Poller& poller)
+    {
+      std::scoped_lock lock(key_);
+      std::erase(pollers_, &poller);
+    }
+
+    static void pin_cpu([[maybe_unused]] std::size_t index)
+    {
+#ifdef __linux__
+      auto cpus = std::thread::hardware_concurrency();
+      if (cpus == 0)
+        return;
+
+      cpu_set_t cpu_set;
+      CPU_ZERO(&cpu_set);
+      CPU_SET(index % cpus, &cpu_set);
+      int result = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+      if (result != 0)
+        throw std::system_error(result, std::generic_category(), "failed to pin thread to cpu");
+#else
+      log.warning("pinning threads to cpus is not supported on this platform");
+#endif
+    }
+  };
+}
+
+#endif // SQUAWKBUS_IO_REACTOR_POOL_HPP
@@ -0,0 +1,198 @@
+#ifndef SQUAWKBUS_IO_RING_BUFFER_HPP
+#define SQUAWKBUS_IO_RING_BUFFER_HPP
+
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+
+#include "io/buffer_pool.hpp"
+
+namespace jetblack::io
+{
+  // A fixed size ring of bytes, used by a connection to hold the data it
+  // has read until it is consumed.
+  //
+  // The data and the free space are each at most two spans, as they may
+  // wrap around the end of the storage. The storage is taken from the
+  // buffer pool when it is first needed, and can be given back while the
+  // ring is empty. A ring which has grown returns to its first capacity
+  // when it is emptied.
+  class RingBuffer
+  {
+  private:
+    Buffer storage_;
+    std::size_t initial_capacity_;
+    std::size_t capacity_;
+    bool is_releasing_ { false };
+    // The positions increase without wrapping, and are masked when used.
+    std::size_t head_ { 0 };
+    std::size_t tail_ { 0 };
+
+  public:
+    // The capacity is rounded up to a power of two.
+    explicit RingBuffer(std::size_t capacity)
+      : initial_capacity_(std::bit_ceil(std::max<std::size_t>(capacity, 1))),
+        capacity_(initial_capacity_)
+    {
+    }
+
+    std::size_t capacity() const noexcept { return capacity_; }
+    // The bytes of storage held, which is zero until it is first needed.
+    std::size_t allocated() const noexcept { return storage_.capacity(); }
+
+    // Give the storage back to the pool whenever the data is all consumed,
+    // so an idle ring holds no memory.
+    void release_when_empty(bool is_releasing) noexcept
+    {
+      is_releasing_ = is_releasing;
+      if (is_releasing_)
+        release();
+    }
+    bool release_when_empty() const noexcept { return is_releasing_; }
+
+    // Give the storage back to the pool if the ring is empty.
+    void release() noexcept
+    {
+      if (empty())
+        storage_ = Buffer();
+    }
+    std::size_t size() const noexcept { return tail_ - head_; }
+    std::size_t available() const noexcept { return capacity_ - size(); }
+    bool empty() const noexcept { return head_ == tail_; }
+    bool full() const noexcept { return size() == capacity_; }
+
+    // The data in order. The second span is empty unless the data wraps.
+    std::array<std::span<const char>, 2> data() const noexcept
+    {
+      if (empty())
+        return {};
+
+      auto start = head_ & (capacity_ - 1);
+      auto first = std::min(size(), capacity_ - start);
+      return {
+        std::span<const char>(storage_.data() + start, first),
+        std::span<const char>(storage_.data(), size() - first)
+      };
+    }
+
+    // The free space in order. The second span is empty unless it wraps.
+    std::array<std::span<char>, 2> free_space()
+    {
+      if (full())
+        return {};
+
+      if (storage_.capacity() == 0)
+        storage_ = BufferPool::local().allocate(capacity_);
+
+      auto start = tail_ & (capacity_ - 1);
+      auto first = std::min(available(), capacity_ - start);
+      return {
+        std::span<char>(storage_.data() + start, first),
+        std::span<char>(storage_.data(), available() - first)
+      };
+    }
+
+    // Fill an iovec array with the free space, returning the count used.
+    int free_space(std::array<iovec, 2>& iov)
+    {
+      int count = 0;
+      for (auto span : free_space())
+      {
+        if (!span.empty())
+          iov[count++] = iovec { span.data(), span.size() };
+      }
+      return count;
+    }
+
+    // Mark bytes written to the free space as data.
+    void commit(std::size_t count)
+    {
+      if (count > available())
+        throw std::length_error("commit exceeds the free space");
+      tail_ += count;
+    }
+
+    // Copy bytes to the free space, and commit them, returning the count
+    // copied.
+    std::size_t append(std::span<const char> src)
+    {
+      std::size_t count = 0;
+      for (auto span : free_space())
+      {
+        auto n = std::min(span.size(), src.size() - count);
+        if (n == 0)
+          break;
+        std::memcpy(span.data(), src.data() + count, n);
+        count += n;
+      }
+      tail_ += count;
+      return count;
+    }
+
+    // Discard bytes from the front of the data.
+    void consume(std::size_t count)
+    {
+      if (count > size())
+        throw std::length_error("consume exceeds the data");
+      head_ += count;
+      if (head_ == tail_)
+      {
+        head_ = tail_ = 0; // keep the next read contiguous.
+        if (is_releasing_ || capacity_ != initial_capacity_)
+        {
+          storage_ = Buffer();
+          capacity_ = initial_capacity_;
+        }
+      }
+    }
+
+    // Move the data to larger storage, so a message longer than the ring
+    // can be completed. The capacity is rounded up to a power of two.
+    void grow(std::size_t capacity)
+    {
+      capacity = std::bit_ceil(capacity);
+      if (capacity <= capacity_)
+        return;
+
+      auto storage = BufferPool::local().allocate(capacity);
+      auto count = copy(storage.span());
+      storage_ = std::move(storage);
+      capacity_ = capacity;
+      head_ = 0;
+      tail_ = count;
+    }
+
+    // Copy bytes from the front of the data, returning the count copied.
+    std::size_t copy(std::span<char> dest) const noexcept
+    {
+      std::size_t count = 0;
+      for (auto span : data())
+      {
+        auto n = std::min(span.size(), dest.size() - count);
+        if (n == 0)
+          break;
+        std::memcpy(dest.data() + count, span.data(), n);
+        count += n;
+      }
+      return count;
+    }
+
+    // Move bytes from the front of the data into a pooled buffer.
+    Buffer read(std::size_t count)
+    {
+      count = std::min(count, size());
+      auto buf = BufferPool::local().allocate(count);
+      copy(buf.span());
+      consume(count);
+      return buf;
+    }
+  };
+}
+
+#endif // SQUAWKBUS_IO_RING_BUFFER_HPP
@@ -1,7 +1,11 @@
 #ifndef SQUAWKBUS_IO_SSL_HPP
 #define SQUAWKBUS_IO_SSL_HPP
 
+#include <cstddef>
 #include <format>
+#include <memory>
+#include <optional>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <utility>
@@ -11,7 +15,10 @@
 #include <openssl/err.h>
 #include <openssl/bio.h>
 
+#include "io/endpoint.hpp"
 #include "io/file_types.hpp"
+#include "io/openssl_error.hpp"
+#include "io/ssl_session_store.hpp"
 
 namespace jetblack::io
 {
@@ -21,6 +28,10 @@ namespace jetblack::io
   private:
     SSL* ssl_;
     bool is_owner_;
+    // Set by the socket BIO when the last read from the socket returned
+    // less than was asked for. The flag is on the heap as the BIO holds its
+    // address.
+    std::unique_ptr<bool> is_socket_drained_;
 
   public:
     Ssl(SSL* ssl, bool is_owner) noexcept
@@ -28,6 +39,27 @@ namespace jetblack::io
         is_owner_(is_owner)
     {
     }
+
+    // A connection which reads and writes the socket directly, rather than
+    // through a chain of BIOs.
+    Ssl(SSL_CTX* ctx, int fd, bool is_client)
+      : Ssl(SSL_new(ctx), true)
+    {
+      if (ssl_ == nullptr)
+        throw std::runtime_error(openssl_strerror());
+      if (SSL_set_fd(ssl_, fd) != 1)
+        throw std::runtime_error(openssl_strerror());
+
+      if (is_client)
+        SSL_set_connect_state(ssl_);
+      else
+        SSL_set_accept_state(ssl_);
+
+      is_socket_drained_ = std::make_unique<bool>(false);
+      auto rbio = SSL_get_rbio(ssl_);
+      BIO_set_callback_ex(rbio, &on_socket_read);
+      BIO_set_callback_arg(rbio, reinterpret_cast<char*>(is_socket_drained_.get()));
+    }
     ~Ssl() noexcept
     {
       if (is_owner_)
@@ -46,10 +78,13 @@ namespace jetblack::io
     {
       ssl_ = other.ssl_;
       is_owner_ = other.is_owner_;
+      is_socket_drained_ = std::move(other.is_socket_drained_);
       other.ssl_ = nullptr;
       return *this;
     }
 
+    SSL* ptr() noexcept { return ssl_; }
+
     int error(int ret = 0) const noexcept
     {
       return SSL_get_error(ssl_, ret);
@@ -121,6 +156,62 @@ namespace jetblack::io
       }
     }
 
+    // Returns nullopt when nothing was read; the reason is found with
+    // error().
+    std::optional<std::size_t> read(std::span<char> buf) noexcept
+    {
+      std::size_t readbytes;
+      if (SSL_read_ex(ssl_, buf.data(), buf.size(), &readbytes) != 1)
+        return std::nullopt;
+      return readbytes;
+    }
+
+    std::optional<std::size_t> write(std::span<const char> buf) noexcept
+    {
+      std::size_t written;
+      if (SSL_write_ex(ssl_, buf.data(), buf.size(), &written) != 1)
+        return std::nullopt;
+      return written;
+    }
+
+    // Write early data before the handshake completes. Returns nullopt when
+    // nothing was written; the reason is found with error().
+    std::optional<std::size_t> write_early_data(std::span<const char> buf) noexcept
+    {
+      std::size_t written;
+      if (SSL_write_early_data(ssl_, buf.data(), buf.size(), &written) != 1)
+        return std::nullopt;
+      return written;
+    }
+
+    // Read early data before the handshake completes. Returns one of the
+    // SSL_READ_EARLY_DATA codes, with the bytes read.
+    int read_early_data(std::span<char> buf, std::size_t& readbytes) noexcept
+    {
+      return SSL_read_early_data(ssl_, buf.data(), buf.size(), &readbytes);
+    }
+
+    // The early data the session being resumed allows, or zero when there
+    // is no session, or it allows none.
+    std::size_t max_early_data() const noexcept
+    {
+      auto session = SSL_get0_session(ssl_);
+      return session == nullptr ? 0 : SSL_SESSION_get_max_early_data(session);
+    }
+
+    int early_data_status() const noexcept { return SSL_get_early_data_status(ssl_); }
+
+    // True when records, or part of a record, have been read from the
+    // socket but not yet returned.
+    bool has_pending() const noexcept { return SSL_has_pending(ssl_) == 1; }
+
+    // True when the last read from the socket emptied it, so there is no
+    // need to read again until the socket is ready.
+    bool is_socket_drained() const noexcept { return is_socket_drained_ && *is_socket_drained_; }
+
+    bool want_read() const noexcept { return SSL_want_read(ssl_); }
+    bool want_write() const noexcept { return SSL_want_write(ssl_); }
+
     void tlsext_host_name(const std::string& host_name)
     {
       // Set hostname for SNI.
@@ -188,6 +279,39 @@ namespace jetblack::io
       }
     }
 
+    // Offer the stored session for the endpoint, if there is one, and store
+    // the sessions the server sends.
+    void resume(SslSessionStore& store, const Endpoint& endpoint)
+    {
+      if (SSL_set_ex_data(ssl_, SslSessionStore::endpoint_index(), new Endpoint(endpoint)) != 1)
+        throw std::runtime_error("failed to set the session endpoint");
+
+      if (auto session = store.get(endpoint); session != nullptr)
+      {
+        int result = SSL_set_session(ssl_, session);
+        SSL_SESSION_free(session);
+        if (result != 1)
+          throw std::runtime_error("failed to set the session");
+      }
+    }
+
+    bool session_reused() const noexcept
+    {
+      return SSL_session_reused(ssl_) == 1;
+    }
+
+    // True when the kernel encrypts the records written.
+    bool ktls_send() const noexcept
+    {
+      return BIO_get_ktls_send(SSL_get_wbio(ssl_));
+    }
+
+    // True when the kernel decrypts the records read.
+    bool ktls_recv() const noexcept
+    {
+      return BIO_get_ktls_recv(SSL_get_rbio(ssl_));
+    }
+
     void quiet_shutdown(bool is_quiet) noexcept
     {
       // This stops BIO_free_all (via SSL_SHUTDOWN) from raising SIGPIPE.
@@ -221,6 +345,25 @@ namespace jetblack::io
 
       throw std::runtime_error("shutdown failed");
     }
+
+  private:
+    static long on_socket_read(
+      BIO* bio,
+      int oper,
+      [[maybe_unused]] const char* argp,
+      std::size_t len,
+      [[maybe_unused]] int argi,
+      [[maybe_unused]] long argl,
+      int ret,
+      std::size_t* processed)
+    {
+      if (oper == (BIO_CB_READ | BIO_CB_RETURN))
+      {
+        auto is_drained = reinterpret_cast<bool*>(BIO_get_callback_arg(bio));
+        *is_drained = ret <= 0 || processed == nullptr || *processed < len;
+      }
+      return ret;
+    }
   };
 
 }
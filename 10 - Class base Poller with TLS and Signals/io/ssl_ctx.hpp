@@ -5,23 +5,69 @@
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <stdexcept> 
 #include <string>
 #include <utility>
 
 #include "io/openssl_error.hpp"
+#include "io/ssl_session_store.hpp"
+#include "io/ssl_ticket_keys.hpp"
 
 namespace jetblack::io
 {
   class SslContext
   {
+  public:
+    // The handshakes completed through the context, and how many resumed an
+    // earlier session. The counts are kept by OpenSSL.
+    struct SessionStats
+    {
+      long handshakes;
+      long resumed;
+      long misses;
+      long timeouts;
+      long cache_full;
+
+      double hit_rate() const noexcept
+      {
+        return handshakes == 0 ? 0.0 : static_cast<double>(resumed) / handshakes;
+      }
+    };
+
+    // The handshakes through the context in which early data was sent,
+    // and whether the server accepted it.
+    struct EarlyDataStats
+    {
+      std::size_t accepted;
+      std::size_t rejected;
+    };
+
+  private:
+    // The connections of a context may be on several threads. The counts
+    // are on the heap so the context can be moved.
+    struct EarlyDataCounts
+    {
+      std::atomic<std::size_t> accepted { 0 };
+      std::atomic<std::size_t> rejected { 0 };
+    };
+
   protected:
     SSL_CTX* ctx_;
+    bool is_early_data_ { false };
+    std::unique_ptr<EarlyDataCounts> early_data_counts_;
+
   public:
     SslContext() = delete;
     SslContext(const SSL_METHOD* method) noexcept
-      : ctx_(SSL_CTX_new(method))
+      : ctx_(SSL_CTX_new(method)),
+        early_data_counts_(std::make_unique<EarlyDataCounts>())
     {
+      read_ahead(true);
     }
     ~SslContext() noexcept
     {
@@ -31,19 +77,52 @@ namespace jetblack::io
     SslContext(const SslContext&) = delete;
     SslContext(SslContext&& other) noexcept
     {
-      ctx_ = other.ctx_;
-      other.ctx_ = nullptr;
+      *this = std::move(other);
     }
     SslContext& operator=(const SslContext&) = delete;
     SslContext& operator=(SslContext&& other) noexcept
     {
       ctx_ = other.ctx_;
+      is_early_data_ = other.is_early_data_;
+      early_data_counts_ = std::move(other.early_data_counts_);
       other.ctx_ = nullptr;
       return *this;
     }
 
     SSL_CTX* ptr() noexcept { return ctx_; }
 
+    SessionStats session_stats() const noexcept
+    {
+      return SessionStats {
+        SSL_CTX_sess_accept_good(ctx_) + SSL_CTX_sess_connect_good(ctx_),
+        SSL_CTX_sess_hits(ctx_),
+        SSL_CTX_sess_misses(ctx_),
+        SSL_CTX_sess_timeouts(ctx_),
+        SSL_CTX_sess_cache_full(ctx_)
+      };
+    }
+
+    // True when connections made with the context send, or accept, TLS 1.3
+    // early data.
+    bool early_data() const noexcept { return is_early_data_; }
+
+    EarlyDataStats early_data_stats() const noexcept
+    {
+      return EarlyDataStats {
+        early_data_counts_->accepted.load(std::memory_order_relaxed),
+        early_data_counts_->rejected.load(std::memory_order_relaxed)
+      };
+    }
+
+    // Count the early data status of a completed handshake.
+    void count_early_data(int status) noexcept
+    {
+      if (status == SSL_EARLY_DATA_ACCEPTED)
+        early_data_counts_->accepted.fetch_add(1, std::memory_order_relaxed);
+      else if (status == SSL_EARLY_DATA_REJECTED)
+        early_data_counts_->rejected.fetch_add(1, std::memory_order_relaxed);
+    }
+
     void min_proto_version(int version)
     {
       if (SSL_CTX_set_min_proto_version(ctx_, version) == 0)
@@ -61,25 +140,107 @@ namespace jetblack::io
       }
     }
     int max_proto_version() const noexcept { return SSL_CTX_get_max_proto_version(ctx_); }
+
+    // With read ahead a read from the socket takes as many records as fit
+    // in the read buffer, rather than a record header and then its body.
+    // It is on by default.
+    void read_ahead(bool is_enabled) noexcept { SSL_CTX_set_read_ahead(ctx_, is_enabled ? 1 : 0); }
+    bool read_ahead() const noexcept { return SSL_CTX_get_read_ahead(ctx_) != 0; }
+
+    // Free the read and write buffers of a connection while they are
+    // empty, which saves around 33KB for each idle connection at the cost
+    // of allocating them again when it is next used.
+    void release_buffers(bool is_enabled) noexcept
+    {
+      if (is_enabled)
+        SSL_CTX_set_mode(ctx_, SSL_MODE_RELEASE_BUFFERS);
+      else
+        SSL_CTX_clear_mode(ctx_, SSL_MODE_RELEASE_BUFFERS);
+    }
+    bool release_buffers() const noexcept { return (SSL_CTX_get_mode(ctx_) & SSL_MODE_RELEASE_BUFFERS) != 0; }
+
+    // The size of the buffer records are read ahead into. OpenSSL's default
+    // holds a single full sized record.
+    void read_buffer_size(std::size_t size) noexcept { SSL_CTX_set_default_read_buffer_len(ctx_, size); }
+
+    // With kernel TLS the keys are handed to the kernel after the handshake,
+    // and the kernel encrypts and decrypts the records. When the kernel or
+    // the negotiated cipher does not support it the connection stays in user
+    // space. Records read ahead of the end of the handshake stop the kernel
+    // taking over decryption, so enabling it turns read ahead off.
+    void ktls(bool is_enabled) noexcept
+    {
+#ifdef SSL_OP_ENABLE_KTLS
+      if (is_enabled)
+      {
+        SSL_CTX_set_options(ctx_, SSL_OP_ENABLE_KTLS);
+        read_ahead(false);
+      }
+      else
+        SSL_CTX_clear_options(ctx_, SSL_OP_ENABLE_KTLS);
+#endif
+    }
+    bool ktls() const noexcept
+    {
+#ifdef SSL_OP_ENABLE_KTLS
+      return (SSL_CTX_get_options(ctx_) & SSL_OP_ENABLE_KTLS) != 0;
+#else
+      return false;
+#endif
+    }
   };
 
   class SslClientContext : public SslContext
   {
+  private:
+    std::shared_ptr<SslSessionStore> session_store_;
+
   public:
     SslClientContext() noexcept
       : SslContext(TLS_client_method())
     {
     }
     SslClientContext(SslClientContext&& other) noexcept
-      : SslContext(std::move(other))
+      : SslContext(std::move(other)),
+        session_store_(std::move(other.session_store_))
     {
     }
     SslClientContext& operator = (SslClientContext&& other) noexcept
     {
       SslContext::operator=(std::move(other));
+      session_store_ = std::move(other.session_store_);
       return *this;
     }
 
+    // Keep the sessions the servers send, so connections to the same
+    // endpoint resume them. The store may be shared between contexts.
+    void session_store(std::shared_ptr<SslSessionStore> store)
+    {
+      session_store_ = std::move(store);
+      if (SSL_CTX_set_ex_data(ctx_, SslSessionStore::ctx_index(), session_store_.get()) != 1)
+        throw std::runtime_error(openssl_strerror());
+
+      if (session_store_)
+      {
+        SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx_, &SslSessionStore::on_new_session);
+      }
+      else
+      {
+        SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_OFF);
+        SSL_CTX_sess_set_new_cb(ctx_, nullptr);
+      }
+    }
+    const std::shared_ptr<SslSessionStore>& session_store() const noexcept { return session_store_; }
+
+    // When resuming a TLS 1.3 session which allows it, send the first
+    // queued message as early data, before the handshake completes. This
+    // saves a round trip, but the server may reject it, in which case it is
+    // sent again once the handshake completes. An attacker can replay early
+    // data, so only requests which are safe to repeat should be sent this
+    // way. It needs a session store.
+    void early_data(bool is_enabled) noexcept { is_early_data_ = is_enabled; }
+
     void verify(int mode = SSL_VERIFY_PEER) noexcept
     {
       SSL_CTX_set_verify(ctx_, mode, nullptr);
@@ -104,20 +265,93 @@ namespace jetblack::io
 
   class SslServerContext : public SslContext
   {
+  private:
+    std::shared_ptr<SslTicketKeys> ticket_keys_;
+
   public:
     SslServerContext() noexcept
       : SslContext(TLS_server_method())
     {
     }
     SslServerContext(SslServerContext&& other) noexcept
-      : SslContext(std::move(other))
+      : SslContext(std::move(other)),
+        ticket_keys_(std::move(other.ticket_keys_))
     {
     }
     SslServerContext& operator = (SslServerContext&& other) noexcept
     {
       SslContext::operator=(std::move(other));
+      ticket_keys_ = std::move(other.ticket_keys_);
       return *this;
     }
+
+    // Keep up to size sessions in memory, so clients can resume with a
+    // session id. A size of zero turns the cache off. Clients which
+    // support tickets resume with those instead, and need no cache.
+    void session_cache(std::size_t size, std::chrono::seconds timeout = std::chrono::seconds(300))
+    {
+      if (size == 0)
+      {
+        SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_OFF);
+        return;
+      }
+
+      static const unsigned char session_id_context[] = "jetblack::io";
+      if (SSL_CTX_set_session_id_context(ctx_, session_id_context, sizeof(session_id_context) - 1) != 1)
+        throw std::runtime_error(openssl_strerror());
+
+      SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_SERVER);
+      SSL_CTX_sess_set_cache_size(ctx_, static_cast<long>(size));
+      SSL_CTX_set_timeout(ctx_, static_cast<long>(timeout.count()));
+    }
+    std::size_t session_cache_size() const noexcept
+    {
+      return static_cast<std::size_t>(SSL_CTX_sess_get_cache_size(ctx_));
+    }
+
+    // Session tickets let clients resume without a server cache. Without
+    // them, TLS 1.3 clients resume from the cache.
+    void tickets(bool is_enabled) noexcept
+    {
+      if (is_enabled)
+        SSL_CTX_clear_options(ctx_, SSL_OP_NO_TICKET);
+      else
+        SSL_CTX_set_options(ctx_, SSL_OP_NO_TICKET);
+    }
+    bool tickets() const noexcept { return (SSL_CTX_get_options(ctx_) & SSL_OP_NO_TICKET) == 0; }
+
+    // Encrypt session tickets with the given keys, which the caller rotates.
+    // Without them OpenSSL uses a random key for the life of the context.
+    void ticket_keys(std::shared_ptr<SslTicketKeys> keys)
+    {
+      ticket_keys_ = std::move(keys);
+      if (SSL_CTX_set_ex_data(ctx_, SslTicketKeys::ctx_index(), ticket_keys_.get()) != 1)
+        throw std::runtime_error(openssl_strerror());
+      SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx_, ticket_keys_ ? &SslTicketKeys::on_ticket_key : nullptr);
+    }
+    const std::shared_ptr<SslTicketKeys>& ticket_keys() const noexcept { return ticket_keys_; }
+
+    // Accept up to max_bytes of TLS 1.3 early data from clients resuming a
+    // session, or refuse it with zero. An attacker can replay early data,
+    // so only accept it where the requests are safe to repeat.
+    //
+    // OpenSSL's replay protection is kept on. Tickets then refer to a
+    // session in the server's cache, rather than carrying it, and a session
+    // is removed from the cache when it is resumed, so a ticket carries
+    // early data once. The session cache is turned on if it is off, and the
+    // ticket keys are not used while early data is accepted. Early data
+    // sent to another server, or after a reload, is rejected and sent again
+    // by the client.
+    void early_data(std::uint32_t max_bytes)
+    {
+      if (max_bytes != 0 && (SSL_CTX_get_session_cache_mode(ctx_) & SSL_SESS_CACHE_SERVER) == 0)
+        session_cache(SSL_SESSION_CACHE_MAX_SIZE_DEFAULT);
+
+      if (SSL_CTX_set_max_early_data(ctx_, max_bytes) != 1 || SSL_CTX_set_recv_max_early_data(ctx_, max_bytes) != 1)
+        throw std::runtime_error(openssl_strerror());
+      is_early_data_ = max_bytes != 0;
+    }
+    std::uint32_t max_early_data() const noexcept { return SSL_CTX_get_max_early_data(ctx_); }
     
     void use_certificate_file(const std::string& path, int type = SSL_FILETYPE_PEM)
     {
@@ -0,0 +1,129 @@
+#ifndef SQUAWKBUS_IO_SSL_SESSION_STORE_HPP
+#define SQUAWKBUS_IO_SSL_SESSION_STORE_HPP
+
+#include <openssl/ssl.h>
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+
+#include "io/endpoint.hpp"
+
+namespace jetblack::io
+{
+  // The sessions from earlier client connections, keyed by endpoint, so a
+  // reconnect can resume the session rather than make a full handshake. The
+  // store may be shared by connections on different threads.
+  //
+  // Sessions are added by the client context when the server sends them,
+  // which for TLS 1.3 is after the handshake.
+  class SslSessionStore
+  {
+  private:
+    mutable std::mutex mutex_;
+    std::map<Endpoint, SSL_SESSION*> sessions_;
+
+  public:
+    SslSessionStore() = default;
+    SslSessionStore(const SslSessionStore&) = delete;
+    SslSessionStore& operator=(const SslSessionStore&) = delete;
+    ~SslSessionStore()
+    {
+      for (auto& [endpoint, session] : sessions_)
+        SSL_SESSION_free(session);
+    }
+
+    // Returns a new reference to a resumable session, or nullptr.
+    SSL_SESSION* get(const Endpoint& endpoint)
+    {
+      std::scoped_lock lock(mutex_);
+      auto i = sessions_.find(endpoint);
+      if (i == sessions_.end())
+        return nullptr;
+
+      if (SSL_SESSION_is_resumable(i->second) == 0)
+      {
+        SSL_SESSION_free(i->second);
+        sessions_.erase(i);
+        return nullptr;
+      }
+
+      SSL_SESSION_up_ref(i->second);
+      return i->second;
+    }
+
+    // Takes the reference to the session, replacing any earlier session.
+    void put(const Endpoint& endpoint, SSL_SESSION* session)
+    {
+      std::scoped_lock lock(mutex_);
+      auto [i, is_added] = sessions_.try_emplace(endpoint, session);
+      if (!is_added)
+      {
+        SSL_SESSION_free(i->second);
+        i->second = session;
+      }
+    }
+
+    void erase(const Endpoint& endpoint)
+    {
+      std::scoped_lock lock(mutex_);
+      if (auto i = sessions_.find(endpoint); i != sessions_.end())
+      {
+        SSL_SESSION_free(i->second);
+        sessions_.erase(i);
+      }
+    }
+
+    std::size_t size() const
+    {
+      std::scoped_lock lock(mutex_);
+      return sessions_.size();
+    }
+
+    // The store used by a context, and the endpoint of a connection, are
+    // found through the OpenSSL ex data.
+    static int ctx_index() noexcept
+    {
+      static int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+      return index;
+    }
+
+    static int endpoint_index() noexcept
+    {
+      static int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, &free_endpoint);
+      return index;
+    }
+
+    static SslSessionStore* of(SSL_CTX* ctx) noexcept
+    {
+      return static_cast<SslSessionStore*>(SSL_CTX_get_ex_data(ctx, ctx_index()));
+    }
+
+    // Called by OpenSSL when a session is received. Returns 1 when the
+    // store takes the reference.
+    static int on_new_session(SSL* ssl, SSL_SESSION* session)
+    {
+      auto store = of(SSL_get_SSL_CTX(ssl));
+      auto endpoint = static_cast<const Endpoint*>(SSL_get_ex_data(ssl, endpoint_index()));
+      if (store == nullptr || endpoint == nullptr)
+        return 0;
+
+      store->put(*endpoint, session);
+      return 1;
+    }
+
+  private:
+    static void free_endpoint(
+      [[maybe_unused]] void* parent,
+      void* ptr,
+      [[maybe_unused]] CRYPTO_EX_DATA* ad,
+      [[maybe_unused]] int index,
+      [[maybe_unused]] long argl,
+      [[maybe_unused]] void* argp)
+    {
+      delete static_cast<Endpoint*>(ptr);
+    }
+  };
+}
+
+#endif // SQUAWKBUS_IO_SSL_SESSION_STORE_HPP
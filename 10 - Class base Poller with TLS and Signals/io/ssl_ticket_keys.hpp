@@ -0,0 +1,163 @@
+#ifndef SQUAWKBUS_IO_SSL_TICKET_KEYS_HPP
+#define SQUAWKBUS_IO_SSL_TICKET_KEYS_HPP
+
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+
+#include "io/openssl_error.hpp"
+
+namespace jetblack::io
+{
+  // The keys used to encrypt session tickets. The newest key encrypts new
+  // tickets, and the older keys are kept so tickets issued before a rotation
+  // can still be resumed, in which case a new ticket is issued. Rotating
+  // the keys limits how long a stolen key can decrypt past sessions.
+  //
+  // The keys may be shared by contexts used on different threads.
+  class SslTicketKeys
+  {
+  private:
+    struct Key
+    {
+      std::array<unsigned char, 16> name;
+      std::array<unsigned char, 32> aes_key;
+      std::array<unsigned char, 32> hmac_key;
+    };
+
+    mutable std::mutex mutex_;
+    // The newest key is first.
+    std::deque<Key> keys_;
+    std::size_t retained_;
+
+  public:
+    // The number of old keys retained for decrypting.
+    explicit SslTicketKeys(std::size_t retained = 2)
+      : retained_(retained)
+    {
+      rotate();
+    }
+    SslTicketKeys(const SslTicketKeys&) = delete;
+    SslTicketKeys& operator=(const SslTicketKeys&) = delete;
+    ~SslTicketKeys()
+    {
+      for (auto& key : keys_)
+        OPENSSL_cleanse(&key, sizeof(key));
+    }
+
+    void rotate()
+    {
+      Key key;
+      if (RAND_bytes(key.name.data(), key.name.size()) != 1
+          || RAND_bytes(key.aes_key.data(), key.aes_key.size()) != 1
+          || RAND_bytes(key.hmac_key.data(), key.hmac_key.size()) != 1)
+      {
+        throw std::runtime_error(openssl_strerror());
+      }
+
+      std::scoped_lock lock(mutex_);
+      keys_.push_front(key);
+      while (keys_.size() > retained_ + 1)
+      {
+        OPENSSL_cleanse(&keys_.back(), sizeof(Key));
+        keys_.pop_back();
+      }
+    }
+
+    std::size_t size() const
+    {
+      std::scoped_lock lock(mutex_);
+      return keys_.size();
+    }
+
+    static int ctx_index() noexcept
+    {
+      static int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+      return index;
+    }
+
+    // The callback for SSL_CTX_set_tlsext_ticket_key_evp_cb. The keys are
+    // found through the context's ex data.
+    static int on_ticket_key(
+      SSL* ssl,
+      unsigned char* key_name,
+      unsigned char* iv,
+      EVP_CIPHER_CTX* cipher_ctx,
+      EVP_MAC_CTX* mac_ctx,
+      int is_encrypting)
+    {
+      auto keys = static_cast<SslTicketKeys*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ctx_index()));
+      if (keys == nullptr)
+        return -1;
+
+      return is_encrypting
+        ? keys->encrypt(key_name, iv, cipher_ctx, mac_ctx)
+        : keys->decrypt(key_name, iv, cipher_ctx, mac_ctx, SSL_version(ssl) >= TLS1_3_VERSION);
+    }
+
+  private:
+    int encrypt(unsigned char* key_name, unsigned char* iv, EVP_CIPHER_CTX* cipher_ctx, EVP_MAC_CTX* mac_ctx)
+    {
+      std::scoped_lock lock(mutex_);
+      auto& key = keys_.front();
+
+      std::memcpy(key_name, key.name.data(), key.name.size());
+      if (RAND_bytes(iv, EVP_CIPHER_get_iv_length(EVP_aes_256_cbc())) != 1)
+        return -1;
+      if (EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), nullptr, key.aes_key.data(), iv) != 1)
+        return -1;
+      if (!set_mac_key(mac_ctx, key))
+        return -1;
+
+      return 1;
+    }
+
+    // Returns 0 when the key is unknown, so a full handshake is made, and 2
+    // when a new ticket should be issued. TLS 1.3 clients use a ticket once,
+    // so they are always given a new one.
+    int decrypt(
+      const unsigned char* key_name,
+      unsigned char* iv,
+      EVP_CIPHER_CTX* cipher_ctx,
+      EVP_MAC_CTX* mac_ctx,
+      bool is_single_use)
+    {
+      std::scoped_lock lock(mutex_);
+      auto i = std::find_if(
+        keys_.begin(),
+        keys_.end(),
+        [key_name](const Key& key) { return std::memcmp(key.name.data(), key_name, key.name.size()) == 0; });
+      if (i == keys_.end())
+        return 0;
+
+      if (!set_mac_key(mac_ctx, *i))
+        return -1;
+      if (EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), nullptr, i->aes_key.data(), iv) != 1)
+        return -1;
+
+      return (i == keys_.begin() && !is_single_use) ? 1 : 2;
+    }
+
+    static bool set_mac_key(EVP_MAC_CTX* mac_ctx, Key& key)
+    {
+      char digest[] = "sha256";
+      OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac_key.data(), key.hmac_key.size()),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+        OSSL_PARAM_construct_end()
+      };
+      return EVP_MAC_CTX_set_params(mac_ctx, params) == 1;
+    }
+  };
+}
+
+#endif // SQUAWKBUS_IO_SSL_TICKET_KEYS_HPP
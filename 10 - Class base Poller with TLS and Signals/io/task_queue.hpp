@@ -0,0 +1,68 @@
+#ifndef SQUAWKBUS_IO_TASK_QUEUE_HPP
+#define SQUAWKBUS_IO_TASK_QUEUE_HPP
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "io/waker.hpp"
+
+namespace jetblack::io
+{
+  // Functions posted to a poller from other threads, and the waker which
+  // tells the poller they are waiting.
+  //
+  // The poller shares the queue, so a thread which holds it can still post
+  // after the poller has gone. The functions are then never run, and are
+  // destroyed with the queue.
+  class TaskQueue
+  {
+  public:
+    typedef std::function<void()> task_type;
+
+  private:
+    std::mutex mutex_;
+    std::vector<task_type> tasks_;
+    std::atomic<bool> has_tasks_ { false };
+    Waker waker_;
+
+  public:
+    TaskQueue() = default;
+    TaskQueue(const TaskQueue&) = delete;
+    TaskQueue& operator=(const TaskQueue&) = delete;
+
+    Waker& waker() noexcept { return waker_; }
+
+    void post(task_type task)
+    {
+      {
+        std::scoped_lock lock(mutex_);
+        tasks_.push_back(std::move(task));
+        has_tasks_.store(true, std::memory_order_release);
+      }
+      waker_.wake();
+    }
+
+    // Run the waiting functions on the calling thread. Functions posted
+    // while these run wait for the next call.
+    void run()
+    {
+      if (!has_tasks_.load(std::memory_order_acquire))
+        return;
+
+      std::vector<task_type> tasks;
+      {
+        std::scoped_lock lock(mutex_);
+        tasks.swap(tasks_);
+        has_tasks_.store(false, std::memory_order_relaxed);
+      }
+
+      for (auto& task : tasks)
+        task();
+    }
+  };
+}
+
+#endif // SQUAWKBUS_IO_TASK_QUEUE_HPP
@@ -1,6 +1,8 @@
 #ifndef SQUAWKBUS_IO_LISTENER_POLL_HANDLER_HPP
 #define SQUAWKBUS_IO_LISTENER_POLL_HANDLER_HPP
 
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <poll.h>
 
 #include <deque>
@@ -12,6 +14,7 @@
 
 #include "utils/match.hpp"
 
+#include "io/handshake_pool.hpp"
 #include "io/poll_handler.hpp"
 #include "io/poller.hpp"
 
@@ -24,24 +27,58 @@ namespace jetblack::io
   {
   private:
     std::optional<std::shared_ptr<SslContext>> ssl_ctx_;
+    TcpTimeouts timeouts_;
     TcpListenerSocket listener_;
+    // When set, TLS handshakes are run on the pool's threads.
+    std::shared_ptr<HandshakePool> handshake_pool_;
+    bool is_low_memory_ { false };
+    std::optional<TlsRecordSizing> record_sizing_;
+    // A listener has no input; the ring never allocates storage.
+    RingBuffer input_ { 0 };
 
   public:
+    // With reuseport several listeners (typically one per thread) can bind
+    // the same port, and the kernel spreads the connections between them.
     TcpListenerPollHandler(
       uint16_t port,
       std::optional<std::shared_ptr<SslContext>> ssl_ctx = std::nullopt,
-      int backlog = 10)
-      : ssl_ctx_ { ssl_ctx }
+      int backlog = 10,
+      bool reuseport = false,
+      TcpTimeouts timeouts = {},
+      std::shared_ptr<HandshakePool> handshake_pool = nullptr)
+      : ssl_ctx_ { ssl_ctx },
+        timeouts_ { timeouts },
+        handshake_pool_ { std::move(handshake_pool) }
     {
+      listener_.reuseaddr(true);
+      if (reuseport)
+        listener_.reuseport(true);
       listener_.bind(port);
       listener_.blocking(false);
-      listener_.reuseaddr(true);
       listener_.listen(backlog);
     }
     ~TcpListenerPollHandler() override
     {
     }
 
+    // Accept new TLS connections with another context, such as one with a
+    // renewed certificate. Connections already accepted keep the context
+    // they were made with. This must be called on the poller's thread; other
+    // threads can post the change to it.
+    void ssl_ctx(std::shared_ptr<SslContext> ssl_ctx) noexcept { ssl_ctx_ = std::move(ssl_ctx); }
+    const std::optional<std::shared_ptr<SslContext>>& ssl_ctx() const noexcept { return ssl_ctx_; }
+
+    // Accept connections in low memory mode.
+    void low_memory(bool is_low_memory) noexcept { is_low_memory_ = is_low_memory; }
+    bool low_memory() const noexcept { return is_low_memory_; }
+
+    // Accept TLS connections with dynamic record sizing.
+    void record_sizing(std::optional<TlsRecordSizing> sizing) noexcept { record_sizing_ = sizing; }
+    const std::optional<TlsRecordSizing>& record_sizing() const noexcept { return record_sizing_; }
+
+    void attach([[maybe_unused]] Poller& poller) override {}
+    void detach([[maybe_unused]] Poller& poller) override {}
+
     bool is_listener() const noexcept override { return true; }
 
     int fd() const noexcept override { return listener_.fd(); }
@@ -52,28 +89,25 @@ namespace jetblack::io
 
     bool read(Poller& poller) override
     {
+      // Accept all the waiting connections.
       auto client = listener_.accept();
-      client->blocking(false);
-
-      auto host = client->address();
-      auto port = client->port();
-
-      if (!ssl_ctx_)
-      {
-        poller.add_handler(
-          std::make_unique<TcpSocketPollHandler>(std::move(client), 8096, 8096),
-          host, port);
-      }
-      else
+      while (client)
       {
-        poller.add_handler(
-          std::make_unique<TcpSocketPollHandler>(std::move(client), *ssl_ctx_, 8096, 8096),
-          host, port);
+        add_client(poller, std::move(client));
+        client = listener_.accept();
       }
 
       return true;
     }
 
+    // The multiplexer may accept the connections.
+    bool can_accept() const noexcept override { return true; }
+
+    void accept(Poller& poller, int fd) override
+    {
+      add_client(poller, TcpListenerSocket::adopt(fd));
+    }
+
     bool write() override { return false; }
 
     void close() override
@@ -84,8 +118,31 @@ namespace jetblack::io
       }
     }
 
-    std::optional<std::vector<char>> dequeue() noexcept override { return std::nullopt; }
-    void enqueue([[maybe_unused]] const std::vector<char>& buf) noexcept override {}
+    RingBuffer& input() noexcept override { return input_; }
+    void enqueue([[maybe_unused]] Message message) noexcept override {}
+
+  private:
+    void add_client(Poller& poller, TcpListenerSocket::client_pointer client)
+    {
+      client->blocking(false);
+      // Handshake messages and replies are small, and must not wait for the
+      // peer's delayed acknowledgement.
+      client->set_option(IPPROTO_TCP, TCP_NODELAY, true);
+
+      auto host = client->address();
+      auto port = client->port();
+
+      auto handler = !ssl_ctx_
+        ? std::make_unique<TcpSocketPollHandler>(std::move(client), 8096, TcpSocketPollHandler::max_record_size)
+        : std::make_unique<TcpSocketPollHandler>(std::move(client), *ssl_ctx_, 8096, TcpSocketPollHandler::max_record_size);
+      handler->timeouts(timeouts_);
+      handler->low_memory(is_low_memory_);
+      handler->record_sizing(record_sizing_);
+      if (ssl_ctx_ && handshake_pool_)
+        handshake_pool_->handshake(poller, std::move(handler), host, port);
+      else
+        poller.add_handler(std::move(handler), host, port);
+    }
   };
 
 }
@@ -70,6 +70,8 @@ namespace jetblack::io
       }
     }
 
+    // Accept a connection. For a non-blocking listener, nullptr is returned
+    // when no connections are waiting.
     client_pointer accept()
     {
       sockaddr_in clientaddr;
@@ -77,19 +79,35 @@ namespace jetblack::io
 
       int client_fd = ::accept(fd_, reinterpret_cast<sockaddr*>(&clientaddr), &clientlen);
       if (client_fd == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+          return nullptr;
         throw std::system_error(
           errno, std::generic_category(), "failed to accept socket");
       }
 
-      char address[INET_ADDRSTRLEN];
-      if (inet_ntop(AF_INET, &clientaddr.sin_addr, address, sizeof(address)) == nullptr)
+      uint16_t port = ntohs(clientaddr.sin_port);
+
+      return std::make_shared<TcpServerSocket>(client_fd, clientaddr.sin_addr, port);
+    }
+
+    // Take a connection accepted for the listener elsewhere, such as by an
+    // io_uring multishot accept, which gives no peer address.
+    static client_pointer adopt(int client_fd)
+    {
+      sockaddr_in clientaddr;
+      socklen_t clientlen = sizeof(clientaddr);
+      std::memset(&clientaddr, 0, sizeof(clientaddr));
+      if (::getpeername(client_fd, reinterpret_cast<sockaddr*>(&clientaddr), &clientlen) == -1)
       {
+        int error = errno;
+        ::close(client_fd);
         throw std::system_error(
-          errno, std::generic_category(), "failed to find client address");
+          error, std::generic_category(), "failed to get peer address");
       }
+
       uint16_t port = ntohs(clientaddr.sin_port);
 
-      return std::make_shared<TcpServerSocket>(client_fd, address, port);
+      return std::make_shared<TcpServerSocket>(client_fd, clientaddr.sin_addr, port);
     }
   };
 
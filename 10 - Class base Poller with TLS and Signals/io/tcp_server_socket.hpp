@@ -1,6 +1,9 @@
 #ifndef SQUAWKBUS_IO_TCP_SERVER_SOCKET_HPP
 #define SQUAWKBUS_IO_TCP_SERVER_SOCKET_HPP
 
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
 #include <cstdint>
 #include <string>
 
@@ -9,21 +12,29 @@
 namespace jetblack::io
 {
 
+  // An accepted connection. The peer address is kept in binary, and only
+  // formatted when it is asked for.
   class TcpServerSocket : public TcpSocket
   {
   private:
-    std::string address_;
+    in_addr address_;
     std::uint16_t port_;
 
   public:
-    TcpServerSocket(int fd, const std::string& address, std::uint16_t port) noexcept
+    TcpServerSocket(int fd, const in_addr& address, std::uint16_t port) noexcept
       : TcpSocket(fd)
       , address_(address)
       , port_(port)
     {
     }
 
-    const std::string& address() const noexcept { return address_; }
+    std::string address() const
+    {
+      char buf[INET_ADDRSTRLEN];
+      if (inet_ntop(AF_INET, &address_, buf, sizeof(buf)) == nullptr)
+        return std::string();
+      return buf;
+    }
     uint16_t port() const noexcept { return port_; }
   };
 
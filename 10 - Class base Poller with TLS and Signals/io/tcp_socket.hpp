@@ -3,11 +3,13 @@
 
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <netinet/in.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <cerrno>
+#include <cstdint>
 #include <iostream>
 #include <system_error>
 
@@ -46,6 +48,25 @@ namespace jetblack::io
     {
       set_option(SOL_SOCKET, SO_REUSEADDR, is_reusable);
     }
+
+    void reuseport(bool is_reusable)
+    {
+      set_option(SOL_SOCKET, SO_REUSEPORT, is_reusable);
+    }
+
+    // The port of the connected peer, or 0 when it is not known.
+    std::uint16_t peer_port() const noexcept
+    {
+      sockaddr_storage address;
+      socklen_t len = sizeof(address);
+      if (::getpeername(fd_, reinterpret_cast<sockaddr*>(&address), &len) == -1)
+        return 0;
+      if (address.ss_family == AF_INET)
+        return ntohs(reinterpret_cast<const sockaddr_in*>(&address)->sin_port);
+      if (address.ss_family == AF_INET6)
+        return ntohs(reinterpret_cast<const sockaddr_in6*>(&address)->sin6_port);
+      return 0;
+    }
   };
 
 }
@@ -2,19 +2,31 @@
 #define SQUAWKBUS_IO_SOCKET_POLL_HANDLER_HPP
 
 #include <poll.h>
+#include <sys/uio.h>
 
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
 #include <deque>
+#include <format>
+#include <functional>
 #include <map>
 #include <memory>
 #include <optional>
 #include <stdexcept>
+#include <system_error>
 #include <vector>
 
 #include "utils/match.hpp"
 
+#include "io/file_region.hpp"
+#include "io/logger.hpp"
 #include "io/tcp_socket.hpp"
 #include "io/tcp_listener_socket.hpp"
 #include "io/tcp_stream.hpp"
+#include "io/message.hpp"
+#include "io/ring_buffer.hpp"
 #include "io/ssl_ctx.hpp"
 #include "io/poll_handler.hpp"
 #include "io/poller.hpp"
@@ -23,15 +35,98 @@ namespace jetblack::io
 {
   using jetblack::utils::match;
 
+  // Connections are closed when a timeout expires. Unset timeouts are
+  // disabled.
+  struct TcpTimeouts
+  {
+    // No data read or written.
+    std::optional<std::chrono::milliseconds> idle;
+    // The TLS handshake has not completed.
+    std::optional<std::chrono::milliseconds> handshake;
+    // Data is waiting to be written, but none has been.
+    std::optional<std::chrono::milliseconds> write_stall;
+  };
+
+  // Dynamic TLS record sizing. A burst of writes starts with records which
+  // fit a single TCP segment, so the peer can decrypt the first bytes as soon
+  // as they arrive, rather than waiting for the rest of a full record. Once
+  // the burst has sent enough bytes, or gone on long enough, it moves to
+  // full records to save the per record overhead. The burst ends when the
+  // connection has not written for a while.
+  struct TlsRecordSizing
+  {
+    // The record payload which, with the TLS, TCP and IP headers, fits a
+    // segment on a 1500 byte MTU.
+    std::size_t small_record_size { 1369 };
+    // Move to full records after this many bytes.
+    std::size_t ramp_bytes { 1024 * 1024 };
+    // Or after this long.
+    std::optional<std::chrono::milliseconds> ramp_time;
+    // Start with small records again after this long without a write.
+    std::chrono::milliseconds idle_reset { 1000 };
+  };
+
   class TcpSocketPollHandler : public PollHandler
   {
+  private:
+    // A message, or a region of a file, waiting to be written, with the
+    // offset written so far.
+    struct PendingWrite
+    {
+      Message message;
+      std::optional<FileRegion> file;
+      std::size_t offset { 0 };
+
+      std::size_t size() const noexcept { return file ? file->size : message.size(); }
+      std::size_t remaining() const noexcept { return size() - offset; }
+    };
+
   private:
     TcpStream stream_;
-    std::deque<std::vector<char>> read_queue_;
-    std::deque<std::pair<std::vector<char>, std::size_t>> write_queue_;
+    RingBuffer input_;
+    // The queue is made when the first write is queued, as an empty deque
+    // still holds a block of storage. In low memory mode it is dropped
+    // again when it empties.
+    std::optional<std::deque<PendingWrite>> write_queue_;
+    bool is_low_memory_ { false };
+    // The bytes at the front of the queue the poller is sending. They stay
+    // queued until the send is made. The messages are gathered for the
+    // poller, which holds them.
+    bool is_sending_ { false };
+    std::size_t send_bytes_ { 0 };
+    std::vector<Message> send_messages_;
+    // A TLS record of packed messages, or part of a file, waiting to be
+    // written.
+    Buffer record_;
+    // A TLS write from the first message blocked, and must be retried.
+    bool is_retrying_ { false };
+    // The size of the record being written, which a retry must keep.
+    std::size_t record_size_ { 0 };
+    // The bytes of the first queued message sent as early data. They stay
+    // queued until the server accepts them.
+    bool is_early_data_written_ { false };
+    std::size_t early_data_bytes_ { 0 };
+    std::optional<TlsRecordSizing> record_sizing_;
+    std::size_t burst_bytes_ { 0 };
+    Poller::time_point burst_start_;
+    Poller::time_point last_record_;
+    TcpTimeouts timeouts_;
+    Poller* poller_ { nullptr };
+    Poller::time_point last_activity_;
+    Poller::time_point last_write_;
+    std::optional<Poller::timer_id> idle_timer_;
+    std::optional<Poller::timer_id> handshake_timer_;
+    std::optional<Poller::timer_id> write_stall_timer_;
+    std::function<void()> on_handshake_;
 
   public:
+    // The largest TLS record.
+    static constexpr std::size_t max_record_size = 16384;
+    // The most messages gathered into one write.
+    static constexpr std::size_t max_iov = 64;
+
     const std::size_t read_bufsiz;
+    // The most bytes given to one write, and so the TLS record size.
     const std::size_t write_bufsiz;
 
     TcpSocketPollHandler(
@@ -39,6 +134,7 @@ namespace jetblack::io
       std::size_t read_bufsiz,
       std::size_t write_bufsiz)
       : stream_(socket, false),
+        input_(read_bufsiz),
         read_bufsiz(read_bufsiz),
         write_bufsiz(write_bufsiz)
     {
@@ -49,6 +145,7 @@ namespace jetblack::io
       std::size_t read_bufsiz,
       std::size_t write_bufsiz)
       : stream_(socket, ssl_ctx, false),
+        input_(read_bufsiz),
         read_bufsiz(read_bufsiz),
         write_bufsiz(write_bufsiz)
     {
@@ -60,27 +157,95 @@ namespace jetblack::io
       std::size_t read_bufsiz,
       std::size_t write_bufsiz)
       : stream_(socket, ssl_ctx, server_name),
+        input_(read_bufsiz),
         read_bufsiz(read_bufsiz),
         write_bufsiz(write_bufsiz)
     {
     }
     ~TcpSocketPollHandler() override
     {
+      cancel_timers();
+    }
+
+    // Set the timeouts. This must be called before the handler is added to
+    // the poller.
+    void timeouts(const TcpTimeouts& timeouts) noexcept { timeouts_ = timeouts; }
+    const TcpTimeouts& timeouts() const noexcept { return timeouts_; }
+
+    // In low memory mode an idle connection holds no input or write queue
+    // storage. It is taken from the buffer pool again when it is needed.
+    void low_memory(bool is_low_memory) noexcept
+    {
+      is_low_memory_ = is_low_memory;
+      input_.release_when_empty(is_low_memory);
+      if (is_low_memory && !has_queued_writes())
+        write_queue_.reset();
+    }
+    bool low_memory() const noexcept { return is_low_memory_; }
+
+    // Size user space TLS records by how long the connection has been
+    // writing. Without it every record is write_bufsiz bytes. Kernel TLS
+    // sizes its own records.
+    void record_sizing(std::optional<TlsRecordSizing> sizing) noexcept { record_sizing_ = sizing; }
+    const std::optional<TlsRecordSizing>& record_sizing() const noexcept { return record_sizing_; }
+
+    // Called once when the TLS handshake completes.
+    void on_handshake(std::function<void()> callback) { on_handshake_ = std::move(callback); }
+
+    void attach(Poller& poller) override
+    {
+      poller_ = &poller;
+      last_activity_ = poller.now();
+
+      if (timeouts_.idle)
+      {
+        idle_timer_ = poller.schedule_after(
+          *timeouts_.idle,
+          [this]() { on_idle_timer(); });
+      }
+
+      if (timeouts_.handshake && is_handshaking())
+      {
+        handshake_timer_ = poller.schedule_after(
+          *timeouts_.handshake,
+          [this]()
+          {
+            handshake_timer_ = std::nullopt;
+            expire("handshake");
+          });
+      }
+    }
+
+    // The timers belong to the poller's thread, so they are cancelled, and
+    // scheduled again when the handler is attached to another poller.
+    void detach([[maybe_unused]] Poller& poller) override
+    {
+      cancel_timers();
+      poller_ = nullptr;
     }
 
     bool is_listener() const noexcept override { return false; }
+    bool is_handshaking() const noexcept override { return stream_.state() == TcpStream::State::HANDSHAKE; }
+    bool is_kernel_tls() const noexcept { return stream_.is_kernel_tls(); }
+    bool is_resumed() const noexcept { return stream_.is_resumed(); }
     int fd() const noexcept override { return stream_.socket->fd(); }
     bool is_open() const noexcept override { return stream_.socket->is_open(); }
-    bool want_read() const noexcept override { return is_open() || stream_.want_read(); }
-    bool want_write() const noexcept override { return is_open() && (!write_queue_.empty() || stream_.want_write()); }
+    // Reading stops while the input is full.
+    bool want_read() const noexcept override { return (is_open() && !input_.full()) || stream_.want_read(); }
+    // A server reading early data cannot write until it has all been read.
+    bool want_write() const noexcept override
+    {
+      return is_open() && ((has_pending_writes() && !is_sending_ && !stream_.is_reading_early_data()) || stream_.want_write());
+    }
 
-    bool read([[maybe_unused]] Poller& poller) override
+    bool read(Poller& poller) override
     {
       try
       {
         bool can_read = true;
         while (can_read && stream_.socket->is_open())
         {
+          auto requested = input_.available();
           can_read = std::visit(match {
             
             [](blocked&&)
@@ -93,15 +258,22 @@ namespace jetblack::io
               return false;
             },
 
-            [&](std::vector<char>&& buf) mutable
+            [&](std::size_t&& count) mutable
             {
-              read_queue_.push_back(std::move(buf));
-              return true;
+              // A short read from a drained socket saves the read that
+              // would fail with EAGAIN.
+              bool is_drained = count < requested && stream_.is_drained();
+              last_activity_ = poller.now();
+              return !is_drained && !input_.full();
             }
 
           },
-          stream_.read(read_bufsiz));
+          stream_.read(input_));
         }
+
+        // A read which found nothing leaves the storage taken.
+        if (is_low_memory_)
+          input_.release();
       }
       catch (...)
       {
@@ -109,23 +281,278 @@ namespace jetblack::io
         throw;
       }
 
+      check_handshake();
+
       return stream_.socket->is_open();
     }
 
+    // A plain socket reads nothing but the data, so the multiplexer can
+    // read it.
+    bool can_receive() const noexcept override { return !stream_.is_secure(); }
+
+    std::size_t receive(Poller& poller, std::span<const char> data) override
+    {
+      if (data.empty())
+      {
+        stream_.socket->is_open(false);
+        return 0;
+      }
+
+      last_activity_ = poller.now();
+      return input_.append(data);
+    }
+
     bool write() override
     {
       try
       {
-        bool can_write = true;
-        while (can_write && stream_.socket->is_open() && !write_queue_.empty())
+        if (stream_.max_early_data() != 0 && !write_early_data())
+          return stream_.socket->is_open();
+
+        // With kernel TLS the socket is written directly, once any record
+        // started in user space has been sent.
+        bool is_user_tls = stream_.is_secure() && !stream_.is_kernel_tls();
+        if (is_user_tls || !record_.empty() || is_retrying_)
+          write_records();
+        else
+          write_gathered();
+
+        if (stream_.socket->is_open() && !has_pending_writes() && stream_.want_write())
         {
+          // Some SSL writes are pending. Typically at shutdown.
+          stream_.write(std::span<const char> {});
+        }
+      }
+      catch(const std::exception& e)
+      {
+        stream_.socket->is_open(false);
+        throw;
+      }      
 
-          auto& [orig_buf, offset] = write_queue_.front();
-          std::size_t count = std::min(orig_buf.size() - offset, write_bufsiz);
-          const auto& buf = std::span<char>(orig_buf).subspan(offset, count);
+      check_handshake();
+
+      return stream_.socket->is_open();
+    }
+
+    void close() override
+    {
+      if (stream_.socket->is_open())
+      {
+        // The send must be made before the descriptor can be reused.
+        if (is_sending_ && poller_ != nullptr)
+          poller_->submit();
+        stream_.close();
+      }
+    }
+
+    void sent([[maybe_unused]] Poller& poller, long result) override
+    {
+      is_sending_ = false;
+      if (!is_open())
+        return;
+
+      try
+      {
+        if (result < 0)
+        {
+          // When the socket is full the poller waits for it to be writable.
+          if (result == -EAGAIN || result == -EWOULDBLOCK || result == -EINTR)
+            return;
+          throw std::system_error(static_cast<int>(-result), std::generic_category(), "failed to write");
+        }
+
+        auto bytes_sent = static_cast<std::size_t>(result);
+        consume_write_queue(bytes_sent);
+        on_written();
+
+        // A short send means the socket buffer is full.
+        if (bytes_sent == send_bytes_)
+          write_gathered();
+      }
+      catch(const std::exception& e)
+      {
+        stream_.socket->is_open(false);
+        throw;
+      }
+    }
+
+    bool has_reads() const noexcept { return !input_.empty(); }
+
+    RingBuffer& input() noexcept override { return input_; }
+
+    void enqueue(Message message) noexcept override
+    {
+      if (message.empty())
+        return;
+
+      start_write_stall_timer();
+      queue().push_back(PendingWrite { std::move(message), std::nullopt });
+      // It is written once the queued send has been made.
+      if (is_sending_ && poller_ != nullptr)
+        poller_->send_more();
+    }
+
+    // Plain and kernel TLS sockets copy the file with sendfile. With user
+    // space TLS it is read a record at a time as it is written.
+    void enqueue(FileRegion region) noexcept override
+    {
+      if (region.size == 0)
+        return;
+
+      start_write_stall_timer();
+      queue().push_back(PendingWrite { Message(), std::move(region) });
+      if (is_sending_ && poller_ != nullptr)
+        poller_->send_more();
+    }
+
+  private:
+    bool has_queued_writes() const noexcept { return write_queue_ && !write_queue_->empty(); }
+    bool has_pending_writes() const noexcept { return has_queued_writes() || !record_.empty(); }
+
+    std::deque<PendingWrite>& queue()
+    {
+      if (!write_queue_)
+        write_queue_.emplace();
+      return *write_queue_;
+    }
+
+    void start_write_stall_timer() noexcept
+    {
+      if (!has_pending_writes() && timeouts_.write_stall && !write_stall_timer_ && poller_ != nullptr)
+      {
+        last_write_ = poller_->now();
+        write_stall_timer_ = poller_->schedule_after(
+          *timeouts_.write_stall,
+          [this]() { on_write_stall_timer(); });
+      }
+    }
+
+    // A plain socket can have the poller send for it.
+    bool can_send() const noexcept
+    {
+      return !stream_.is_secure() && poller_ != nullptr && poller_->can_send();
+    }
+
+    // Write as much of the queue as the socket will take, gathering up to
+    // write_bufsiz bytes into each call. When the poller sends for the
+    // socket the first gather is queued with it, and the rest is written
+    // once it has been sent.
+    void write_gathered()
+    {
+      bool can_write = true;
+      while (can_write && stream_.socket->is_open() && has_queued_writes() && !is_sending_)
+      {
+        if (write_queue_->front().file)
+        {
+          can_write = write_file();
+          continue;
+        }
+
+        std::array<iovec, max_iov> iov;
+        std::size_t count = 0;
+        std::size_t total = 0;
+        bool is_send = can_send();
+        bool has_more = false;
+        for (auto& pending : *write_queue_)
+        {
+          if (pending.file || count == iov.size() || total == write_bufsiz)
+          {
+            has_more = true;
+            break;
+          }
+          auto len = std::min(pending.remaining(), write_bufsiz - total);
+          iov[count++] = iovec { const_cast<char*>(pending.message.data()) + pending.offset, len };
+          total += len;
+          has_more = len < pending.remaining();
+          if (is_send)
+            send_messages_.push_back(pending.message);
+        }
+
+        bool is_sent = is_send && poller_->send(fd(), std::span<const iovec>(iov.data(), count), send_messages_);
+        send_messages_.clear();
+        if (is_sent)
+        {
+          is_sending_ = true;
+          send_bytes_ = total;
+          // The rest is written once the send has been made, so the poller
+          // must not wait for events first.
+          if (has_more)
+            poller_->send_more();
+          return;
+        }
+
+        can_write = std::visit(match {
+
+          [](eof&&)
+          {
+            return false;
+          },
+
+          [](blocked&&)
+          {
+            return false;
+          },
+
+          [&](std::size_t&& bytes_written) mutable
+          {
+            consume_write_queue(bytes_written);
+            on_written();
+            // A short write means the socket buffer is full.
+            return bytes_written == total;
+          }
+
+        },
+        stream_.write(std::span<const iovec>(iov.data(), count)));
+      }
+    }
+
+    // Copy the file at the front of the queue to the socket. The data does
+    // not pass through user space.
+    bool write_file()
+    {
+      auto& pending = write_queue_->front();
+      auto requested = pending.remaining();
+      return std::visit(match {
+
+        [](eof&&)
+        {
+          return false;
+        },
+
+        [](blocked&&)
+        {
+          return false;
+        },
+
+        [&](std::size_t&& bytes_written) mutable
+        {
+          consume_write_queue(bytes_written);
+          on_written();
+          // A short write means the socket buffer is full.
+          return bytes_written == requested;
+        }
+
+      },
+      stream_.sendfile(pending.file->file->fd(), pending.file->offset + pending.offset, requested));
+    }
+
+    // Send the first queued message as early data, and drive the handshake
+    // until the server has said whether it accepted it, so nothing is sent
+    // twice. The message stays queued until then, and is written again if
+    // it was rejected. Returns true when the queue can be written.
+    bool write_early_data()
+    {
+      if (!is_early_data_written_)
+      {
+        if (!has_queued_writes())
+          return true;
+
+        auto& front = write_queue_->front();
+        if (!front.file)
+        {
+          auto len = std::min(front.remaining(), stream_.max_early_data());
+          bool is_written = std::visit(match {
 
-          can_write = std::visit(match {
-            
             [](eof&&)
             {
               return false;
@@ -136,61 +563,250 @@ namespace jetblack::io
               return false;
             },
 
-            [&](ssize_t&& bytes_written) mutable
+            [&](std::size_t&& bytes_written)
             {
-              // Update the offset reference by the number of bytes written.
-              offset += bytes_written;
-              // Are we there yet?
-              if (offset == orig_buf.size()) {
-                // The buffer has been completely used. Remove it from the
-                // queue.
-                write_queue_.pop_front();
-              }
+              early_data_bytes_ = bytes_written;
+              on_written();
               return true;
             }
-            
+
           },
-          stream_.write(buf));
+          stream_.write_early_data(front.message.span().subspan(front.offset, len)));
+
+          if (!is_written)
+            return false;
+        }
+        is_early_data_written_ = true;
+      }
+
+      if (!stream_.do_handshake())
+        return false;
+
+      check_handshake();
+      return true;
+    }
+
+    // Write the queue as TLS records of up to write_bufsiz bytes. Small
+    // messages are packed together into a single record, so each record
+    // carries as much data as it can. A record which could not be written
+    // must be retried unchanged, so it is kept until it has been sent.
+    void write_records()
+    {
+      bool can_write = true;
+      while (can_write && stream_.socket->is_open() && has_pending_writes())
+      {
+        if (!is_retrying_)
+          record_size_ = next_record_size();
+        auto record_size = record_size_;
+
+        if (record_.empty() && !is_retrying_)
+        {
+          if (auto& front = write_queue_->front(); front.file)
+          {
+            record_ = front.file->read(front.offset, std::min(front.remaining(), record_size));
+            consume_write_queue(record_.size());
+          }
+          else if (should_pack(record_size))
+          {
+            record_ = BufferPool::local().allocate(record_size);
+            std::size_t count = 0;
+            for (auto& pending : *write_queue_)
+            {
+              if (pending.file)
+                break;
+              auto len = std::min(pending.remaining(), record_size - count);
+              std::memcpy(record_.data() + count, pending.message.data() + pending.offset, len);
+              count += len;
+              if (count == record_size)
+                break;
+            }
+            record_.resize(count);
+            consume_write_queue(count);
+          }
         }
 
-        if (stream_.socket->is_open() && stream_.want_write())
+        // The record is either the packed messages, a part of a file, or a
+        // part of the first message.
+        auto is_packed = !record_.empty();
+        std::span<const char> record;
+        if (is_packed)
         {
-          // Some SSL writes are pending. Typically at shutdown.
-          stream_.write(std::span<char> {});
+          record = record_.span();
+        }
+        else
+        {
+          auto& pending = write_queue_->front();
+          record = pending.message.span().subspan(pending.offset, std::min(pending.remaining(), record_size));
         }
+
+        can_write = std::visit(match {
+
+          [](eof&&)
+          {
+            return false;
+          },
+
+          [&](blocked&&)
+          {
+            is_retrying_ = !is_packed;
+            return false;
+          },
+
+          [&](std::size_t&& bytes_written) mutable
+          {
+            is_retrying_ = false;
+            if (is_packed)
+              record_ = Buffer();
+            else
+              consume_write_queue(bytes_written);
+            burst_bytes_ += bytes_written;
+            last_record_ = poller_ != nullptr ? poller_->now() : last_record_;
+            on_written();
+            return true;
+          }
+
+        },
+        stream_.write(record));
       }
-      catch(const std::exception& e)
+    }
+
+    // The size of the next record. With dynamic sizing a burst starts with
+    // small records, and moves to full ones.
+    std::size_t next_record_size() noexcept
+    {
+      auto full_size = std::min<std::size_t>(write_bufsiz, max_record_size);
+      if (!record_sizing_ || poller_ == nullptr)
+        return full_size;
+
+      auto now = poller_->now();
+      if (burst_bytes_ == 0 || now - last_record_ >= record_sizing_->idle_reset)
       {
-        stream_.socket->is_open(false);
-        throw;
-      }      
+        burst_bytes_ = 0;
+        burst_start_ = now;
+      }
 
-      return stream_.socket->is_open();
+      if (
+        burst_bytes_ >= record_sizing_->ramp_bytes ||
+        (record_sizing_->ramp_time && now - burst_start_ >= *record_sizing_->ramp_time))
+      {
+        return full_size;
+      }
+      return std::min(record_sizing_->small_record_size, full_size);
     }
 
-    void close() override
+    // Pack when there are several messages, and the first would not fill a
+    // record by itself.
+    bool should_pack(std::size_t record_size) const noexcept
     {
-      if (stream_.socket->is_open())
+      if (write_queue_->size() < 2)
+        return false;
+      return write_queue_->front().remaining() < record_size;
+    }
+
+    void consume_write_queue(std::size_t count) noexcept
+    {
+      while (count > 0)
       {
-        stream_.socket->close();
+        auto& pending = write_queue_->front();
+        auto len = std::min(count, pending.remaining());
+        pending.offset += len;
+        count -= len;
+        if (pending.remaining() == 0)
+          write_queue_->pop_front();
       }
+
+      if (is_low_memory_ && write_queue_ && write_queue_->empty())
+        write_queue_.reset();
     }
 
-    bool has_reads() const noexcept { return !read_queue_.empty(); }
+    void on_written() noexcept
+    {
+      if (poller_ != nullptr)
+        last_activity_ = last_write_ = poller_->now();
+    }
 
-    std::optional<std::vector<char>> dequeue() noexcept override
+    // The timers are rescheduled from the last activity when they fire,
+    // rather than on every read or write.
+    void on_idle_timer()
     {
-      if (read_queue_.empty())
-        return std::nullopt;
+      idle_timer_ = std::nullopt;
+      if (!is_open())
+        return;
+
+      auto deadline = last_activity_ + *timeouts_.idle;
+      if (deadline <= poller_->now())
+      {
+        expire("idle");
+        return;
+      }
 
-      auto buf { std::move(read_queue_.front()) };
-      read_queue_.pop_front();
-      return buf;
+      idle_timer_ = poller_->schedule_at(deadline, [this]() { on_idle_timer(); });
     }
 
-    void enqueue(const std::vector<char>& buf) noexcept override
+    void on_write_stall_timer()
     {
-      write_queue_.push_back(std::make_pair(buf, 0));
+      write_stall_timer_ = std::nullopt;
+      if (!is_open() || !has_pending_writes())
+        return;
+
+      auto deadline = last_write_ + *timeouts_.write_stall;
+      if (deadline <= poller_->now())
+      {
+        expire("write stall");
+        return;
+      }
+
+      write_stall_timer_ = poller_->schedule_at(deadline, [this]() { on_write_stall_timer(); });
+    }
+
+    void check_handshake()
+    {
+      if (is_handshaking())
+        return;
+
+      if (handshake_timer_)
+      {
+        poller_->cancel(*handshake_timer_);
+        handshake_timer_ = std::nullopt;
+      }
+
+      // Early data the server rejected is written again.
+      if (early_data_bytes_ != 0)
+      {
+        if (stream_.is_early_data_accepted())
+          consume_write_queue(early_data_bytes_);
+        early_data_bytes_ = 0;
+      }
+
+      if (on_handshake_ && stream_.state() == TcpStream::State::DATA)
+      {
+        auto callback = std::move(on_handshake_);
+        on_handshake_ = nullptr;
+        callback();
+      }
+    }
+
+    void cancel_timers() noexcept
+    {
+      if (poller_ == nullptr)
+        return;
+
+      for (auto timer : { &idle_timer_, &handshake_timer_, &write_stall_timer_ })
+      {
+        if (*timer)
+          poller_->cancel(**timer);
+        *timer = std::nullopt;
+      }
+    }
+
+    void expire(const char* reason)
+    {
+      // Another timer may have closed the connection.
+      if (!is_open())
+        return;
+
+      log.info("closing {} after {} timeout", fd(), reason);
+      poller_->close(fd());
     }
   };
 }
@@ -6,13 +6,20 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <openssl/bio.h>
 
+#include <algorithm>
+#include <array>
 #include <cerrno>
+#include <format>
 #include <memory>
 #include <optional>
 #include <span>
@@ -27,8 +34,10 @@
 #include "io/tcp_socket.hpp"
 #include "io/file_types.hpp"
 #include "io/ssl_ctx.hpp"
+#include "io/buffer_pool.hpp"
+#include "io/ring_buffer.hpp"
 #include "io/ssl.hpp"
-#include "io/bio.hpp"
+#include "io/ssl_session_store.hpp"
 
 namespace jetblack::io
 {
@@ -47,19 +56,30 @@ namespace jetblack::io
       STOP
     };
 
+  public:
+    // The socket is declared before the SSL connection so it is still open
+    // when the connection is freed.
+    socket_pointer socket;
+
   private:
-    Bio bio_;
+    // The context is kept for the life of the connection, as the listener
+    // may be given a new one.
+    std::shared_ptr<SslContext> ssl_ctx_;
+    // TLS reads and writes the socket directly, so decrypted data goes
+    // straight into the caller's buffer.
+    std::optional<Ssl> ssl_;
     bool should_verify_;
     State state_ { State::START };
-
-  public:
-    socket_pointer socket;
+    bool is_kernel_tls_ { false };
+    // A client which may send early data when it resumes a session.
+    bool is_early_data_client_ { false };
+    // A server reads any early data before the handshake can go on.
+    bool is_reading_early_data_ { false };
 
   public:
     TcpStream(socket_pointer socket, bool should_verify)
-      : bio_(*socket, BIO_NOCLOSE),
-        should_verify_(should_verify),
-        socket(std::move(socket))
+      : socket(std::move(socket)),
+        should_verify_(should_verify)
     {
     }
 
@@ -67,15 +87,22 @@ namespace jetblack::io
       : TcpStream(socket, is_client)
     {
         state_ = State::HANDSHAKE;
-        bio_.push_ssl(*ssl_ctx, is_client);
+        ssl_ctx_ = ssl_ctx;
+        ssl_.emplace(ssl_ctx->ptr(), this->socket->fd(), is_client);
+        is_early_data_client_ = is_client && ssl_ctx->early_data();
+        is_reading_early_data_ = !is_client && ssl_ctx->early_data();
     }
 
     TcpStream(socket_pointer socket, std::shared_ptr<SslContext> ssl_ctx, const std::string& server_name)
       : TcpStream(socket, ssl_ctx, true)
     {
       // Set hostname for SNI.
-      bio_.ssl->tlsext_host_name(server_name);
-      bio_.ssl->host(server_name);
+      ssl_->tlsext_host_name(server_name);
+      ssl_->host(server_name);
+
+      // Resume a session from an earlier connection to the endpoint.
+      if (auto store = SslSessionStore::of(ssl_ctx->ptr()); store != nullptr)
+        ssl_->resume(*store, Endpoint(server_name, this->socket->peer_port()));
     }
 
     static TcpStream make(
@@ -96,16 +123,53 @@ namespace jetblack::io
       }
     }
 
-    bool want_read() const noexcept { return bio_.should_read(); }
-    bool want_write() const noexcept{ return bio_.should_write(); }
+    State state() const noexcept { return state_; }
+    bool is_secure() const noexcept { return ssl_.has_value(); }
+    // True when the handshake has completed and the kernel encrypts the
+    // records written, so data can be written to the socket directly.
+    bool is_kernel_tls() const noexcept { return is_kernel_tls_; }
+    // True when the handshake resumed an earlier session.
+    bool is_resumed() const noexcept { return ssl_ && ssl_->session_reused(); }
+
+    // The early data a resuming client can send before the handshake
+    // completes, or zero.
+    std::size_t max_early_data() const noexcept
+    {
+      if (!is_early_data_client_ || state_ != State::HANDSHAKE)
+        return 0;
+      return ssl_->max_early_data();
+    }
+    // True when the server accepted the client's early data.
+    bool is_early_data_accepted() const noexcept
+    {
+      return ssl_ && ssl_->early_data_status() == SSL_EARLY_DATA_ACCEPTED;
+    }
+    // True while a server reads early data, when nothing can be written.
+    bool is_reading_early_data() const noexcept { return is_reading_early_data_; }
+
+    bool want_read() const noexcept { return ssl_ && ssl_->want_read(); }
+    bool want_write() const noexcept{ return ssl_ && ssl_->want_write(); }
+
+    // True when a short read means the socket is empty. TLS may hold
+    // records it has read ahead, and reads less than was asked for when
+    // the socket was not emptied.
+    bool is_drained() const noexcept
+    {
+      return !ssl_ || (!ssl_->has_pending() && ssl_->is_socket_drained());
+    }
 
     bool do_handshake()
     {
-      if (!bio_.ssl || state_ != State::HANDSHAKE)
+      if (!ssl_ || state_ != State::HANDSHAKE)
       {
         return true; // continue processing reads.
       }
 
+      if (is_reading_early_data_)
+      {
+        return false; // the handshake goes on once the early data is read.
+      }
+
       bool is_done = std::visit(
         match {
           
@@ -119,15 +183,17 @@ namespace jetblack::io
             return is_complete;
           }
         },
-        bio_.ssl->do_handshake()
+        ssl_->do_handshake()
       );
 
       if (is_done)
       {
         state_ = State::DATA;
+        is_kernel_tls_ = ssl_->ktls_send();
+        ssl_ctx_->count_early_data(ssl_->early_data_status());
         if (should_verify_)
         {
-          bio_.ssl->verify();
+          ssl_->verify();
         }
       }
 
@@ -136,12 +202,12 @@ namespace jetblack::io
 
     void verify()
     {
-      if (!bio_.ssl)
+      if (!ssl_)
       {
         return;
       }
 
-      bio_.ssl->verify();
+      ssl_->verify();
     }
 
     bool do_shutdown()
@@ -162,13 +228,13 @@ namespace jetblack::io
         throw std::runtime_error("shutdown in invalid state");
       }
 
-      if (!bio_.ssl)
+      if (!ssl_)
       {
         state_ = State::STOP;
         return true;
       }
 
-      if (!bio_.ssl || state_ != State::SHUTDOWN)
+      if (!ssl_ || state_ != State::SHUTDOWN)
       {
         return true;
       }
@@ -176,10 +242,102 @@ namespace jetblack::io
       return handle_shutdown();
     }
 
-    std::variant<std::vector<char>, eof, blocked> read(std::size_t len)
+    std::variant<Buffer, eof, blocked> read(std::size_t len)
+    {
+      auto buf = BufferPool::local().allocate(len);
+
+      return std::visit(
+        match {
+
+          [&](std::size_t&& nbytes_read) -> std::variant<Buffer, eof, blocked>
+          {
+            // Data has been read successfully. Resize the buffer and return.
+            buf.resize(nbytes_read);
+            return std::move(buf);
+          },
+
+          [](eof&& value) -> std::variant<Buffer, eof, blocked>
+          {
+            return value;
+          },
+
+          [](blocked&& value) -> std::variant<Buffer, eof, blocked>
+          {
+            return value;
+          }
+
+        },
+        read(buf.span()));
+    }
+
+    // Read into the free space of a ring buffer, committing the bytes read.
+    // Plain sockets fill both parts of the free space with a single readv.
+    // TLS decrypts into the free space until the records already read from
+    // the socket have been returned, so records read ahead together are
+    // decrypted together.
+    std::variant<std::size_t, eof, blocked> read(RingBuffer& buf)
+    {
+      if (buf.full())
+        return blocked {};
+
+      if (ssl_)
+      {
+        std::size_t total = 0;
+        while (!buf.full())
+        {
+          auto result = read(buf.free_space()[0]);
+          auto nbytes_read = std::get_if<std::size_t>(&result);
+          if (nbytes_read == nullptr)
+            return total == 0 ? result : total;
+
+          buf.commit(*nbytes_read);
+          total += *nbytes_read;
+          if (!ssl_->has_pending())
+            break;
+        }
+        return total;
+      }
+
+      if (state_ == State::SHUTDOWN || state_ == State::STOP)
+        return eof {};
+
+      std::array<iovec, 2> iov;
+      auto count = buf.free_space(iov);
+      auto result = ::readv(socket->fd(), iov.data(), count);
+      if (result == -1)
+      {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        {
+          // The socket is ok, but nothing has been read due to blocking.
+          return blocked {};
+        }
+
+        // The socket has faulted.
+        socket->is_open(false);
+        return eof {};
+      }
+
+      if (result == 0)
+      {
+        // A read of zero bytes indicates socket has closed.
+        socket->is_open(false);
+        return eof {};
+      }
+
+      buf.commit(static_cast<std::size_t>(result));
+      return static_cast<std::size_t>(result);
+    }
+
+    std::variant<std::size_t, eof, blocked> read(const std::span<char>& buf)
     {
       if (state_ == State::HANDSHAKE)
       {
+        if (is_reading_early_data_)
+        {
+          if (auto result = read_early_data(buf); result)
+            return *result;
+        }
+
         if (!do_handshake())
           return blocked {};
       }
@@ -192,17 +350,19 @@ namespace jetblack::io
           return blocked {};
       }
 
-      std::vector<char> buf(len);
+      if (!ssl_)
+        return read_plain(buf);
 
-      std::optional<std::size_t> nbytes_read = bio_.read(buf);
+      std::optional<std::size_t> nbytes_read = ssl_->read(buf);
       if (!nbytes_read) {
-        if (bio_.should_retry())
+        auto error = ssl_->error();
+        if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
         {
           // The socket is ok, but nothing has been read due to blocking.
           return blocked {};
         }
 
-        if (bio_.ssl && bio_.ssl->error() == SSL_ERROR_ZERO_RETURN)
+        if (error == SSL_ERROR_ZERO_RETURN)
         {
           // The client has initiated an SSL shutdown.
           state_ = State::SHUTDOWN;
@@ -224,12 +384,10 @@ namespace jetblack::io
         return eof {};
       }
 
-      // Data has been read successfully. Resize the buffer and return.
-      buf.resize(*nbytes_read);
-      return buf;
+      return *nbytes_read;
     }
 
-    std::variant<std::size_t, eof, blocked> write(const std::span<char>& buf)
+    std::variant<std::size_t, eof, blocked> write(const std::span<const char>& buf)
     {
       if (state_ == State::HANDSHAKE)
       {
@@ -245,11 +403,22 @@ namespace jetblack::io
           return blocked {};
       }
 
-      std::optional<std::size_t> nbytes_written = bio_.write(buf);
+      // An empty write only moves the handshake or shutdown on.
+      if (buf.empty())
+        return std::size_t { 0 };
+
+      if (!ssl_)
+      {
+        iovec iov { const_cast<char*>(buf.data()), buf.size() };
+        return write(std::span<const iovec>(&iov, 1));
+      }
+
+      std::optional<std::size_t> nbytes_written = ssl_->write(buf);
       if (!nbytes_written)
       {
         // Check if it's flow control.
-        if (!bio_.should_retry()) {
+        auto error = ssl_->error();
+        if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) {
           // Not flow control; the socket has faulted.
           socket->is_open(false);
           handle_client_faulted();
@@ -271,19 +440,198 @@ namespace jetblack::io
       return *nbytes_written;
     }
 
+    // Write early data, before the handshake completes. A write which
+    // blocks must be retried with the same data.
+    std::variant<std::size_t, eof, blocked> write_early_data(const std::span<const char>& buf)
+    {
+      std::optional<std::size_t> nbytes_written = ssl_->write_early_data(buf);
+      if (!nbytes_written)
+      {
+        auto error = ssl_->error();
+        if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+          return blocked {};
+
+        socket->is_open(false);
+        handle_client_faulted();
+        throw std::runtime_error("failed to write early data");
+      }
+
+      return *nbytes_written;
+    }
+
+    // Write a gather list to a plain or kernel TLS socket with a single
+    // sendmsg, returning the number of bytes written.
+    std::variant<std::size_t, eof, blocked> write(std::span<const iovec> iov)
+    {
+      if (ssl_ && !is_kernel_tls_)
+        throw std::logic_error("gather writes are not supported with user space TLS");
+
+      msghdr msg {};
+      msg.msg_iov = const_cast<iovec*>(iov.data());
+      msg.msg_iovlen = iov.size();
+
+#ifdef MSG_NOSIGNAL
+      int flags = MSG_NOSIGNAL;
+#else
+      int flags = 0;
+#endif
+      auto result = ::sendmsg(socket->fd(), &msg, flags);
+      if (result == -1)
+      {
+        // Check if it's flow control.
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        {
+          // The socket is ok, but nothing has been written due to blocking.
+          return blocked {};
+        }
+
+        // Not flow control; the socket has faulted.
+        socket->is_open(false);
+        throw std::system_error(errno, std::generic_category(), "failed to write");
+      }
+
+      if (result == 0)
+      {
+        // A write of zero bytes indicates socket has closed.
+        socket->is_open(false);
+        return eof {};
+      }
+
+      return static_cast<std::size_t>(result);
+    }
+
+    // Copy part of a file to a plain or kernel TLS socket, returning the
+    // number of bytes written. On Linux the kernel copies the data with
+    // sendfile, elsewhere it is read into a buffer and written.
+    std::variant<std::size_t, eof, blocked> sendfile(int file_fd, off_t offset, std::size_t count)
+    {
+      if (ssl_ && !is_kernel_tls_)
+        throw std::logic_error("sendfile is not supported with user space TLS");
+
+#ifdef __linux__
+      auto result = ::sendfile(socket->fd(), file_fd, &offset, count);
+      if (result == -1)
+      {
+        // Check if it's flow control.
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        {
+          // The socket is ok, but nothing has been written due to blocking.
+          return blocked {};
+        }
+
+        // Not flow control; the socket has faulted.
+        socket->is_open(false);
+        throw std::system_error(errno, std::generic_category(), "failed to send file");
+      }
+
+      if (result == 0 && count > 0)
+        throw std::runtime_error("the file is shorter than the region");
+
+      return static_cast<std::size_t>(result);
+#else
+      auto buf = BufferPool::local().allocate(std::min<std::size_t>(count, 65536));
+      auto nbytes_read = ::pread(file_fd, buf.data(), buf.size(), offset);
+      if (nbytes_read == -1)
+        throw std::system_error(errno, std::generic_category(), "failed to read file");
+      if (nbytes_read == 0)
+        throw std::runtime_error("the file is shorter than the region");
+
+      iovec iov { buf.data(), static_cast<std::size_t>(nbytes_read) };
+      return write(std::span<const iovec>(&iov, 1));
+#endif
+    }
+
+    void close()
+    {
+      // Try once to send a close notify, so the peer knows the connection
+      // was not truncated. OpenSSL does not resume the session of a
+      // connection which ended without one.
+      if (ssl_ && state_ == State::DATA && socket->is_open())
+      {
+        try
+        {
+          ssl_->shutdown();
+        }
+        catch (...)
+        {
+          ERR_clear_error();
+        }
+      }
+
+      // The file descriptor may be reused as soon as it is closed, so
+      // nothing more may be sent on it.
+      handle_client_faulted();
+      socket->close();
+    }
+
   private:
+    std::variant<std::size_t, eof, blocked> read_plain(const std::span<char>& buf)
+    {
+      auto result = ::recv(socket->fd(), buf.data(), buf.size(), 0);
+      if (result == -1)
+      {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        {
+          // The socket is ok, but nothing has been read due to blocking.
+          return blocked {};
+        }
+
+        // The socket has faulted.
+        socket->is_open(false);
+        return eof {};
+      }
+
+      if (result == 0)
+      {
+        // A read of zero bytes indicates socket has closed.
+        socket->is_open(false);
+        return eof {};
+      }
+
+      return static_cast<std::size_t>(result);
+    }
+
+    // Read the early data a client sent with its hello. Returns nothing once
+    // the client has ended it, so the handshake can go on.
+    std::optional<std::variant<std::size_t, eof, blocked>> read_early_data(const std::span<char>& buf)
+    {
+      std::size_t nbytes_read = 0;
+      int result = ssl_->read_early_data(buf, nbytes_read);
+      if (result == SSL_READ_EARLY_DATA_SUCCESS)
+        return nbytes_read;
+
+      if (result == SSL_READ_EARLY_DATA_FINISH)
+      {
+        is_reading_early_data_ = false;
+        if (nbytes_read == 0)
+          return std::nullopt;
+        return nbytes_read;
+      }
+
+      auto error = ssl_->error(result);
+      if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+        return blocked {};
+
+      throw std::runtime_error(
+        std::format(
+          "handshake failed: {} - {}",
+          Ssl::error_code(error),
+          Ssl::error_description(error)));
+    }
+
     void handle_client_faulted()
     {
-      if (bio_.ssl)
+      if (ssl_)
       {
-        // This stops BIO_free_all (via SSL_SHUTDOWN) from raising SIGPIPE.
-        bio_.ssl->quiet_shutdown(true);
+        // This stops a later SSL_shutdown writing to the faulted socket,
+        // and raising SIGPIPE.
+        ssl_->quiet_shutdown(true);
       }
     }
 
     bool handle_shutdown()
     {
-      if (!bio_.ssl)
+      if (!ssl_)
       {
         state_ = State::STOP;
         return true;
@@ -303,7 +651,7 @@ namespace jetblack::io
           }
 
         },
-        bio_.ssl->shutdown()
+        ssl_->shutdown()
       );
 
       if (is_done)
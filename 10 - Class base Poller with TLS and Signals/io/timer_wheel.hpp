@@ -0,0 +1,336 @@
+#ifndef SQUAWKBUS_IO_TIMER_WHEEL_HPP
+#define SQUAWKBUS_IO_TIMER_WHEEL_HPP
+
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace jetblack::io
+{
+  // A hierarchical timing wheel with a resolution of one millisecond.
+  //
+  // There are four levels of 64 slots. A timer is placed on the level given
+  // by the highest 6 bit group in which its deadline differs from the
+  // current tick, so the lowest level holds the next 64ms, the next level
+  // the next 4s, and so on up to about 4.6 hours. As time advances the slots
+  // which have been passed are emptied; their timers either expire or move
+  // down a level. Timers beyond the range of the wheel are parked on the
+  // top level and re-inserted when their slot is reached.
+  //
+  // Timers are held in a vector of nodes with a free list, and each slot is
+  // an intrusive doubly linked list, so scheduling and cancelling are O(1).
+  class TimerWheel
+  {
+  public:
+    typedef std::chrono::steady_clock clock_type;
+    typedef clock_type::time_point time_point;
+    typedef clock_type::duration duration;
+    typedef std::function<void()> callback_type;
+    // The node index in the high 32 bits and its generation in the low.
+    typedef std::uint64_t timer_id;
+
+  private:
+    static constexpr std::size_t slot_bits = 6;
+    static constexpr std::size_t slots_per_level = 1 << slot_bits;
+    static constexpr std::size_t levels = 4;
+    static constexpr std::size_t due_list = levels * slots_per_level;
+    static constexpr std::uint32_t expiring = due_list + 1;
+    static constexpr std::uint32_t nil = std::numeric_limits<std::uint32_t>::max();
+
+    struct Node
+    {
+      callback_type callback;
+      std::uint64_t deadline { 0 };
+      std::uint32_t generation { 0 };
+      std::uint32_t prev { nil };
+      std::uint32_t next { nil };
+      std::uint32_t list { nil };
+    };
+
+    time_point start_;
+    std::uint64_t now_ { 0 };
+    std::vector<Node> nodes_;
+    std::vector<std::uint32_t> free_;
+    std::array<std::uint32_t, due_list + 1> heads_;
+    std::array<std::uint64_t, levels> occupied_ {};
+    std::size_t size_ { 0 };
+    // Kept between calls to advance, so their storage is reused.
+    std::vector<std::uint32_t> pending_;
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> expired_;
+
+  public:
+    TimerWheel(time_point start = clock_type::now())
+      : start_(start)
+    {
+      heads_.fill(nil);
+    }
+
+    std::size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+
+    timer_id schedule_at(time_point when, callback_type callback)
+    {
+      auto index = allocate();
+      auto& node = nodes_[index];
+      node.callback = std::move(callback);
+      node.deadline = to_tick_ceil(when);
+      insert(index);
+      ++size_;
+      return make_id(index, node.generation);
+    }
+
+    timer_id schedule_after(duration delay, callback_type callback)
+    {
+      return schedule_at(clock_type::now() + delay, std::move(callback));
+    }
+
+    // Returns false if the timer has already fired or been cancelled.
+    bool cancel(timer_id id) noexcept
+    {
+      auto index = static_cast<std::uint32_t>(id >> 32);
+      auto generation = static_cast<std::uint32_t>(id);
+      if (index >= nodes_.size())
+        return false;
+
+      auto& node = nodes_[index];
+      if (node.generation != generation || node.list == nil)
+        return false;
+
+      if (node.list != expiring)
+        unlink(index);
+      release(index);
+      --size_;
+      return true;
+    }
+
+    // Advance the wheel to the given time, calling the callbacks of the
+    // timers which have expired. Callbacks may schedule or cancel timers,
+    // but not advance the wheel.
+    void advance(time_point now)
+    {
+      auto tick = to_tick_floor(now);
+
+      pending_.clear();
+      take_list(due_list, pending_);
+
+      if (tick > now_)
+      {
+        collect_passed_slots(tick, pending_);
+        now_ = tick;
+      }
+
+      expired_.clear();
+      for (auto index : pending_)
+      {
+        if (nodes_[index].deadline <= now_)
+        {
+          nodes_[index].list = expiring;
+          expired_.emplace_back(index, nodes_[index].generation);
+        }
+        else
+        {
+          insert(index);
+        }
+      }
+
+      for (auto [index, generation] : expired_)
+      {
+        // An earlier callback may have cancelled the timer.
+        if (nodes_[index].generation != generation)
+          continue;
+
+        nodes_[index].list = nil;
+        auto callback = std::move(nodes_[index].callback);
+        release(index);
+        --size_;
+        callback();
+      }
+    }
+
+    // The time until the wheel next needs to be advanced, in milliseconds
+    // rounded up, or -1 if there are no timers. For timers on the upper
+    // levels this is when they move down a level, which is never later than
+    // their deadline.
+    int timeout(time_point now) const noexcept
+    {
+      if (size_ == 0)
+        return -1;
+      if (heads_[due_list] != nil)
+        return 0;
+
+      auto wake = std::numeric_limits<std::uint64_t>::max();
+      for (std::size_t level = 0; level < levels; ++level)
+      {
+        if (occupied_[level] == 0)
+          continue;
+
+        auto shift = level * slot_bits;
+        auto current = (now_ >> shift) & (slots_per_level - 1);
+        // Rotate so bit 0 is the slot after the current one.
+        auto pending = std::rotr(occupied_[level], static_cast<int>(current + 1));
+        auto distance = static_cast<std::uint64_t>(std::countr_zero(pending)) + 1;
+        wake = std::min(wake, ((now_ >> shift) + distance) << shift);
+      }
+
+      auto delay = start_ + std::chrono::milliseconds(wake) - now;
+      if (delay <= duration::zero())
+        return 0;
+
+      auto milliseconds = std::chrono::ceil<std::chrono::milliseconds>(delay).count();
+      return static_cast<int>(std::min<decltype(milliseconds)>(milliseconds, std::numeric_limits<int>::max()));
+    }
+
+  private:
+    static timer_id make_id(std::uint32_t index, std::uint32_t generation) noexcept
+    {
+      return (static_cast<timer_id>(index) << 32) | generation;
+    }
+
+    std::uint64_t to_tick_floor(time_point when) const noexcept
+    {
+      if (when <= start_)
+        return 0;
+      return std::chrono::floor<std::chrono::milliseconds>(when - start_).count();
+    }
+
+    std::uint64_t to_tick_ceil(time_point when) const noexcept
+    {
+      if (when <= start_)
+        return 0;
+      return std::chrono::ceil<std::chrono::milliseconds>(when - start_).count();
+    }
+
+    std::uint32_t allocate()
+    {
+      if (free_.empty())
+      {
+        nodes_.emplace_back();
+        nodes_.back().generation = 1;
+        return static_cast<std::uint32_t>(nodes_.size() - 1);
+      }
+
+      auto index = free_.back();
+      free_.pop_back();
+      return index;
+    }
+
+    void release(std::uint32_t index) noexcept
+    {
+      auto& node = nodes_[index];
+      node.callback = nullptr;
+      node.list = nil;
+      // Zero is never used, so a timer id is never zero.
+      if (++node.generation == 0)
+        node.generation = 1;
+      free_.push_back(index);
+    }
+
+    std::size_t list_for(std::uint64_t deadline) const noexcept
+    {
+      if (deadline <= now_)
+        return due_list;
+
+      auto level = static_cast<std::size_t>(std::bit_width(deadline ^ now_) - 1) / slot_bits;
+      if (level >= levels)
+      {
+        // Beyond the wheel; park on the top level no later than the
+        // deadline, to be re-inserted when the slot is reached.
+        auto shift = (levels - 1) * slot_bits;
+        auto distance = std::min<std::uint64_t>((deadline >> shift) - (now_ >> shift), slots_per_level - 1);
+        auto slot = ((now_ >> shift) + distance) & (slots_per_level - 1);
+        return (levels - 1) * slots_per_level + slot;
+      }
+
+      auto slot = (deadline >> (level * slot_bits)) & (slots_per_level - 1);
+      return level * slots_per_level + slot;
+    }
+
+    void insert(std::uint32_t index) noexcept
+    {
+      auto list = list_for(nodes_[index].deadline);
+      auto& node = nodes_[index];
+      node.list = static_cast<std::uint32_t>(list);
+      node.prev = nil;
+      node.next = heads_[list];
+      if (node.next != nil)
+        nodes_[node.next].prev = index;
+      heads_[list] = index;
+      if (list != due_list)
+        occupied_[list / slots_per_level] |= std::uint64_t{1} << (list % slots_per_level);
+    }
+
+    void unlink(std::uint32_t index) noexcept
+    {
+      auto& node = nodes_[index];
+      if (node.prev != nil)
+        nodes_[node.prev].next = node.next;
+      else
+        heads_[node.list] = node.next;
+      if (node.next != nil)
+        nodes_[node.next].prev = node.prev;
+
+      if (node.list != due_list && heads_[node.list] == nil)
+        occupied_[node.list / slots_per_level] &= ~(std::uint64_t{1} << (node.list % slots_per_level));
+
+      node.list = nil;
+      node.prev = node.next = nil;
+    }
+
+    // Empty a list, appending its nodes.
+    void take_list(std::size_t list, std::vector<std::uint32_t>& nodes)
+    {
+      auto index = heads_[list];
+      while (index != nil)
+      {
+        auto next = nodes_[index].next;
+        nodes_[index].list = nil;
+        nodes.push_back(index);
+        index = next;
+      }
+
+      heads_[list] = nil;
+      if (list != due_list)
+        occupied_[list / slots_per_level] &= ~(std::uint64_t{1} << (list % slots_per_level));
+    }
+
+    void collect_passed_slots(std::uint64_t tick, std::vector<std::uint32_t>& pending)
+    {
+      for (std::size_t level = 0; level < levels; ++level)
+      {
+        auto shift = level * slot_bits;
+        auto passed = (tick >> shift) - (now_ >> shift);
+        if (passed == 0)
+          break; // the higher levels have not moved either.
+
+        std::uint64_t mask;
+        if (passed >= slots_per_level)
+        {
+          mask = ~std::uint64_t{0};
+        }
+        else
+        {
+          // The slots after the current one, up to and including the new one.
+          auto current = (now_ >> shift) & (slots_per_level - 1);
+          mask = std::rotl((std::uint64_t{1} << passed) - 1, static_cast<int>(current + 1));
+        }
+
+        auto slots = occupied_[level] & mask;
+        while (slots != 0)
+        {
+          auto slot = static_cast<std::size_t>(std::countr_zero(slots));
+          slots &= slots - 1;
+          take_list(level * slots_per_level + slot, pending);
+        }
+      }
+    }
+  };
+}
+
+#endif // SQUAWKBUS_IO_TIMER_WHEEL_HPP
@@ -0,0 +1,352 @@
+#ifndef SQUAWKBUS_IO_URING_HPP
+#define SQUAWKBUS_IO_URING_HPP
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+
+#define JETBLACK_IO_HAS_URING 1
+
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <system_error>
+
+// Multishot receives, and the provided buffer rings they use, came with
+// Linux 6.0.
+#ifdef IORING_RECV_MULTISHOT
+#define JETBLACK_IO_HAS_URING_RECV 1
+#endif
+
+// Sends which post no completion when they succeed came with Linux 5.17.
+#ifdef IOSQE_CQE_SKIP_SUCCESS
+#define JETBLACK_IO_HAS_URING_SEND 1
+#endif
+
+// Multishot accepts came with Linux 5.19.
+#ifdef IORING_ACCEPT_MULTISHOT
+#define JETBLACK_IO_HAS_URING_ACCEPT 1
+#endif
+
+namespace jetblack::io
+{
+  // A minimal wrapper around the io_uring system calls.
+  //
+  // The submission and completion rings are shared with the kernel. The
+  // submission queue tail and completion queue head are owned by this side,
+  // the others are owned by the kernel, so they are accessed with
+  // acquire/release semantics.
+  class Uring
+  {
+  private:
+    int fd_ { -1 };
+    io_uring_params params_ {};
+
+    void* sq_ring_ { MAP_FAILED };
+    std::size_t sq_ring_size_ { 0 };
+    void* cq_ring_ { MAP_FAILED };
+    std::size_t cq_ring_size_ { 0 };
+    io_uring_sqe* sqes_ { static_cast<io_uring_sqe*>(MAP_FAILED) };
+    std::size_t sqes_size_ { 0 };
+
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned sq_mask_;
+    unsigned* sq_array_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned cq_mask_;
+    io_uring_cqe* cqes_;
+
+  public:
+    explicit Uring(unsigned entries = 256)
+    {
+      fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params_));
+      if (fd_ == -1)
+      {
+        throw std::system_error(errno, std::generic_category(), "io_uring_setup failed");
+      }
+
+      try
+      {
+        map_rings();
+      }
+      catch (...)
+      {
+        unmap_rings();
+        ::close(fd_);
+        throw;
+      }
+    }
+    ~Uring()
+    {
+      unmap_rings();
+      ::close(fd_);
+    }
+    Uring(const Uring&) = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    int fd() const noexcept { return fd_; }
+    std::uint32_t features() const noexcept { return params_.features; }
+
+    // The number of entries queued but not yet seen by the kernel.
+    unsigned pending() const noexcept
+    {
+      return *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    }
+
+    // The position of the next entry, and of the first the kernel has not
+    // taken. An entry has been submitted once the head has passed it.
+    unsigned tail() const noexcept { return *sq_tail_; }
+    unsigned head() const noexcept { return __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE); }
+
+    io_uring_sqe* get_sqe()
+    {
+      if (pending() == params_.sq_entries)
+      {
+        // The submission queue is full; hand it to the kernel.
+        enter(0, -1);
+        if (pending() == params_.sq_entries)
+          throw std::runtime_error("io_uring submission queue is full");
+      }
+
+      unsigned tail = *sq_tail_;
+      unsigned index = tail & sq_mask_;
+      io_uring_sqe* sqe = &sqes_[index];
+      std::memset(sqe, 0, sizeof(*sqe));
+      sq_array_[index] = index;
+      __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+      return sqe;
+    }
+
+    // Submit the queued entries and wait for at least min_complete
+    // completions, or until the timeout (in milliseconds) expires. This is a
+    // single io_uring_enter call.
+    void enter(unsigned min_complete, int timeout)
+    {
+      unsigned flags = 0;
+      io_uring_getevents_arg arg {};
+      __kernel_timespec ts {};
+      void* argp = nullptr;
+      std::size_t argsz = 0;
+
+      if (min_complete > 0)
+      {
+        flags |= IORING_ENTER_GETEVENTS;
+        if (timeout >= 0)
+        {
+          ts.tv_sec = timeout / 1000;
+          ts.tv_nsec = (timeout % 1000) * 1000000L;
+          arg.ts = reinterpret_cast<std::uint64_t>(&ts);
+          flags |= IORING_ENTER_EXT_ARG;
+          argp = &arg;
+          argsz = sizeof(arg);
+        }
+      }
+
+      long result = ::syscall(
+        __NR_io_uring_enter, fd_, pending(), min_complete, flags, argp, argsz);
+      if (result < 0)
+      {
+        if (errno == EINTR || errno == ETIME || errno == EBUSY || errno == EAGAIN)
+          return; // interrupted, timed out, or the completions need reaping.
+        throw std::system_error(errno, std::generic_category(), "io_uring_enter failed");
+      }
+    }
+
+    template<typename Func>
+    unsigned for_each_cqe(Func&& func)
+    {
+      unsigned head = *cq_head_;
+      unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+      unsigned count = tail - head;
+      while (head != tail)
+      {
+        // Copy the entry so the slot can be released before the callback
+        // queues new submissions.
+        io_uring_cqe cqe = cqes_[head & cq_mask_];
+        ++head;
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        func(cqe);
+      }
+      return count;
+    }
+
+#ifdef JETBLACK_IO_HAS_URING_RECV
+    // Give the kernel a ring of buffers, which receives with the group id
+    // pick from.
+    void register_buffer_ring(io_uring_buf_ring* ring, unsigned entries, std::uint16_t group)
+    {
+      io_uring_buf_reg reg {};
+      reg.ring_addr = reinterpret_cast<std::uint64_t>(ring);
+      reg.ring_entries = entries;
+      reg.bgid = group;
+      if (::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+        throw std::system_error(errno, std::generic_category(), "failed to register io_uring buffer ring");
+    }
+
+    void unregister_buffer_ring(std::uint16_t group) noexcept
+    {
+      io_uring_buf_reg reg {};
+      reg.bgid = group;
+      ::syscall(__NR_io_uring_register, fd_, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    }
+#endif
+
+  private:
+    void map_rings()
+    {
+      sq_ring_size_ = params_.sq_off.array + params_.sq_entries * sizeof(unsigned);
+      cq_ring_size_ = params_.cq_off.cqes + params_.cq_entries * sizeof(io_uring_cqe);
+      bool is_single_mmap = (params_.features & IORING_FEAT_SINGLE_MMAP) != 0;
+      if (is_single_mmap)
+      {
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+      }
+
+      sq_ring_ = ::mmap(
+        nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        fd_, IORING_OFF_SQ_RING);
+      if (sq_ring_ == MAP_FAILED)
+        throw std::system_error(errno, std::generic_category(), "failed to map io_uring submission ring");
+
+      if (is_single_mmap)
+      {
+        cq_ring_ = sq_ring_;
+      }
+      else
+      {
+        cq_ring_ = ::mmap(
+          nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+          fd_, IORING_OFF_CQ_RING);
+        if (cq_ring_ == MAP_FAILED)
+          throw std::system_error(errno, std::generic_category(), "failed to map io_uring completion ring");
+      }
+
+      sqes_size_ = params_.sq_entries * sizeof(io_uring_sqe);
+      sqes_ = static_cast<io_uring_sqe*>(::mmap(
+        nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        fd_, IORING_OFF_SQES));
+      if (sqes_ == MAP_FAILED)
+        throw std::system_error(errno, std::generic_category(), "failed to map io_uring submission entries");
+
+      auto sq = static_cast<char*>(sq_ring_);
+      sq_head_ = reinterpret_cast<unsigned*>(sq + params_.sq_off.head);
+      sq_tail_ = reinterpret_cast<unsigned*>(sq + params_.sq_off.tail);
+      sq_mask_ = *reinterpret_cast<unsigned*>(sq + params_.sq_off.ring_mask);
+      sq_array_ = reinterpret_cast<unsigned*>(sq + params_.sq_off.array);
+
+      auto cq = static_cast<char*>(cq_ring_);
+      cq_head_ = reinterpret_cast<unsigned*>(cq + params_.cq_off.head);
+      cq_tail_ = reinterpret_cast<unsigned*>(cq + params_.cq_off.tail);
+      cq_mask_ = *reinterpret_cast<unsigned*>(cq + params_.cq_off.ring_mask);
+      cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params_.cq_off.cqes);
+    }
+
+    void unmap_rings() noexcept
+    {
+      if (sqes_ != MAP_FAILED)
+        ::munmap(sqes_, sqes_size_);
+      if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_)
+        ::munmap(cq_ring_, cq_ring_size_);
+      if (sq_ring_ != MAP_FAILED)
+        ::munmap(sq_ring_, sq_ring_size_);
+    }
+  };
+
+#ifdef JETBLACK_IO_HAS_URING_RECV
+  // A group of equal sized buffers provided to the kernel, which takes one
+  // for each receive. The completion names the buffer, and it is given back
+  // once its data has been used.
+  //
+  // The ring of buffer entries is shared with the kernel, which owns the
+  // head, so the tail is published with release semantics.
+  class UringBufferRing
+  {
+  private:
+    Uring& uring_;
+    std::uint16_t group_;
+    unsigned count_;
+    std::size_t buffer_size_;
+    io_uring_buf_ring* ring_ { static_cast<io_uring_buf_ring*>(MAP_FAILED) };
+    std::size_t ring_size_ { 0 };
+    std::unique_ptr<char[]> buffers_;
+    std::uint16_t tail_ { 0 };
+
+  public:
+    // The count must be a power of two.
+    UringBufferRing(Uring& uring, std::uint16_t group, unsigned count, std::size_t buffer_size)
+      : uring_(uring),
+        group_(group),
+        count_(count),
+        buffer_size_(buffer_size),
+        buffers_(new char[count * buffer_size])
+    {
+      ring_size_ = count * sizeof(io_uring_buf);
+      ring_ = static_cast<io_uring_buf_ring*>(::mmap(
+        nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+      if (ring_ == MAP_FAILED)
+        throw std::system_error(errno, std::generic_category(), "failed to map io_uring buffer ring");
+
+      try
+      {
+        uring_.register_buffer_ring(ring_, count_, group_);
+      }
+      catch (...)
+      {
+        ::munmap(ring_, ring_size_);
+        throw;
+      }
+
+      for (unsigned id = 0; id < count_; ++id)
+        recycle(static_cast<std::uint16_t>(id));
+      publish();
+    }
+    ~UringBufferRing()
+    {
+      uring_.unregister_buffer_ring(group_);
+      ::munmap(ring_, ring_size_);
+    }
+    UringBufferRing(const UringBufferRing&) = delete;
+    UringBufferRing& operator=(const UringBufferRing&) = delete;
+
+    std::uint16_t group() const noexcept { return group_; }
+
+    // The data the kernel put in a buffer.
+    std::span<const char> data(std::uint16_t id, std::size_t size) const noexcept
+    {
+      return std::span<const char>(buffers_.get() + id * buffer_size_, size);
+    }
+
+    // Add a buffer to the ring. The kernel sees it once it is published.
+    void recycle(std::uint16_t id) noexcept
+    {
+      // The entries start at the ring, with the tail in the first one. The
+      // header's flexible array is placed after an empty struct, which has
+      // a size in C++, so it is not used.
+      auto& buf = reinterpret_cast<io_uring_buf*>(ring_)[tail_ & (count_ - 1)];
+      buf.addr = reinterpret_cast<std::uint64_t>(buffers_.get() + id * buffer_size_);
+      buf.len = static_cast<std::uint32_t>(buffer_size_);
+      buf.bid = id;
+      ++tail_;
+    }
+
+    void publish() noexcept
+    {
+      __atomic_store_n(&ring_->tail, tail_, __ATOMIC_RELEASE);
+    }
+  };
+#endif
+}
+
+#endif // __linux__ && <linux/io_uring.h>
+
+#endif // SQUAWKBUS_IO_URING_HPP
@@ -0,0 +1,653 @@
+#ifndef SQUAWKBUS_IO_URING_MULTIPLEXER_HPP
+#define SQUAWKBUS_IO_URING_MULTIPLEXER_HPP
+
+#include "io/uring.hpp"
+
+#ifdef JETBLACK_IO_HAS_URING
+
+#include <endian.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "io/logger.hpp"
+#include "io/multiplexer.hpp"
+
+namespace jetblack::io
+{
+  // A multiplexer using io_uring.
+  //
+  // Each file descriptor has a multishot poll request which stays armed
+  // between waits. Changes to the interest are queued as submissions and
+  // handed to the kernel with the next wait, so an iteration of the event
+  // loop costs a single io_uring_enter however many registrations changed.
+  //
+  // A multishot poll posts a completion when the file becomes ready, rather
+  // than while it is ready, so handlers must consume all the available
+  // input (or output space) when they are called.
+  //
+  // Descriptors added as receivers are read by the kernel while the
+  // interest includes POLLIN, with a multishot receive into a ring of
+  // provided buffers, so no read is made for them. Their poll request
+  // leaves out POLLIN. The buffers are given back at the start of the next
+  // wait, once the poller has copied the data. When the kernel does not
+  // support it they are polled for POLLIN as usual. Listeners added as
+  // acceptors are treated in the same way, with a multishot accept.
+  //
+  // Sends are queued as submissions, and made as the next wait submits
+  // them, so a reply costs no system call of its own. They do not wait for
+  // the socket, so each is complete when the wait returns. Only a send
+  // which was short, or failed, posts a completion, so the others do not
+  // end the wait; they are known to have sent everything once the kernel
+  // has taken them. The messages and their gather list are held until
+  // then. Sends need a kernel which can skip completions (Linux 5.17).
+  class UringMultiplexer : public Multiplexer
+  {
+  private:
+    enum class Request : std::uint64_t
+    {
+      POLL = 0,
+      RECV = 1,
+      ACCEPT = 2,
+      SEND = 3
+    };
+
+    struct Interest
+    {
+      std::int16_t events;
+      std::uint32_t generation;
+      // Every request made for the registration has this generation or a
+      // later one.
+      std::uint32_t registration;
+      // The multiplexer reads the descriptor, by receiving data, or by
+      // accepting connections for a listener.
+      bool is_receiving;
+      bool is_accepting;
+      bool is_recv_armed;
+      std::uint32_t recv_generation;
+      std::size_t epoch;
+      std::size_t active_index;
+    };
+
+    // A send waiting to be made.
+    struct PendingSend
+    {
+      int fd;
+      std::uint32_t generation;
+      // The position of its submission.
+      unsigned position;
+      std::size_t size;
+      // The result posted when the send was short, or failed.
+      std::optional<long> result;
+      msghdr msg;
+      std::vector<iovec> iov;
+      std::vector<Message> messages;
+    };
+
+    // Completions for cancellations carry no interest.
+    static constexpr std::uint64_t cancel_user_data = ~std::uint64_t{0};
+
+    Uring uring_;
+    std::unordered_map<int, Interest> interests_;
+    std::uint32_t next_generation_ { 0 };
+    std::size_t epoch_ { 0 };
+    bool is_multishot_ { true };
+#ifdef JETBLACK_IO_HAS_URING_RECV
+    std::optional<UringBufferRing> buffers_;
+    std::vector<std::uint16_t> used_buffers_;
+#endif
+    bool can_receive_ { false };
+    std::vector<Received> received_;
+#ifdef JETBLACK_IO_HAS_URING_ACCEPT
+    bool can_accept_ { true };
+#else
+    bool can_accept_ { false };
+#endif
+    std::vector<Accepted> accepted_;
+    bool can_send_ { false };
+    // The sends in the order they were queued, and those finished with,
+    // kept for reuse.
+    std::vector<std::unique_ptr<PendingSend>> sends_;
+    std::vector<std::unique_ptr<PendingSend>> free_sends_;
+    bool is_sending_more_ { false };
+    std::vector<Sent> sent_;
+
+  public:
+    // The receive buffers are buffer_count buffers of buffer_size bytes,
+    // shared by the receivers. The count must be a power of two, and a
+    // count of zero disables receiving.
+    UringMultiplexer(
+      unsigned entries = 1024,
+      [[maybe_unused]] unsigned buffer_count = 256,
+      [[maybe_unused]] std::size_t buffer_size = 4096)
+      : uring_(entries)
+    {
+      if ((uring_.features() & IORING_FEAT_EXT_ARG) == 0)
+      {
+        throw std::runtime_error("io_uring does not support wait timeouts");
+      }
+
+#ifdef JETBLACK_IO_HAS_URING_SEND
+      can_send_ = (uring_.features() & IORING_FEAT_CQE_SKIP) != 0;
+#endif
+
+#ifdef JETBLACK_IO_HAS_URING_RECV
+      if (buffer_count != 0)
+      {
+        try
+        {
+          buffers_.emplace(uring_, 0, buffer_count, buffer_size);
+          can_receive_ = true;
+        }
+        catch (const std::exception& error)
+        {
+          log.debug("io_uring receives unavailable: {}", error.what());
+        }
+      }
+#endif
+    }
+
+    void add(int fd, std::int16_t events) override
+    {
+      add(fd, events, false, false);
+    }
+
+    void add_receiver(int fd, std::int16_t events) override
+    {
+      add(fd, events, can_receive_, false);
+    }
+
+    void add_acceptor(int fd, std::int16_t events) override
+    {
+      add(fd, events, can_accept_, can_accept_);
+    }
+
+    void modify(int fd, std::int16_t events) override
+    {
+      auto i = interests_.find(fd);
+      if (i == interests_.end())
+        return;
+
+      auto& interest = i->second;
+      auto previous = std::exchange(interest.events, events);
+
+      // Replace the poll request. The generation distinguishes completions
+      // from the old request which are still in flight.
+      if (poll_events(interest, events) != poll_events(interest, previous))
+      {
+        cancel(fd, interest.generation, Request::POLL);
+        interest.generation = ++next_generation_;
+        arm(fd, interest);
+      }
+
+      // Receiving stops while the handler cannot take more input. Data
+      // already received is still returned.
+      if (interest.is_receiving)
+      {
+        bool is_reading = (events & POLLIN) != 0;
+        if (is_reading && !interest.is_recv_armed)
+          arm_recv(fd, interest);
+        else if (!is_reading && interest.is_recv_armed)
+        {
+          cancel(fd, interest.recv_generation, reader(interest));
+          interest.is_recv_armed = false;
+        }
+      }
+    }
+
+    void remove(int fd) noexcept override
+    {
+      auto i = interests_.find(fd);
+      if (i == interests_.end())
+        return;
+
+      try
+      {
+        cancel_all(fd, i->second);
+      }
+      catch (const std::exception& error)
+      {
+        log.warning("failed to cancel poll for {}: {}", fd, error.what());
+      }
+      interests_.erase(i);
+    }
+
+    std::span<const Received> received() const noexcept override
+    {
+      return received_;
+    }
+
+    std::span<const Accepted> accepted() const noexcept override
+    {
+      return accepted_;
+    }
+
+    bool can_send() const noexcept override { return can_send_; }
+
+    bool send(int fd, std::span<const iovec> iov, std::span<const Message> messages) override
+    {
+      if (!can_send_ || !interests_.contains(fd))
+        return false;
+
+      std::unique_ptr<PendingSend> pending;
+      if (free_sends_.empty())
+        pending = std::make_unique<PendingSend>();
+      else
+      {
+        pending = std::move(free_sends_.back());
+        free_sends_.pop_back();
+      }
+
+      pending->fd = fd;
+      pending->generation = ++next_generation_;
+      pending->size = 0;
+      for (const auto& buf : iov)
+        pending->size += buf.iov_len;
+      pending->result = std::nullopt;
+      pending->iov.assign(iov.begin(), iov.end());
+      pending->messages.assign(messages.begin(), messages.end());
+      pending->msg = msghdr {};
+      pending->msg.msg_iov = pending->iov.data();
+      pending->msg.msg_iovlen = pending->iov.size();
+
+      io_uring_sqe* sqe = uring_.get_sqe();
+      pending->position = uring_.tail() - 1;
+      sqe->opcode = IORING_OP_SENDMSG;
+      sqe->fd = fd;
+#ifdef JETBLACK_IO_HAS_URING_SEND
+      sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+#endif
+      sqe->addr = reinterpret_cast<std::uint64_t>(&pending->msg);
+      // The send is made as it is submitted, rather than waiting for the
+      // socket to be writable. Sending less than all the data is a failure,
+      // which posts a completion.
+      sqe->msg_flags = MSG_DONTWAIT | MSG_WAITALL | MSG_NOSIGNAL;
+      sqe->user_data = make_user_data(fd, pending->generation, Request::SEND);
+
+      sends_.push_back(std::move(pending));
+      return true;
+    }
+
+    std::span<const Sent> sent() const noexcept override
+    {
+      return sent_;
+    }
+
+    void send_more() override
+    {
+      is_sending_more_ = true;
+    }
+
+    void submit() override
+    {
+      if (uring_.pending() != 0)
+        uring_.enter(0, -1);
+    }
+
+    int wait(std::vector<pollfd>& active, int timeout) override
+    {
+      active.clear();
+      received_.clear();
+      accepted_.clear();
+      sent_.clear();
+      ++epoch_;
+
+#ifdef JETBLACK_IO_HAS_URING_RECV
+      // The data from the last wait has been used.
+      if (!used_buffers_.empty())
+      {
+        for (auto id : used_buffers_)
+          buffers_->recycle(id);
+        buffers_->publish();
+        used_buffers_.clear();
+      }
+#endif
+
+      log.trace("polling");
+
+      uring_.enter(1, std::exchange(is_sending_more_, false) ? 0 : timeout);
+
+      uring_.for_each_cqe(
+        [&](const io_uring_cqe& cqe)
+        {
+          handle_completion(cqe, active);
+        });
+
+      finish_sends();
+
+      return static_cast<int>(active.size());
+    }
+
+  private:
+    // The generation is in the top half, and the descriptor, with the kind
+    // of request in its top two bits, in the bottom half.
+    static std::uint64_t make_user_data(int fd, std::uint32_t generation, Request request) noexcept
+    {
+      return
+        (static_cast<std::uint64_t>(generation) << 32) |
+        (static_cast<std::uint64_t>(request) << 30) |
+        static_cast<std::uint32_t>(fd);
+    }
+
+    // The request which reads for a receiver or acceptor.
+    static Request reader(const Interest& interest) noexcept
+    {
+      return interest.is_accepting ? Request::ACCEPT : Request::RECV;
+    }
+
+    // The events polled for. A receiver's input comes from its receive.
+    static std::int16_t poll_events(const Interest& interest, std::int16_t events) noexcept
+    {
+      return interest.is_receiving ? static_cast<std::int16_t>(events & ~POLLIN) : events;
+    }
+
+    // Completions are accepted for requests made since the registration.
+    static bool is_registered(const Interest& interest, std::uint32_t generation) noexcept
+    {
+      return static_cast<std::int32_t>(generation - interest.registration) >= 0;
+    }
+
+    void add(int fd, std::int16_t events, bool is_receiving, bool is_accepting)
+    {
+      if (auto i = interests_.find(fd); i != interests_.end())
+      {
+        // The file descriptor number has been reused.
+        cancel_all(fd, i->second);
+      }
+
+      auto generation = ++next_generation_;
+      auto& interest = interests_[fd] = Interest { events, generation, generation, is_receiving, is_accepting, false, 0, 0, 0 };
+      arm(fd, interest);
+      if (is_receiving && (events & POLLIN) != 0)
+        arm_recv(fd, interest);
+    }
+
+    static std::uint32_t to_poll32_events(std::int16_t events) noexcept
+    {
+      auto poll32_events = static_cast<std::uint32_t>(static_cast<std::uint16_t>(events));
+#if __BYTE_ORDER == __BIG_ENDIAN
+      poll32_events = (poll32_events << 16) | (poll32_events >> 16);
+#endif
+      return poll32_events;
+    }
+
+    void arm(int fd, const Interest& interest)
+    {
+      io_uring_sqe* sqe = uring_.get_sqe();
+      sqe->opcode = IORING_OP_POLL_ADD;
+      sqe->fd = fd;
+      sqe->poll32_events = to_poll32_events(poll_events(interest, interest.events));
+      sqe->len = is_multishot_ ? IORING_POLL_ADD_MULTI : 0;
+      sqe->user_data = make_user_data(fd, interest.generation, Request::POLL);
+    }
+
+    void arm_recv([[maybe_unused]] int fd, Interest& interest)
+    {
+#ifdef JETBLACK_IO_HAS_URING_ACCEPT
+      if (interest.is_accepting)
+      {
+        interest.recv_generation = ++next_generation_;
+        interest.is_recv_armed = true;
+
+        // The peer address is not asked for, as the completions would
+        // share it.
+        io_uring_sqe* sqe = uring_.get_sqe();
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = fd;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        sqe->user_data = make_user_data(fd, interest.recv_generation, Request::ACCEPT);
+        return;
+      }
+#endif
+#ifdef JETBLACK_IO_HAS_URING_RECV
+      interest.recv_generation = ++next_generation_;
+      interest.is_recv_armed = true;
+
+      io_uring_sqe* sqe = uring_.get_sqe();
+      sqe->opcode = IORING_OP_RECV;
+      sqe->fd = fd;
+      sqe->ioprio = IORING_RECV_MULTISHOT;
+      sqe->flags = IOSQE_BUFFER_SELECT;
+      sqe->buf_group = buffers_->group();
+      sqe->user_data = make_user_data(fd, interest.recv_generation, Request::RECV);
+#else
+      interest.is_receiving = false;
+#endif
+    }
+
+    void cancel(int fd, std::uint32_t generation, Request request)
+    {
+      io_uring_sqe* sqe = uring_.get_sqe();
+      sqe->opcode = request == Request::POLL ? IORING_OP_POLL_REMOVE : IORING_OP_ASYNC_CANCEL;
+      sqe->fd = -1;
+      sqe->addr = make_user_data(fd, generation, request);
+      sqe->user_data = cancel_user_data;
+    }
+
+    void cancel_all(int fd, Interest& interest)
+    {
+      cancel(fd, interest.generation, Request::POLL);
+      if (interest.is_recv_armed)
+      {
+        cancel(fd, interest.recv_generation, reader(interest));
+        interest.is_recv_armed = false;
+      }
+    }
+
+    void handle_completion(const io_uring_cqe& cqe, std::vector<pollfd>& active)
+    {
+      if (cqe.user_data == cancel_user_data)
+        return;
+
+      auto generation = static_cast<std::uint32_t>(cqe.user_data >> 32);
+      auto request = static_cast<Request>((cqe.user_data >> 30) & 3);
+      int fd = static_cast<int>(cqe.user_data & 0x3fffffff);
+
+      switch (request)
+      {
+      case Request::RECV:
+        handle_recv_completion(cqe, fd, generation);
+        return;
+      case Request::ACCEPT:
+        handle_accept_completion(cqe, fd, generation);
+        return;
+      case Request::SEND:
+        handle_send_completion(cqe, fd, generation);
+        return;
+      case Request::POLL:
+        break;
+      }
+
+      auto i = interests_.find(fd);
+      if (i == interests_.end() || i->second.generation != generation)
+        return; // a completion for a request which has been replaced.
+
+      auto& interest = i->second;
+
+      if (cqe.res < 0)
+      {
+        if (cqe.res == -EINVAL && is_multishot_)
+        {
+          // Older kernels only support single shot polls.
+          is_multishot_ = false;
+          arm(fd, interest);
+        }
+        return;
+      }
+
+      if ((cqe.flags & IORING_CQE_F_MORE) == 0)
+      {
+        // The request has terminated (or was single shot); re-arm it.
+        arm(fd, interest);
+      }
+
+      auto revents = static_cast<std::int16_t>(cqe.res);
+      if (interest.epoch == epoch_)
+      {
+        // Several completions for the same file in one wait.
+        active[interest.active_index].revents |= revents;
+        return;
+      }
+
+      interest.epoch = epoch_;
+      interest.active_index = active.size();
+      active.push_back(pollfd { fd, 0, revents });
+    }
+
+    void handle_recv_completion(
+      [[maybe_unused]] const io_uring_cqe& cqe,
+      [[maybe_unused]] int fd,
+      [[maybe_unused]] std::uint32_t generation)
+    {
+#ifdef JETBLACK_IO_HAS_URING_RECV
+      // The buffer is given back whoever it was for.
+      std::span<const char> data;
+      if ((cqe.flags & IORING_CQE_F_BUFFER) != 0)
+      {
+        auto id = static_cast<std::uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        used_buffers_.push_back(id);
+        if (cqe.res > 0)
+          data = buffers_->data(id, static_cast<std::size_t>(cqe.res));
+      }
+
+      // The data from a receive which was cancelled, as the input was
+      // full, is still wanted. A receive for an earlier registration of
+      // the descriptor is not.
+      auto i = interests_.find(fd);
+      if (i == interests_.end() || !is_registered(i->second, generation))
+        return;
+
+      auto& interest = i->second;
+      bool is_current = interest.is_recv_armed && interest.recv_generation == generation;
+
+      if (cqe.res == -EINVAL && is_current)
+      {
+        // The kernel cannot receive for the descriptor, so it is polled.
+        log.debug("io_uring receives unsupported, polling {}", fd);
+        can_receive_ = false;
+        interest.is_receiving = false;
+        interest.is_recv_armed = false;
+        cancel(fd, interest.generation, Request::POLL);
+        interest.generation = ++next_generation_;
+        arm(fd, interest);
+        return;
+      }
+
+      if (cqe.res > 0)
+        received_.push_back(Received { fd, data });
+      else if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED)
+        received_.push_back(Received { fd, {} }); // the end of the stream, or an error.
+
+      if (is_current && (cqe.flags & IORING_CQE_F_MORE) == 0)
+      {
+        // The receive has terminated. When the buffers ran out it starts
+        // again with the next wait, after they have been given back.
+        interest.is_recv_armed = false;
+        if ((cqe.res > 0 || cqe.res == -ENOBUFS) && (interest.events & POLLIN) != 0)
+          arm_recv(fd, interest);
+      }
+#endif
+    }
+
+    void handle_accept_completion(const io_uring_cqe& cqe, int fd, std::uint32_t generation)
+    {
+      // A connection accepted after the listener was removed, or its
+      // descriptor reused, is closed. One from an accept which was
+      // cancelled is still wanted.
+      auto i = interests_.find(fd);
+      if (i == interests_.end() || !is_registered(i->second, generation))
+      {
+        if (cqe.res >= 0)
+          ::close(cqe.res);
+        return;
+      }
+
+      auto& interest = i->second;
+      bool is_current = interest.is_recv_armed && interest.recv_generation == generation;
+
+      if (cqe.res == -EINVAL && is_current)
+      {
+        // The kernel cannot accept for the listener, so it is polled.
+        log.debug("io_uring accepts unsupported, polling {}", fd);
+        can_accept_ = false;
+        interest.is_receiving = false;
+        interest.is_accepting = false;
+        interest.is_recv_armed = false;
+        cancel(fd, interest.generation, Request::POLL);
+        interest.generation = ++next_generation_;
+        arm(fd, interest);
+        return;
+      }
+
+      if (cqe.res >= 0)
+        accepted_.push_back(Accepted { fd, cqe.res });
+      else if (cqe.res != -ECANCELED)
+        log.warning("failed to accept on {}: {}", fd, std::generic_category().message(-cqe.res));
+
+      if (is_current && (cqe.flags & IORING_CQE_F_MORE) == 0)
+      {
+        // The accept has terminated, as after an error.
+        interest.is_recv_armed = false;
+        if (cqe.res != -ECANCELED && (interest.events & POLLIN) != 0)
+          arm_recv(fd, interest);
+      }
+    }
+
+    // A send which was short, or failed.
+    void handle_send_completion(const io_uring_cqe& cqe, [[maybe_unused]] int fd, std::uint32_t generation)
+    {
+      for (auto& pending : sends_)
+      {
+        if (pending->generation == generation)
+        {
+          pending->result = cqe.res;
+          return;
+        }
+      }
+    }
+
+    // Return the results of the sends the kernel has taken, which sent
+    // everything unless they posted a completion, and release their data.
+    // A send for an earlier registration of the descriptor is not returned.
+    void finish_sends()
+    {
+      auto head = uring_.head();
+      std::size_t kept = 0;
+      for (std::size_t index = 0; index < sends_.size(); ++index)
+      {
+        auto& pending = sends_[index];
+        if (static_cast<std::int32_t>(head - pending->position) <= 0)
+        {
+          if (kept != index)
+            sends_[kept] = std::move(pending);
+          ++kept;
+          continue;
+        }
+
+        auto i = interests_.find(pending->fd);
+        if (i != interests_.end() && is_registered(i->second, pending->generation))
+          sent_.push_back(Sent { pending->fd, pending->result.value_or(static_cast<long>(pending->size)) });
+
+        pending->messages.clear();
+        free_sends_.push_back(std::move(pending));
+      }
+      sends_.resize(kept);
+    }
+  };
+}
+
+#endif // JETBLACK_IO_HAS_URING
+
+#endif // SQUAWKBUS_IO_URING_MULTIPLEXER_HPP
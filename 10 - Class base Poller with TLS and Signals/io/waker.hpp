@@ -0,0 +1,73 @@
+#ifndef SQUAWKBUS_IO_WAKER_HPP
+#define SQUAWKBUS_IO_WAKER_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+
+namespace jetblack::io
+{
+  // Wakes a poller from another thread. The read descriptor is watched by
+  // the poller, and becomes readable when wake is called.
+  //
+  // On Linux this is an eventfd, elsewhere it is a pipe.
+  class Waker
+  {
+  private:
+    int read_fd_ { -1 };
+    int write_fd_ { -1 };
+
+  public:
+    Waker()
+    {
+#ifdef __linux__
+      read_fd_ = write_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (read_fd_ == -1)
+        throw std::system_error(errno, std::generic_category(), "failed to create eventfd");
+#else
+      int fds[2];
+      if (::pipe(fds) == -1)
+        throw std::system_error(errno, std::generic_category(), "failed to create pipe");
+      read_fd_ = fds[0];
+      write_fd_ = fds[1];
+      for (auto fd : fds)
+      {
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+      }
+#endif
+    }
+    ~Waker()
+    {
+      ::close(read_fd_);
+      if (write_fd_ != read_fd_)
+        ::close(write_fd_);
+    }
+    Waker(const Waker&) = delete;
+    Waker& operator=(const Waker&) = delete;
+
+    int fd() const noexcept { return read_fd_; }
+
+    void wake() noexcept
+    {
+      std::uint64_t value = 1;
+      // A full pipe or counter means a wakeup is already pending.
+      [[maybe_unused]] auto result = ::write(write_fd_, &value, sizeof(value));
+    }
+
+    void drain() noexcept
+    {
+      std::uint64_t value;
+      while (::read(read_fd_, &value, sizeof(value)) > 0)
+        ;
+    }
+  };
+}
+
+#endif // SQUAWKBUS_IO_WAKER_HPP
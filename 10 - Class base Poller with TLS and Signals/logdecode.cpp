@@ -0,0 +1,231 @@
+// Render a log written by the BinaryLogHandler as text, in the format of
+// the stream handler.
+//
+//   logdecode -i server.log.bin
+//   logdecode -i server.log.bin -f "{time:%Y-%m-%d %X} {level:8} {name} {message} ({file}, {line})"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <format>
+#include <fstream>
+#include <map>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "logging/binary_format.hpp"
+#include "logging/log.hpp"
+#include "utils/utils.hpp"
+
+#include "external/popl.hpp"
+
+namespace logging = jetblack::logging;
+
+typedef std::variant<bool, char, std::int64_t, std::uint64_t, double, std::string, const void*> Value;
+
+class Reader
+{
+private:
+  std::istream& in_;
+
+public:
+  Reader(std::istream& in)
+    : in_(in)
+  {
+  }
+
+  bool read(void* data, std::size_t size)
+  {
+    return static_cast<bool>(in_.read(static_cast<char*>(data), static_cast<std::streamsize>(size)));
+  }
+
+  template<typename T>
+  T get()
+  {
+    T value;
+    if (!read(&value, sizeof(value)))
+      throw std::runtime_error("the log ends in the middle of an entry");
+    return value;
+  }
+
+  std::string get_string()
+  {
+    auto size = get<std::uint32_t>();
+    std::string value(size, '\0');
+    if (!read(value.data(), size))
+      throw std::runtime_error("the log ends in the middle of an entry");
+    return value;
+  }
+
+  Value get_value(char code)
+  {
+    switch (code)
+    {
+    case logging::binary_bool:
+      return get<char>() != 0;
+    case logging::binary_char:
+      return get<char>();
+    case logging::binary_int:
+      return get<std::int64_t>();
+    case logging::binary_uint:
+      return get<std::uint64_t>();
+    case logging::binary_double:
+      return get<double>();
+    case logging::binary_string:
+      return get_string();
+    case logging::binary_pointer:
+      return reinterpret_cast<const void*>(get<std::uint64_t>());
+    }
+    throw std::runtime_error(std::format("unknown argument code '{}'", code));
+  }
+};
+
+// Format the message from its format string and the decoded arguments, one
+// replacement field at a time, as the number of arguments is only known
+// when the log is read.
+std::string render_message(const std::string& format, const std::vector<Value>& values)
+{
+  std::string message;
+  std::size_t next = 0;
+  for (std::size_t i = 0; i < format.size(); ++i)
+  {
+    auto c = format[i];
+    if (c == '}')
+    {
+      if (i + 1 < format.size() && format[i + 1] == '}')
+        ++i;
+      message += '}';
+      continue;
+    }
+    if (c != '{')
+    {
+      message += c;
+      continue;
+    }
+    if (i + 1 < format.size() && format[i + 1] == '{')
+    {
+      message += '{';
+      ++i;
+      continue;
+    }
+
+    auto end = format.find('}', i);
+    if (end == std::string::npos)
+      throw std::runtime_error("invalid format: no closing bracket");
+    auto field = format.substr(i + 1, end - i - 1);
+    auto colon = field.find(':');
+    auto arg_id = field.substr(0, colon);
+    auto index = arg_id.empty() ? next++ : std::stoul(arg_id);
+    if (index >= values.size())
+      throw std::runtime_error("invalid format: not enough arguments");
+
+    auto field_format = colon == std::string::npos ? std::string("{}") : "{" + field.substr(colon) + "}";
+    std::visit(
+      [&](const auto& value)
+      {
+        message += std::vformat(field_format, std::make_format_args(value));
+      },
+      values[index]);
+    i = end;
+  }
+  return message;
+}
+
+int main(int argc, char** argv)
+{
+  popl::OptionParser op("options");
+  auto help_option = op.add<popl::Switch>("", "help", "produce help message");
+  auto input_option = op.add<popl::Value<std::string>>("i", "input", "path to the binary log");
+  auto format_option = op.add<popl::Value<std::string>>("f", "format", "format of each line", logging::default_format_string);
+
+  try
+  {
+    op.parse(argc, argv);
+    if (help_option->is_set() || !input_option->is_set())
+    {
+      print_line(stderr, op.help());
+      exit(1);
+    }
+
+    auto format_string = logging::make_format(format_option->value(), logging::position_map);
+
+    std::ifstream file(input_option->value(), std::ios::binary);
+    if (!file)
+      throw std::runtime_error(std::format("failed to open \"{}\"", input_option->value()));
+    Reader reader(file);
+
+    std::string magic(logging::binary_log_magic.size(), '\0');
+    if (!reader.read(magic.data(), magic.size()) || magic != logging::binary_log_magic)
+      throw std::runtime_error("not a binary log");
+
+    std::map<std::uint32_t, logging::BinaryDescriptor> descriptors;
+    char entry;
+    while (reader.read(&entry, 1))
+    {
+      auto id = reader.get<std::uint32_t>();
+
+      if (entry == logging::binary_descriptor_entry)
+      {
+        reader.get<std::uint32_t>(); // the size, for readers which skip.
+        auto& descriptor = descriptors[id];
+        descriptor.id = id;
+        descriptor.level = reader.get<std::uint8_t>();
+        descriptor.line = reader.get<std::uint32_t>();
+        descriptor.name = reader.get_string();
+        descriptor.format = reader.get_string();
+        descriptor.args = reader.get_string();
+        descriptor.file = reader.get_string();
+        descriptor.function = reader.get_string();
+        continue;
+      }
+
+      if (entry != logging::binary_record_entry)
+        throw std::runtime_error(std::format("unknown entry '{}'", entry));
+
+      auto nanoseconds = reader.get<std::int64_t>();
+      reader.get<std::uint32_t>(); // the size of the arguments.
+      auto i_descriptor = descriptors.find(id);
+      if (i_descriptor == descriptors.end())
+        throw std::runtime_error(std::format("record for unknown descriptor {}", id));
+      const auto& descriptor = i_descriptor->second;
+
+      std::vector<Value> values;
+      for (auto code : descriptor.args)
+        values.push_back(reader.get_value(code));
+
+      std::string message;
+      try
+      {
+        message = render_message(descriptor.format, values);
+      }
+      catch (const std::exception& error)
+      {
+        message = std::format("{} (failed to render: {})", descriptor.format, error.what());
+      }
+
+      auto time = std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(nanoseconds)));
+      auto level = logging::to_string(static_cast<logging::Level>(descriptor.level));
+      auto line = descriptor.line;
+      auto formatted = std::vformat(
+        format_string,
+        std::make_format_args(
+          time,
+          level,
+          descriptor.name,
+          message,
+          descriptor.function,
+          descriptor.file,
+          line));
+      fputs(formatted.c_str(), stdout);
+    }
+  }
+  catch (const std::exception& error)
+  {
+    print_line(stderr, std::format("logdecode failed: {}", error.what()));
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,321 @@
+#ifndef JETBLACK_LOGGING_ASYNC_LOG_HANDLER_HPP
+#define JETBLACK_LOGGING_ASYNC_LOG_HANDLER_HPP
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <source_location>
+#include <string>
+#include <thread>
+
+#include "logging/log.hpp"
+
+namespace jetblack::logging {
+
+  // What a thread which logs does when the queue is full.
+  enum class Overflow
+  {
+    BLOCK,  // Wait for the writer to make room.
+    DROP,   // Drop the record.
+    SAMPLE  // Keep one in sample_rate records below a warning once the
+            // queue is half full, and drop when it is full.
+  };
+
+  struct AsyncLogOptions
+  {
+    std::size_t capacity = 8192;
+    Overflow overflow = Overflow::DROP;
+    std::size_t sample_rate = 16;
+    std::chrono::milliseconds flush_interval { 10 };
+  };
+
+  // Hand records to a background thread, which emits them to another
+  // handler in batches, and flushes it after each.
+  //
+  // The records are copied into the slots of a bounded queue with many
+  // producers and a single consumer, so logging takes no lock. The slots
+  // keep their strings, so once the queue has been round a record is
+  // copied without allocating. The writer wakes every flush interval, or
+  // sooner when the queue is half full, and logs a warning with the count
+  // of any records it has lost.
+  class AsyncLogHandler : public LogHandler
+  {
+  public:
+    struct Stats
+    {
+      std::uint64_t written = 0;
+      std::uint64_t dropped = 0;
+      std::uint64_t sampled = 0;
+      std::uint64_t blocked = 0;
+      std::size_t high_water = 0;
+    };
+
+  private:
+    struct Slot
+    {
+      std::atomic<std::size_t> sequence;
+      LogRecord log_record;
+      std::string format_string;
+    };
+
+    std::shared_ptr<LogHandler> target_;
+    AsyncLogOptions options_;
+    std::size_t capacity_;
+    std::unique_ptr<Slot[]> slots_;
+
+    alignas(64) std::atomic<std::size_t> enqueue_position_ { 0 };
+    alignas(64) std::atomic<std::size_t> dequeue_position_ { 0 };
+    std::atomic<std::size_t> flushed_position_ { 0 };
+
+    std::atomic<std::uint64_t> written_ { 0 };
+    std::atomic<std::uint64_t> dropped_ { 0 };
+    std::atomic<std::uint64_t> sampled_ { 0 };
+    std::atomic<std::uint64_t> blocked_ { 0 };
+    std::atomic<std::uint64_t> offered_ { 0 };
+    std::atomic<std::size_t> high_water_ { 0 };
+
+    // Used by the writer to report lost records.
+    std::string last_format_string_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool is_stopping_ = false;
+    std::thread thread_;
+
+  public:
+    AsyncLogHandler(std::shared_ptr<LogHandler> target, AsyncLogOptions options = {})
+      : target_(std::move(target)),
+        options_(options),
+        capacity_(std::bit_ceil(options.capacity < 2 ? 2 : options.capacity)),
+        slots_(std::make_unique<Slot[]>(capacity_))
+    {
+      if (options_.sample_rate == 0)
+        options_.sample_rate = 1;
+      for (std::size_t i = 0; i < capacity_; ++i)
+        slots_[i].sequence.store(i, std::memory_order_relaxed);
+
+      thread_ = std::thread([this]() { run(); });
+    }
+    ~AsyncLogHandler() override
+    {
+      {
+        std::scoped_lock lock(mutex_);
+        is_stopping_ = true;
+      }
+      wake_.notify_one();
+      thread_.join();
+    }
+    AsyncLogHandler(const AsyncLogHandler&) = delete;
+    AsyncLogHandler& operator=(const AsyncLogHandler&) = delete;
+
+    std::size_t capacity() const noexcept { return capacity_; }
+    const AsyncLogOptions& options() const noexcept { return options_; }
+
+    std::size_t size() const noexcept
+    {
+      return enqueue_position_.load(std::memory_order_relaxed) - dequeue_position_.load(std::memory_order_relaxed);
+    }
+
+    Stats stats() const noexcept
+    {
+      return Stats {
+        .written = written_.load(std::memory_order_relaxed),
+        .dropped = dropped_.load(std::memory_order_relaxed),
+        .sampled = sampled_.load(std::memory_order_relaxed),
+        .blocked = blocked_.load(std::memory_order_relaxed),
+        .high_water = high_water_.load(std::memory_order_relaxed)
+      };
+    }
+
+    void emit(const LogRecord& log_record, const std::string& format_string) override
+    {
+      auto is_sampled =
+        options_.overflow == Overflow::SAMPLE &&
+        static_cast<int>(log_record.level) > static_cast<int>(Level::WARNING) &&
+        size() >= capacity_ / 2;
+      if (is_sampled && offered_.fetch_add(1, std::memory_order_relaxed) % options_.sample_rate != 0)
+      {
+        sampled_.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+
+      if (!try_push(log_record, format_string))
+      {
+        if (options_.overflow != Overflow::BLOCK)
+        {
+          dropped_.fetch_add(1, std::memory_order_relaxed);
+          return;
+        }
+
+        blocked_.fetch_add(1, std::memory_order_relaxed);
+        do
+        {
+          wake_.notify_one();
+          std::this_thread::yield();
+        } while (!try_push(log_record, format_string));
+      }
+
+      if (size() >= capacity_ / 2)
+        wake_.notify_one();
+    }
+
+    // Wait until the records logged before the call have been written and
+    // the handler they were written to has been flushed.
+    void flush() override
+    {
+      auto position = enqueue_position_.load(std::memory_order_acquire);
+      while (flushed_position_.load(std::memory_order_acquire) < position)
+      {
+        wake_.notify_one();
+        std::this_thread::yield();
+      }
+    }
+
+  private:
+    bool try_push(const LogRecord& log_record, const std::string& format_string)
+    {
+      auto position = enqueue_position_.load(std::memory_order_relaxed);
+      for (;;)
+      {
+        auto& slot = slots_[position & (capacity_ - 1)];
+        auto sequence = slot.sequence.load(std::memory_order_acquire);
+        auto difference = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(position);
+        if (difference < 0)
+          return false; // full.
+
+        if (difference > 0)
+        {
+          // Another thread took the slot.
+          position = enqueue_position_.load(std::memory_order_relaxed);
+          continue;
+        }
+
+        if (enqueue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+        {
+          slot.log_record = log_record;
+          slot.format_string = format_string;
+          slot.sequence.store(position + 1, std::memory_order_release);
+
+          auto used = position + 1 - dequeue_position_.load(std::memory_order_relaxed);
+          auto high_water = high_water_.load(std::memory_order_relaxed);
+          used = std::min(used, capacity_);
+          while (used > high_water && !high_water_.compare_exchange_weak(high_water, used, std::memory_order_relaxed))
+            ;
+          return true;
+        }
+      }
+    }
+
+    // Emit the waiting records, and return how many there were.
+    std::size_t drain(LogRecord& last)
+    {
+      std::size_t count = 0;
+      auto position = dequeue_position_.load(std::memory_order_relaxed);
+      for (;; ++position, ++count)
+      {
+        auto& slot = slots_[position & (capacity_ - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != position + 1)
+          break;
+
+        try
+        {
+          target_->emit(slot.log_record, slot.format_string);
+        }
+        catch (...)
+        {
+          dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+        last.name = slot.log_record.name;
+        last_format_string_ = slot.format_string;
+
+        slot.sequence.store(position + capacity_, std::memory_order_release);
+        dequeue_position_.store(position + 1, std::memory_order_release);
+      }
+      written_.fetch_add(count, std::memory_order_relaxed);
+      return count;
+    }
+
+    // Log a warning with the count of records lost since the last report,
+    // in the format of the last record written.
+    void report_lost(std::uint64_t& reported, LogRecord& last)
+    {
+      auto lost = dropped_.load(std::memory_order_relaxed) + sampled_.load(std::memory_order_relaxed);
+      if (lost == reported || last_format_string_.empty())
+        return;
+
+      last.time = std::chrono::system_clock::now();
+      last.level = Level::WARNING;
+      last.loc = std::source_location::current();
+      last.msg = std::format("dropped {} log records", lost - reported);
+      reported = lost;
+      try
+      {
+        target_->emit(last, last_format_string_);
+      }
+      catch (...)
+      {
+      }
+    }
+
+    void run()
+    {
+      // Signals are left to the threads which handle them.
+      sigset_t signals;
+      sigfillset(&signals);
+      pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+      LogRecord last;
+      std::uint64_t reported = 0;
+      for (;;)
+      {
+        auto position = enqueue_position_.load(std::memory_order_acquire);
+        auto count = drain(last);
+        report_lost(reported, last);
+        if (count != 0)
+        {
+          try
+          {
+            target_->flush();
+          }
+          catch (...)
+          {
+          }
+        }
+        // Records still being copied when the position was read are
+        // counted at the next flush.
+        if (dequeue_position_.load(std::memory_order_relaxed) >= position)
+          flushed_position_.store(position, std::memory_order_release);
+
+        std::unique_lock lock(mutex_);
+        if (is_stopping_)
+        {
+          if (size() == 0)
+            break;
+          continue;
+        }
+        if (size() < capacity_ / 2)
+          wake_.wait_for(lock, options_.flush_interval);
+      }
+
+      try
+      {
+        target_->flush();
+      }
+      catch (...)
+      {
+      }
+    }
+  };
+}
+
+#endif // JETBLACK_LOGGING_ASYNC_LOG_HANDLER_HPP
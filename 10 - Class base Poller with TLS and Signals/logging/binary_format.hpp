@@ -0,0 +1,311 @@
+#ifndef JETBLACK_LOGGING_BINARY_FORMAT_HPP
+#define JETBLACK_LOGGING_BINARY_FORMAT_HPP
+
+#include <array>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <source_location>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+namespace jetblack::logging {
+
+  // A binary log starts with the magic, followed by descriptor and record
+  // entries. A descriptor is written before the first record which uses
+  // it. Numbers are in the byte order of the machine which wrote the log.
+  //
+  //   descriptor: 'D' id:u32 size:u32 level:u8 line:u32
+  //               name format args file function, each as length:u32 bytes
+  //   record:     'R' id:u32 time:i64 size:u32 arguments
+  //
+  // The time is in nanoseconds since the epoch. The arguments are encoded
+  // in the order of the descriptor's argument codes.
+  constexpr std::string_view binary_log_magic { "JBLOG\0\0\1", 8 };
+
+  constexpr char binary_descriptor_entry = 'D';
+  constexpr char binary_record_entry = 'R';
+  constexpr std::size_t binary_record_header_size = 1 + 4 + 8 + 4;
+
+  // The argument codes.
+  constexpr char binary_bool = 'b';
+  constexpr char binary_char = 'c';
+  constexpr char binary_int = 'i';
+  constexpr char binary_uint = 'u';
+  constexpr char binary_double = 'd';
+  constexpr char binary_string = 's';
+  constexpr char binary_pointer = 'p';
+
+  template<typename T>
+  concept BinaryStringArgument =
+    std::same_as<T, std::string> ||
+    std::same_as<T, std::string_view> ||
+    std::same_as<T, const char*> ||
+    std::same_as<T, char*> ||
+    (std::is_array_v<T> && std::same_as<std::remove_cv_t<std::remove_extent_t<T>>, char>);
+
+  template<typename T>
+  concept BinaryPointerArgument =
+    std::same_as<T, const void*> ||
+    std::same_as<T, void*> ||
+    std::same_as<T, std::nullptr_t>;
+
+  // The types which are written as they are. Anything else is formatted on
+  // the calling thread, and the message is written as a string.
+  template<typename T>
+  concept BinaryArgument =
+    std::same_as<T, bool> ||
+    std::same_as<T, char> ||
+    (std::is_integral_v<T> && !std::same_as<T, wchar_t> && !std::same_as<T, char8_t> && !std::same_as<T, char16_t> && !std::same_as<T, char32_t>) ||
+    std::same_as<T, float> ||
+    std::same_as<T, double> ||
+    BinaryStringArgument<T> ||
+    BinaryPointerArgument<T>;
+
+  template<BinaryArgument T>
+  constexpr char binary_code() noexcept
+  {
+    if constexpr (std::same_as<T, bool>)
+      return binary_bool;
+    else if constexpr (std::same_as<T, char>)
+      return binary_char;
+    else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+      return binary_int;
+    else if constexpr (std::is_integral_v<T>)
+      return binary_uint;
+    else if constexpr (std::is_floating_point_v<T>)
+      return binary_double;
+    else if constexpr (BinaryStringArgument<T>)
+      return binary_string;
+    else
+      return binary_pointer;
+  }
+
+  namespace
+  {
+    template<typename T>
+    std::string_view binary_string_view(const T& value) noexcept
+    {
+      if constexpr (std::same_as<T, const char*> || std::same_as<T, char*>)
+        return value == nullptr ? std::string_view() : std::string_view(value);
+      else if constexpr (std::is_array_v<T>)
+        return std::string_view(static_cast<const char*>(value));
+      else
+        return std::string_view(value);
+    }
+
+    template<typename T>
+    std::size_t binary_size(const T& value) noexcept
+    {
+      if constexpr (std::same_as<T, bool> || std::same_as<T, char>)
+        return 1;
+      else if constexpr (BinaryStringArgument<T>)
+        return 4 + binary_string_view(value).size();
+      else
+        return 8;
+    }
+
+    template<typename T>
+    void binary_put(char*& buffer, const T& value) noexcept
+    {
+      std::memcpy(buffer, &value, sizeof(value));
+      buffer += sizeof(value);
+    }
+
+    template<typename T>
+    void binary_encode(char*& buffer, const T& value) noexcept
+    {
+      if constexpr (std::same_as<T, bool> || std::same_as<T, char>)
+        *buffer++ = static_cast<char>(value);
+      else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+        binary_put(buffer, static_cast<std::int64_t>(value));
+      else if constexpr (std::is_integral_v<T>)
+        binary_put(buffer, static_cast<std::uint64_t>(value));
+      else if constexpr (std::is_floating_point_v<T>)
+        binary_put(buffer, static_cast<double>(value));
+      else if constexpr (BinaryStringArgument<T>)
+      {
+        auto text = binary_string_view(value);
+        binary_put(buffer, static_cast<std::uint32_t>(text.size()));
+        std::memcpy(buffer, text.data(), text.size());
+        buffer += text.size();
+      }
+      else
+        binary_put(buffer, reinterpret_cast<std::uint64_t>(static_cast<const void*>(value)));
+    }
+  }
+
+  // What a call site writes: the logger, the level, the format and where
+  // the call was made.
+  struct BinaryCallSite
+  {
+    std::string_view format;
+    std::string_view name;
+    int level;
+    std::source_location loc;
+  };
+
+  struct BinaryDescriptor
+  {
+    std::uint32_t id;
+    int level;
+    std::string name;
+    std::string format;
+    std::string args;
+    std::string file;
+    std::string function;
+    std::uint32_t line;
+  };
+
+  // The descriptors of the call sites in the process. A call site is
+  // registered the first time it is logged from each thread, and after
+  // that is found in a small cache for the thread.
+  class BinaryDescriptors
+  {
+  private:
+    typedef std::tuple<const char*, const char*, std::uint32_t, std::uint32_t, int, std::string> key_type;
+
+    struct CacheEntry
+    {
+      const char* format = nullptr;
+      const char* file = nullptr;
+      std::uint32_t line = 0;
+      std::uint32_t column = 0;
+      int level = 0;
+      std::string name;
+      std::uint32_t id = 0;
+    };
+
+    std::mutex mutex_;
+    std::map<key_type, std::uint32_t> ids_;
+    std::deque<BinaryDescriptor> descriptors_;
+
+    BinaryDescriptors() = default;
+
+  public:
+    static BinaryDescriptors& instance()
+    {
+      static BinaryDescriptors descriptors;
+      return descriptors;
+    }
+
+    std::uint32_t id(const BinaryCallSite& site, std::string_view args)
+    {
+      static thread_local std::array<CacheEntry, 256> cache;
+
+      auto hash =
+        reinterpret_cast<std::uintptr_t>(site.format.data()) ^
+        (reinterpret_cast<std::uintptr_t>(site.loc.file_name()) >> 4) ^
+        (static_cast<std::uintptr_t>(site.loc.line()) * 31 + site.loc.column());
+      auto& entry = cache[(hash * 0x9e3779b97f4a7c15ull) >> 56];
+      if (
+        entry.format == site.format.data() &&
+        entry.file == site.loc.file_name() &&
+        entry.line == site.loc.line() &&
+        entry.column == site.loc.column() &&
+        entry.level == site.level &&
+        entry.name == site.name)
+      {
+        return entry.id;
+      }
+
+      auto id = add(site, args);
+      entry = CacheEntry {
+        .format = site.format.data(),
+        .file = site.loc.file_name(),
+        .line = site.loc.line(),
+        .column = site.loc.column(),
+        .level = site.level,
+        .name = std::string(site.name),
+        .id = id
+      };
+      return id;
+    }
+
+    BinaryDescriptor get(std::uint32_t id)
+    {
+      std::scoped_lock lock(mutex_);
+      return descriptors_.at(id);
+    }
+
+  private:
+    std::uint32_t add(const BinaryCallSite& site, std::string_view args)
+    {
+      auto key = key_type {
+        site.format.data(),
+        site.loc.file_name(),
+        site.loc.line(),
+        site.loc.column(),
+        site.level,
+        std::string(site.name)
+      };
+
+      std::scoped_lock lock(mutex_);
+      auto i = ids_.find(key);
+      if (i != ids_.end())
+        return i->second;
+
+      auto id = static_cast<std::uint32_t>(descriptors_.size());
+      descriptors_.push_back(BinaryDescriptor {
+        .id = id,
+        .level = site.level,
+        .name = std::string(site.name),
+        .format = std::string(site.format),
+        .args = std::string(args),
+        .file = site.loc.file_name(),
+        .function = site.loc.function_name(),
+        .line = site.loc.line()
+      });
+      ids_.emplace(std::move(key), id);
+      return id;
+    }
+  };
+
+  // Where binary records are written. A record is reserved, encoded in
+  // place, and committed, all on the calling thread. Reserve returns null
+  // when there is no room, and the record is dropped.
+  class BinarySink
+  {
+  public:
+    virtual ~BinarySink() {}
+
+    virtual char* reserve(std::size_t size) noexcept = 0;
+    virtual void commit(std::size_t size) noexcept = 0;
+  };
+
+  template<typename... Args>
+    requires (BinaryArgument<Args> && ...)
+  void write_binary(
+    BinarySink& sink,
+    const BinaryCallSite& site,
+    std::chrono::system_clock::time_point time,
+    const Args&... args)
+  {
+    static constexpr char codes[] = { binary_code<Args>()..., '\0' };
+
+    auto id = BinaryDescriptors::instance().id(site, std::string_view(codes, sizeof...(Args)));
+    auto payload_size = (binary_size(args) + ... + std::size_t { 0 });
+    auto size = binary_record_header_size + payload_size;
+
+    auto buffer = sink.reserve(size);
+    if (buffer == nullptr)
+      return;
+
+    *buffer++ = binary_record_entry;
+    binary_put(buffer, id);
+    binary_put(buffer, static_cast<std::int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count()));
+    binary_put(buffer, static_cast<std::uint32_t>(payload_size));
+    (binary_encode(buffer, args), ...);
+
+    sink.commit(size);
+  }
+}
+
+#endif // JETBLACK_LOGGING_BINARY_FORMAT_HPP
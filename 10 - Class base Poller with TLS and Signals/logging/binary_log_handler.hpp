@@ -0,0 +1,343 @@
+#ifndef JETBLACK_LOGGING_BINARY_LOG_HANDLER_HPP
+#define JETBLACK_LOGGING_BINARY_LOG_HANDLER_HPP
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "logging/binary_format.hpp"
+#include "logging/log.hpp"
+
+namespace jetblack::logging {
+
+  // Write records to a file in the binary format, to be rendered later by
+  // logdecode.
+  //
+  // A formatted call writes the descriptor id of its call site, the time,
+  // and its arguments unformatted, into a buffer belonging to the calling
+  // thread. Each buffer is a ring with a single producer, so the call takes
+  // no lock and makes no system call. A background thread moves the
+  // records from the buffers to the file every flush interval, writing each
+  // descriptor before the first record which uses it. When a thread's
+  // buffer is full its records are dropped and counted. Records from
+  // different threads are written in batches, so they are only in time
+  // order within a thread.
+  class BinaryLogHandler : public LogHandler, public BinarySink
+  {
+  public:
+    struct Stats
+    {
+      std::uint64_t written = 0;
+      std::uint64_t dropped = 0;
+      std::uint64_t bytes = 0;
+      std::size_t buffers = 0;
+    };
+
+  private:
+    // Skips the rest of the ring when a record does not fit before its end.
+    static constexpr char wrap_entry = 'W';
+
+    struct Buffer
+    {
+      std::unique_ptr<char[]> data;
+      std::size_t capacity;
+      alignas(64) std::atomic<std::uint64_t> head { 0 };
+      alignas(64) std::atomic<std::uint64_t> tail { 0 };
+      std::atomic<std::uint64_t> dropped { 0 };
+      std::atomic<bool> is_orphaned { false };
+      std::uint64_t reserved = 0; // the start of the reserved record.
+
+      Buffer(std::size_t capacity)
+        : data(std::make_unique<char[]>(capacity)),
+          capacity(capacity)
+      {
+      }
+    };
+
+    // The buffers of a thread, by the handler they belong to. The buffers
+    // are orphaned when the thread exits, and freed once they are drained.
+    struct ThreadBuffers
+    {
+      std::vector<std::pair<std::uint64_t, std::shared_ptr<Buffer>>> items;
+
+      ~ThreadBuffers()
+      {
+        for (auto& [generation, buffer] : items)
+          buffer->is_orphaned.store(true, std::memory_order_release);
+      }
+    };
+
+    static inline std::atomic<std::uint64_t> next_generation_ { 1 };
+
+    std::uint64_t generation_;
+    FILE* file_;
+    std::size_t buffer_size_;
+    std::chrono::milliseconds flush_interval_;
+
+    std::mutex buffers_mutex_;
+    std::vector<std::shared_ptr<Buffer>> buffers_;
+
+    // Held while the buffers are drained to the file.
+    std::mutex drain_mutex_;
+    std::vector<bool> is_described_;
+    std::uint64_t written_ = 0;
+    std::uint64_t bytes_ = 0;
+    std::uint64_t orphan_dropped_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool is_stopping_ = false;
+    std::thread thread_;
+
+  public:
+    BinaryLogHandler(
+      const std::string& path,
+      std::size_t buffer_size = 1024 * 1024,
+      std::chrono::milliseconds flush_interval = std::chrono::milliseconds(10))
+      : generation_(next_generation_.fetch_add(1, std::memory_order_relaxed)),
+        file_(fopen(path.c_str(), "wb")),
+        buffer_size_(std::bit_ceil(std::max<std::size_t>(buffer_size, 4096))),
+        flush_interval_(flush_interval)
+    {
+      if (file_ == nullptr)
+        throw std::system_error(errno, std::generic_category(), std::format("failed to open \"{}\"", path));
+      setvbuf(file_, nullptr, _IOFBF, 1024 * 1024);
+      fwrite(binary_log_magic.data(), 1, binary_log_magic.size(), file_);
+
+      thread_ = std::thread([this]() { run(); });
+    }
+    ~BinaryLogHandler() override
+    {
+      {
+        std::scoped_lock lock(mutex_);
+        is_stopping_ = true;
+      }
+      wake_.notify_one();
+      thread_.join();
+
+      drain();
+      fclose(file_);
+    }
+    BinaryLogHandler(const BinaryLogHandler&) = delete;
+    BinaryLogHandler& operator=(const BinaryLogHandler&) = delete;
+
+    BinarySink* binary_sink() noexcept override { return this; }
+
+    // A message which is already a string is written with its call site.
+    void emit(const LogRecord& log_record, [[maybe_unused]] const std::string& format_string) override
+    {
+      auto site = BinaryCallSite {
+        .format = "{}",
+        .name = log_record.name,
+        .level = static_cast<int>(log_record.level),
+        .loc = log_record.loc
+      };
+      write_binary(*this, site, log_record.time, log_record.msg);
+    }
+
+    // Write the records made before the call to the file.
+    void flush() override
+    {
+      drain();
+    }
+
+    Stats stats()
+    {
+      Stats stats;
+      {
+        std::scoped_lock lock(drain_mutex_);
+        stats.written = written_;
+        stats.bytes = bytes_;
+        stats.dropped = orphan_dropped_;
+      }
+      std::scoped_lock lock(buffers_mutex_);
+      for (auto& buffer : buffers_)
+        stats.dropped += buffer->dropped.load(std::memory_order_relaxed);
+      stats.buffers = buffers_.size();
+      return stats;
+    }
+
+    char* reserve(std::size_t size) noexcept override
+    {
+      auto& buffer = thread_buffer();
+      if (size > buffer.capacity)
+      {
+        buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+      }
+
+      auto head = buffer.head.load(std::memory_order_relaxed);
+      auto offset = head & (buffer.capacity - 1);
+      auto skip = buffer.capacity - offset < size ? buffer.capacity - offset : 0;
+      auto used = head - buffer.tail.load(std::memory_order_acquire);
+      if (used + skip + size > buffer.capacity)
+      {
+        buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+      }
+
+      if (skip != 0)
+      {
+        buffer.data[offset] = wrap_entry;
+        offset = 0;
+      }
+      buffer.reserved = head + skip;
+      return buffer.data.get() + offset;
+    }
+
+    void commit(std::size_t size) noexcept override
+    {
+      auto& buffer = thread_buffer();
+      buffer.head.store(buffer.reserved + size, std::memory_order_release);
+    }
+
+  private:
+    Buffer& thread_buffer()
+    {
+      static thread_local ThreadBuffers thread_buffers;
+
+      // Nearly always the first.
+      for (auto& [generation, buffer] : thread_buffers.items)
+      {
+        if (generation == generation_)
+          return *buffer;
+      }
+
+      auto buffer = std::make_shared<Buffer>(buffer_size_);
+      {
+        std::scoped_lock lock(buffers_mutex_);
+        buffers_.push_back(buffer);
+      }
+      thread_buffers.items.emplace_back(generation_, buffer);
+      return *buffer;
+    }
+
+    void describe(std::uint32_t id)
+    {
+      if (id < is_described_.size() && is_described_[id])
+        return;
+      if (id >= is_described_.size())
+        is_described_.resize(id + 1);
+      is_described_[id] = true;
+
+      auto descriptor = BinaryDescriptors::instance().get(id);
+      std::string entry;
+      auto put = [&entry](const auto& value)
+      {
+        entry.append(reinterpret_cast<const char*>(&value), sizeof(value));
+      };
+      auto put_string = [&entry, &put](const std::string& value)
+      {
+        put(static_cast<std::uint32_t>(value.size()));
+        entry += value;
+      };
+
+      put(static_cast<std::uint8_t>(descriptor.level));
+      put(descriptor.line);
+      put_string(descriptor.name);
+      put_string(descriptor.format);
+      put_string(descriptor.args);
+      put_string(descriptor.file);
+      put_string(descriptor.function);
+
+      fputc(binary_descriptor_entry, file_);
+      fwrite(&id, sizeof(id), 1, file_);
+      auto size = static_cast<std::uint32_t>(entry.size());
+      fwrite(&size, sizeof(size), 1, file_);
+      fwrite(entry.data(), 1, entry.size(), file_);
+      bytes_ += 1 + sizeof(id) + sizeof(size) + entry.size();
+    }
+
+    void drain(Buffer& buffer)
+    {
+      auto tail = buffer.tail.load(std::memory_order_relaxed);
+      auto head = buffer.head.load(std::memory_order_acquire);
+      while (tail != head)
+      {
+        auto offset = tail & (buffer.capacity - 1);
+        auto data = buffer.data.get() + offset;
+        if (*data == wrap_entry)
+        {
+          tail += buffer.capacity - offset;
+          continue;
+        }
+
+        std::uint32_t id, payload_size;
+        std::memcpy(&id, data + 1, sizeof(id));
+        std::memcpy(&payload_size, data + 1 + 4 + 8, sizeof(payload_size));
+        auto size = binary_record_header_size + payload_size;
+
+        describe(id);
+        fwrite(data, 1, size, file_);
+        ++written_;
+        bytes_ += size;
+        tail += size;
+      }
+      buffer.tail.store(tail, std::memory_order_release);
+    }
+
+    void drain()
+    {
+      std::vector<std::shared_ptr<Buffer>> buffers;
+      {
+        std::scoped_lock lock(buffers_mutex_);
+        buffers = buffers_;
+      }
+
+      std::scoped_lock lock(drain_mutex_);
+      for (auto& buffer : buffers)
+        drain(*buffer);
+      fflush(file_);
+
+      // The buffers of threads which have gone are freed once drained.
+      std::scoped_lock buffers_lock(buffers_mutex_);
+      std::erase_if(
+        buffers_,
+        [this](const std::shared_ptr<Buffer>& buffer)
+        {
+          auto is_done =
+            buffer->is_orphaned.load(std::memory_order_acquire) &&
+            buffer->tail.load(std::memory_order_relaxed) == buffer->head.load(std::memory_order_acquire);
+          if (is_done)
+            orphan_dropped_ += buffer->dropped.load(std::memory_order_relaxed);
+          return is_done;
+        });
+    }
+
+    void run()
+    {
+      // Signals are left to the threads which handle them.
+      sigset_t signals;
+      sigfillset(&signals);
+      pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+      for (;;)
+      {
+        drain();
+
+        std::unique_lock lock(mutex_);
+        if (is_stopping_)
+          break;
+        wake_.wait_for(lock, flush_interval_);
+      }
+    }
+  };
+}
+
+#endif // JETBLACK_LOGGING_BINARY_LOG_HANDLER_HPP
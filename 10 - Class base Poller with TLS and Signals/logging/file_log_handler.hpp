@@ -0,0 +1,323 @@
+#ifndef JETBLACK_LOGGING_FILE_LOG_HANDLER_HPP
+#define JETBLACK_LOGGING_FILE_LOG_HANDLER_HPP
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <format>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#include "logging/log.hpp"
+
+namespace jetblack::logging {
+
+  // When the log file is synced to the disk.
+  enum class Fsync
+  {
+    NEVER,    // Leave it to the kernel.
+    ROTATE,   // When a file is rotated or closed.
+    INTERVAL, // Every fsync_interval, and when a file is rotated or closed.
+    BATCH     // After every batch is written.
+  };
+
+  struct FileLogOptions
+  {
+    std::size_t buffer_size = 1024 * 1024;
+    std::size_t max_size = 0;              // rotate at this size, or 0 for never.
+    std::chrono::seconds max_age { 0 };    // rotate at this age, or 0 for never.
+    std::size_t max_files = 5;             // rotated files kept.
+    Fsync fsync = Fsync::ROTATE;
+    std::chrono::milliseconds fsync_interval { 1000 };
+    std::chrono::milliseconds flush_interval { 10 };
+  };
+
+  // Write records to a file, rotating it by size or age.
+  //
+  // A record is formatted on the calling thread, and appended to a buffer
+  // under a lock. A background thread swaps the buffer for a second one
+  // every flush interval, or sooner when it is half full, and writes the
+  // batch to the file with a single write, so the callers make no system
+  // calls. The file is rotated, and synced, on the background thread
+  // between batches, while the callers fill the other buffer. A caller only
+  // waits when both buffers are full. The rotated files are numbered from
+  // the newest, as in "server.log.1", and the oldest is removed.
+  class FileLogHandler : public LogHandler
+  {
+  public:
+    struct Stats
+    {
+      std::uint64_t records = 0;
+      std::uint64_t bytes = 0;
+      std::uint64_t writes = 0;
+      std::uint64_t rotations = 0;
+      std::uint64_t fsyncs = 0;
+      std::uint64_t blocked = 0;
+      std::uint64_t errors = 0;
+    };
+
+  private:
+    typedef std::chrono::steady_clock clock_type;
+
+    std::string path_;
+    FileLogOptions options_;
+
+    // Held while records are added to the buffer.
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable room_;
+    std::string buffer_;
+    std::uint64_t records_ = 0;
+    std::uint64_t blocked_ = 0;
+    bool is_stopping_ = false;
+
+    // Held while a batch is written to the file.
+    std::mutex write_mutex_;
+    std::string batch_;
+    int fd_ = -1;
+    std::size_t file_size_ = 0;
+    bool is_dirty_ = false;
+    clock_type::time_point opened_;
+    clock_type::time_point synced_;
+    std::uint64_t bytes_ = 0;
+    std::uint64_t writes_ = 0;
+    std::uint64_t rotations_ = 0;
+    std::uint64_t fsyncs_ = 0;
+    std::uint64_t errors_ = 0;
+
+    std::thread thread_;
+
+  public:
+    FileLogHandler(const std::string& path, const FileLogOptions& options = FileLogOptions {})
+      : path_(path),
+        options_(options)
+    {
+      if (!open())
+        throw std::system_error(errno, std::generic_category(), std::format("failed to open \"{}\"", path));
+      buffer_.reserve(options_.buffer_size);
+      batch_.reserve(options_.buffer_size);
+
+      thread_ = std::thread([this]() { run(); });
+    }
+    ~FileLogHandler() override
+    {
+      {
+        std::scoped_lock lock(mutex_);
+        is_stopping_ = true;
+      }
+      wake_.notify_one();
+      thread_.join();
+
+      write_pending();
+      if (fd_ != -1)
+      {
+        if (options_.fsync != Fsync::NEVER)
+          sync();
+        ::close(fd_);
+      }
+    }
+    FileLogHandler(const FileLogHandler&) = delete;
+    FileLogHandler& operator=(const FileLogHandler&) = delete;
+
+    const std::string& path() const noexcept { return path_; }
+
+    void emit(const LogRecord& log_record, const std::string& format_string) override
+    {
+      static thread_local std::string formatted;
+      formatted.clear();
+      LogFormat::compiled(format_string).format(formatted, log_record);
+
+      auto half = options_.buffer_size / 2;
+      std::unique_lock lock(mutex_);
+      if (!has_room(formatted.size()))
+      {
+        ++blocked_;
+        wake_.notify_one();
+        room_.wait(lock, [&]() { return has_room(formatted.size()); });
+      }
+
+      auto was_under_half = buffer_.size() < half;
+      buffer_ += formatted;
+      ++records_;
+      if (was_under_half && buffer_.size() >= half)
+        wake_.notify_one();
+    }
+
+    // Write the records made before the call to the file.
+    void flush() override
+    {
+      write_pending();
+    }
+
+    Stats stats()
+    {
+      Stats stats;
+      {
+        std::scoped_lock lock(mutex_);
+        stats.records = records_;
+        stats.blocked = blocked_;
+      }
+      std::scoped_lock lock(write_mutex_);
+      stats.bytes = bytes_;
+      stats.writes = writes_;
+      stats.rotations = rotations_;
+      stats.fsyncs = fsyncs_;
+      stats.errors = errors_;
+      return stats;
+    }
+
+  private:
+    // A record larger than the buffer is taken when the buffer is empty.
+    bool has_room(std::size_t size) const noexcept
+    {
+      return buffer_.empty() || buffer_.size() + size <= options_.buffer_size;
+    }
+
+    bool open()
+    {
+      fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+      if (fd_ == -1)
+        return false;
+
+      struct stat status;
+      file_size_ = ::fstat(fd_, &status) == 0 ? static_cast<std::size_t>(status.st_size) : 0;
+      opened_ = synced_ = clock_type::now();
+      return true;
+    }
+
+    std::string rotated_path(std::size_t index) const
+    {
+      return std::format("{}.{}", path_, index);
+    }
+
+    bool is_due_rotation(std::size_t size, clock_type::time_point now) const noexcept
+    {
+      if (file_size_ == 0)
+        return false;
+      if (options_.max_size != 0 && file_size_ + size > options_.max_size)
+        return true;
+      return options_.max_age.count() != 0 && now - opened_ >= options_.max_age;
+    }
+
+    void rotate()
+    {
+      if (options_.fsync != Fsync::NEVER)
+        sync();
+      ::close(fd_);
+      fd_ = -1;
+
+      // Renaming over the oldest file removes it.
+      for (auto index = options_.max_files; index > 1; --index)
+        std::rename(rotated_path(index - 1).c_str(), rotated_path(index).c_str());
+      if (options_.max_files == 0)
+        ::unlink(path_.c_str());
+      else
+        std::rename(path_.c_str(), rotated_path(1).c_str());
+
+      ++rotations_;
+      if (!open())
+        ++errors_;
+    }
+
+    void sync()
+    {
+      if (!is_dirty_)
+        return;
+      if (::fdatasync(fd_) != 0)
+        ++errors_;
+      ++fsyncs_;
+      is_dirty_ = false;
+      synced_ = clock_type::now();
+    }
+
+    void write(const std::string& batch)
+    {
+      auto now = clock_type::now();
+      if (fd_ != -1 && is_due_rotation(batch.size(), now))
+        rotate();
+      // A file which failed to open after a rotation is tried again.
+      if (fd_ == -1 && !open())
+      {
+        ++errors_;
+        return;
+      }
+
+      std::size_t offset = 0;
+      while (offset < batch.size())
+      {
+        auto written = ::write(fd_, batch.data() + offset, batch.size() - offset);
+        if (written == -1)
+        {
+          if (errno == EINTR)
+            continue;
+          ++errors_;
+          break;
+        }
+        offset += static_cast<std::size_t>(written);
+        ++writes_;
+      }
+      file_size_ += offset;
+      bytes_ += offset;
+      is_dirty_ = is_dirty_ || offset != 0;
+    }
+
+    void write_pending()
+    {
+      std::scoped_lock write_lock(write_mutex_);
+      {
+        std::scoped_lock lock(mutex_);
+        std::swap(buffer_, batch_);
+      }
+      room_.notify_all();
+
+      if (!batch_.empty())
+      {
+        write(batch_);
+        batch_.clear();
+      }
+
+      if (fd_ == -1)
+        return;
+      if (options_.fsync == Fsync::BATCH)
+        sync();
+      else if (options_.fsync == Fsync::INTERVAL && clock_type::now() - synced_ >= options_.fsync_interval)
+        sync();
+    }
+
+    void run()
+    {
+      // Signals are left to the threads which handle them.
+      sigset_t signals;
+      sigfillset(&signals);
+      pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+      auto half = options_.buffer_size / 2;
+      for (;;)
+      {
+        write_pending();
+
+        std::unique_lock lock(mutex_);
+        if (is_stopping_)
+          break;
+        wake_.wait_for(
+          lock,
+          options_.flush_interval,
+          [&]() { return is_stopping_ || buffer_.size() >= half; });
+      }
+    }
+  };
+}
+
+#endif // JETBLACK_LOGGING_FILE_LOG_HANDLER_HPP
@@ -1,16 +1,27 @@
 #ifndef JETBLACK_LOGGING_LOG_HPP
 #define JETBLACK_LOGGING_LOG_HPP
 
+#include <array>
+#include <atomic>
+#include <charconv>
 #include <chrono>
+#include <concepts>
 #include <cstdio>
 #include <cstdlib>
 #include <format>
+#include <iterator>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <source_location>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <utility>
+#include <vector>
+
+#include "logging/binary_format.hpp"
 
 namespace jetblack::logging {
 
@@ -25,6 +36,39 @@ namespace jetblack::logging {
     TRACE    = 6
   };
 
+  // Calls for levels above this are compiled out. Build with, for example,
+  // -DJETBLACK_LOGGING_COMPILED_LEVEL=4 to keep INFO and below.
+#ifndef JETBLACK_LOGGING_COMPILED_LEVEL
+#define JETBLACK_LOGGING_COMPILED_LEVEL 6
+#endif
+
+  constexpr Level compiled_level = static_cast<Level>(JETBLACK_LOGGING_COMPILED_LEVEL);
+
+  constexpr bool is_compiled(Level level) noexcept
+  {
+    return static_cast<int>(level) <= static_cast<int>(compiled_level);
+  }
+
+  // A format string checked against its arguments at compile time, with
+  // the location of the call. The location is taken here, as it cannot
+  // follow the arguments as a default.
+  template<typename... Args>
+  struct FormatString
+  {
+    std::format_string<Args...> format;
+    std::string_view text;
+    std::source_location loc;
+
+    template<typename T>
+      requires std::convertible_to<const T&, std::string_view>
+    consteval FormatString(const T& format, std::source_location loc = std::source_location::current())
+      : format(format),
+        text(format),
+        loc(loc)
+    {
+    }
+  };
+
   namespace
   {
     static const std::string root_logger_name = "root";
@@ -188,44 +232,299 @@ namespace jetblack::logging {
     std::string msg;
   };
 
+  // A position format, as made by make_format, compiled into the literal
+  // text and fields to append for each record, so it is only parsed once.
+  // The level names are rendered when the format is compiled, and the time
+  // once a second unless the format shows fractions of a second.
+  class LogFormat
+  {
+  private:
+    enum class Kind
+    {
+      LITERAL,
+      TIME,
+      LEVEL,
+      NAME,
+      MESSAGE,
+      FUNCTION,
+      FILE,
+      LINE
+    };
+
+    struct Op
+    {
+      Kind kind = Kind::LITERAL;
+      std::string text {}; // the literal, or "{:spec}" for a field with a spec.
+      std::array<std::string, 7> levels {};
+    };
+
+    // The rendered second of the last record on this thread.
+    struct TimeCache
+    {
+      std::uint64_t id = 0;
+      std::chrono::sys_seconds second;
+      std::string text;
+    };
+
+    static inline std::atomic<std::uint64_t> next_id_ { 1 };
+
+    std::uint64_t id_;
+    std::vector<Op> ops_;
+    bool has_time_ = false;
+    bool is_time_cached_ = false;
+
+  public:
+    explicit LogFormat(const std::string& position_format)
+      : id_(next_id_.fetch_add(1, std::memory_order_relaxed))
+    {
+      std::string literal;
+      for (std::size_t i = 0; i < position_format.size(); ++i)
+      {
+        auto c = position_format[i];
+        if ((c == '{' || c == '}') && i + 1 < position_format.size() && position_format[i + 1] == c)
+        {
+          literal += c;
+          ++i;
+          continue;
+        }
+        if (c != '{')
+        {
+          literal += c;
+          continue;
+        }
+
+        auto end = position_format.find('}', i);
+        if (end == std::string::npos)
+          throw std::logic_error("invalid format: no closing bracket");
+        auto field = position_format.substr(i + 1, end - i - 1);
+        auto colon = field.find(':');
+        auto spec = colon == std::string::npos ? std::string() : "{" + field.substr(colon) + "}";
+        i = end;
+
+        if (!literal.empty())
+          ops_.push_back(Op { .kind = Kind::LITERAL, .text = std::move(literal) });
+        literal.clear();
+        ops_.push_back(make_op(std::stoul(field.substr(0, colon)), std::move(spec)));
+      }
+      if (!literal.empty())
+        ops_.push_back(Op { .kind = Kind::LITERAL, .text = std::move(literal) });
+    }
+
+    // Append the record to the output.
+    void format(std::string& out, const LogRecord& log_record) const
+    {
+      for (const auto& op : ops_)
+      {
+        switch (op.kind)
+        {
+        case Kind::LITERAL:
+          out += op.text;
+          break;
+        case Kind::TIME:
+          format_time(out, op, log_record.time);
+          break;
+        case Kind::LEVEL:
+          out += op.levels[static_cast<std::size_t>(log_record.level)];
+          break;
+        case Kind::NAME:
+          append(out, op, std::string_view(log_record.name));
+          break;
+        case Kind::MESSAGE:
+          append(out, op, std::string_view(log_record.msg));
+          break;
+        case Kind::FUNCTION:
+          append(out, op, std::string_view(log_record.loc.function_name()));
+          break;
+        case Kind::FILE:
+          append(out, op, std::string_view(log_record.loc.file_name()));
+          break;
+        case Kind::LINE:
+          if (op.text.empty())
+          {
+            char digits[16];
+            auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), log_record.loc.line());
+            out.append(digits, end);
+          }
+          else
+          {
+            auto line = log_record.loc.line();
+            std::vformat_to(std::back_inserter(out), op.text, std::make_format_args(line));
+          }
+          break;
+        }
+      }
+    }
+
+    // The compiled format for a position format, from the few most recently
+    // used on this thread.
+    static const LogFormat& compiled(const std::string& position_format)
+    {
+      static thread_local std::vector<std::pair<std::string, std::unique_ptr<LogFormat>>> formats;
+
+      for (const auto& [text, log_format] : formats)
+      {
+        if (text == position_format)
+          return *log_format;
+      }
+
+      if (formats.size() == 8)
+        formats.erase(formats.begin());
+      formats.emplace_back(position_format, std::make_unique<LogFormat>(position_format));
+      return *formats.back().second;
+    }
+
+  private:
+    Op make_op(std::size_t position, std::string spec)
+    {
+      switch (position)
+      {
+      case 0:
+        // A format with two times renders them for each record.
+        is_time_cached_ = !has_time_ && !has_subseconds(spec);
+        has_time_ = true;
+        return Op { .kind = Kind::TIME, .text = spec.empty() ? "{}" : std::move(spec) };
+      case 1:
+      {
+        auto op = Op { .kind = Kind::LEVEL };
+        for (std::size_t level = 0; level < op.levels.size(); ++level)
+        {
+          auto name = to_string(static_cast<Level>(level));
+          op.levels[level] = spec.empty() ? name : std::vformat(spec, std::make_format_args(name));
+        }
+        return op;
+      }
+      case 2:
+        return Op { .kind = Kind::NAME, .text = std::move(spec) };
+      case 3:
+        return Op { .kind = Kind::MESSAGE, .text = std::move(spec) };
+      case 4:
+        return Op { .kind = Kind::FUNCTION, .text = std::move(spec) };
+      case 5:
+        return Op { .kind = Kind::FILE, .text = std::move(spec) };
+      case 6:
+        return Op { .kind = Kind::LINE, .text = std::move(spec) };
+      }
+      throw std::logic_error(std::format("invalid format: bad position {}", position));
+    }
+
+    // Seconds, and the times which include them, are shown with their
+    // fractions.
+    static bool has_subseconds(const std::string& spec) noexcept
+    {
+      if (spec.empty())
+        return true;
+      for (std::size_t i = 0; i + 1 < spec.size(); ++i)
+      {
+        if (spec[i] != '%')
+          continue;
+        auto c = spec[++i];
+        if ((c == 'E' || c == 'O') && i + 1 < spec.size())
+          c = spec[++i];
+        if (c == 'S' || c == 'T' || c == 'r')
+          return true;
+      }
+      return false;
+    }
+
+    static void append(std::string& out, const Op& op, std::string_view value)
+    {
+      if (op.text.empty())
+        out += value;
+      else
+        std::vformat_to(std::back_inserter(out), op.text, std::make_format_args(value));
+    }
+
+    void format_time(std::string& out, const Op& op, std::chrono::system_clock::time_point time) const
+    {
+      if (!is_time_cached_)
+      {
+        std::vformat_to(std::back_inserter(out), op.text, std::make_format_args(time));
+        return;
+      }
+
+      static thread_local TimeCache cache;
+      auto second = std::chrono::floor<std::chrono::seconds>(time);
+      if (cache.id != id_ || cache.second != second)
+      {
+        cache.text.clear();
+        std::vformat_to(std::back_inserter(cache.text), op.text, std::make_format_args(second));
+        cache.id = id_;
+        cache.second = second;
+      }
+      out += cache.text;
+    }
+  };
+
+  // A handler may be called by many threads at once.
   class LogHandler
   {
   public:
     virtual ~LogHandler() {}
 
     virtual void emit(const LogRecord& log_record, const std::string& format_string) = 0;
+
+    // Write out any records which have been held back.
+    virtual void flush() {}
+
+    // A handler which writes the binary format takes the arguments of a
+    // formatted call unformatted.
+    virtual BinarySink* binary_sink() noexcept { return nullptr; }
   };
 
+  // Write records to a stream. With a buffer size the records are held
+  // until the buffer is full or the handler is flushed, so this is meant to
+  // be wrapped by a handler which flushes it, like the AsyncLogHandler.
   class StreamLogHandler : public LogHandler
   {
   private:
     FILE* stream_;
+    std::size_t buffer_size_;
+    std::string buffer_;
+    std::mutex key_;
+
   public:
-    StreamLogHandler(FILE* stream = stderr)
-      : stream_(stream)
+    StreamLogHandler(FILE* stream = stderr, std::size_t buffer_size = 0)
+      : stream_(stream),
+        buffer_size_(buffer_size)
     {
+      buffer_.reserve(buffer_size);
+    }
+    ~StreamLogHandler() override
+    {
+      flush();
     }
 
     void emit(const LogRecord& log_record, const std::string& format_string) override
     {
-      auto log_level = to_string(log_record.level);
-      auto function = std::string(log_record.loc.function_name());
-      auto file = std::string(log_record.loc.file_name());
-      auto line = log_record.loc.line();
+      static thread_local std::string formatted;
+      formatted.clear();
+      LogFormat::compiled(format_string).format(formatted, log_record);
 
-      auto formatted = std::vformat(
-        format_string,
-        std::make_format_args(
-          log_record.time,
-          log_level,
-          log_record.name,
-          log_record.msg,
-          function,
-          file,
-          line));
+      std::scoped_lock lock(key_);
+      if (buffer_size_ == 0)
+      {
+        fwrite(formatted.data(), 1, formatted.size(), stream_);
+        return;
+      }
 
+      if (buffer_.size() + formatted.size() > buffer_size_)
+        write_buffer();
+      buffer_ += formatted;
+    }
 
-        fputs(formatted.c_str(), stream_);
+    void flush() override
+    {
+      std::scoped_lock lock(key_);
+      write_buffer();
+      fflush(stream_);
+    }
+
+  private:
+    void write_buffer()
+    {
+      if (!buffer_.empty())
+        fwrite(buffer_.data(), 1, buffer_.size(), stream_);
+      buffer_.clear();
     }
   };
 
@@ -236,7 +535,7 @@ namespace jetblack::logging {
     Level level_;
     std::string format_string_;
     std::shared_ptr<LogHandler> log_handler_;
-    std::mutex key_;
+    BinarySink* binary_sink_ = nullptr;
 
   public:
     Logger() {}
@@ -248,14 +547,16 @@ namespace jetblack::logging {
       : name_(name),
       level_(level),
       format_string_(make_format(format_string, position_map)),
-      log_handler_(log_handler)
+      log_handler_(log_handler),
+      binary_sink_(log_handler ? log_handler->binary_sink() : nullptr)
     {
     }
     Logger(const Logger& other)
       : name_(other.name_),
         level_(other.level_),
         format_string_(other.format_string_),
-        log_handler_(other.log_handler_)
+        log_handler_(other.log_handler_),
+        binary_sink_(other.binary_sink_)
     {
     }
     Logger& operator = (const Logger& other)
@@ -264,6 +565,7 @@ namespace jetblack::logging {
       this->level_ = other.level_;
       this->format_string_ = other.format_string_;
       this->log_handler_ = other.log_handler_;
+      this->binary_sink_ = other.binary_sink_;
       return *this;
     }
 
@@ -275,12 +577,23 @@ namespace jetblack::logging {
     const std::string& format_string() const noexcept { return format_string_; }
     void format_string(const std::string& format_string) noexcept { format_string_ = make_format(format_string, position_map); }
 
-    void log(Level level, const std::string& message, std::source_location loc)
+    // The handler should be changed before other threads log.
+    const std::shared_ptr<LogHandler>& log_handler() const noexcept { return log_handler_; }
+    void log_handler(std::shared_ptr<LogHandler> log_handler) noexcept
     {
-      if (static_cast<int>(level) <= static_cast<int>(level_))
-      {
-        std::scoped_lock lock(key_);
+      log_handler_ = std::move(log_handler);
+      binary_sink_ = log_handler_ ? log_handler_->binary_sink() : nullptr;
+    }
 
+    bool is_enabled(Level level) const noexcept
+    {
+      return is_compiled(level) && static_cast<int>(level) <= static_cast<int>(level_);
+    }
+
+    void log(Level level, std::string message, std::source_location loc)
+    {
+      if (is_enabled(level))
+      {
         auto time = std::chrono::system_clock::now();
         // auto time = std::chrono::current_zone()->to_local(std::chrono::system_clock::now());
 
@@ -290,40 +603,129 @@ namespace jetblack::logging {
           .name = name_,
           .level = level,
           .loc = loc,
-          .msg = message
+          .msg = std::move(message)
         };
         log_handler_->emit(log_record, format_string_);
       }
     }
 
+    // Log a formatted message, or hand the arguments to a binary handler.
+    template<typename... Args>
+    void log_format(Level level, const FormatString<std::type_identity_t<Args>...>& format, Args&&... args)
+    {
+      if (binary_sink_ == nullptr)
+      {
+        log(level, std::format(format.format, std::forward<Args>(args)...), format.loc);
+        return;
+      }
+
+      auto time = std::chrono::system_clock::now();
+      auto site = BinaryCallSite {
+        .format = format.text,
+        .name = name_,
+        .level = static_cast<int>(level),
+        .loc = format.loc
+      };
+      if constexpr ((BinaryArgument<std::remove_cvref_t<Args>> && ...))
+      {
+        write_binary(*binary_sink_, site, time, args...);
+      }
+      else
+      {
+        // The message is formatted here, and written as a string.
+        site.format = "{}";
+        write_binary(*binary_sink_, site, time, std::format(format.format, std::forward<Args>(args)...));
+      }
+    }
+
     void trace(std::string message, std::source_location loc = std::source_location::current())
     {
-      log(Level::TRACE, message, loc);
+      log(Level::TRACE, std::move(message), loc);
+    }
+
+    template<typename... Args>
+    void trace(FormatString<std::type_identity_t<Args>...> format, Args&&... args)
+    {
+      if constexpr (is_compiled(Level::TRACE))
+      {
+        if (is_enabled(Level::TRACE))
+          log_format(Level::TRACE, format, std::forward<Args>(args)...);
+      }
     }
     
     void debug(std::string message, std::source_location loc = std::source_location::current())
     {
-      log(Level::DEBUG, message, loc);
+      log(Level::DEBUG, std::move(message), loc);
+    }
+
+    template<typename... Args>
+    void debug(FormatString<std::type_identity_t<Args>...> format, Args&&... args)
+    {
+      if constexpr (is_compiled(Level::DEBUG))
+      {
+        if (is_enabled(Level::DEBUG))
+          log_format(Level::DEBUG, format, std::forward<Args>(args)...);
+      }
     }
     
     void info(std::string message, std::source_location loc = std::source_location::current())
     {
-      log(Level::INFO, message, loc);
+      log(Level::INFO, std::move(message), loc);
+    }
+
+    template<typename... Args>
+    void info(FormatString<std::type_identity_t<Args>...> format, Args&&... args)
+    {
+      if constexpr (is_compiled(Level::INFO))
+      {
+        if (is_enabled(Level::INFO))
+          log_format(Level::INFO, format, std::forward<Args>(args)...);
+      }
     }
     
     void warning(std::string message, std::source_location loc = std::source_location::current())
     {
-      log(Level::WARNING, message, loc);
+      log(Level::WARNING, std::move(message), loc);
+    }
+
+    template<typename... Args>
+    void warning(FormatString<std::type_identity_t<Args>...> format, Args&&... args)
+    {
+      if constexpr (is_compiled(Level::WARNING))
+      {
+        if (is_enabled(Level::WARNING))
+          log_format(Level::WARNING, format, std::forward<Args>(args)...);
+      }
     }
     
     void error(std::string message, std::source_location loc = std::source_location::current())
     {
-      log(Level::ERROR, message, loc);
+      log(Level::ERROR, std::move(message), loc);
+    }
+
+    template<typename... Args>
+    void error(FormatString<std::type_identity_t<Args>...> format, Args&&... args)
+    {
+      if constexpr (is_compiled(Level::ERROR))
+      {
+        if (is_enabled(Level::ERROR))
+          log_format(Level::ERROR, format, std::forward<Args>(args)...);
+      }
     }
     
     void critical(std::string message, std::source_location loc = std::source_location::current())
     {
-      log(Level::CRITICAL, message, loc);
+      log(Level::CRITICAL, std::move(message), loc);
+    }
+
+    template<typename... Args>
+    void critical(FormatString<std::type_identity_t<Args>...> format, Args&&... args)
+    {
+      if constexpr (is_compiled(Level::CRITICAL))
+      {
+        if (is_enabled(Level::CRITICAL))
+          log_format(Level::CRITICAL, format, std::forward<Args>(args)...);
+      }
     }
   };
 
@@ -339,12 +741,29 @@ namespace jetblack::logging {
     public:
       static Logger& get(const std::string& name = root_logger_name)
       {
-        static LogManager instance;
-        return instance.logger(name);
+        return instance().logger(name);
+      }
+
+      // Set the handler of the loggers made so far, and of those made
+      // after, which otherwise write to stderr. Their levels and formats
+      // are still taken from the environment.
+      static void log_handler(std::shared_ptr<LogHandler> log_handler)
+      {
+        auto& manager = instance();
+        for (auto& [name, logger] : manager.loggers_)
+          logger.log_handler(log_handler);
+        manager.log_handler_ = std::move(log_handler);
       }
 
     private:
       std::map<std::string, Logger> loggers_;
+      std::shared_ptr<LogHandler> log_handler_;
+
+      static LogManager& instance()
+      {
+        static LogManager instance;
+        return instance;
+      }
 
       Logger& logger(const std::string& name)
       {
@@ -353,7 +772,8 @@ namespace jetblack::logging {
         {
           auto level = env_level_or(name, Level::INFO);
           auto format_string = env_format_string_or(name, default_format_string);
-          auto logger = Logger(name, level, format_string, std::make_shared<StreamLogHandler>(stderr));
+          auto log_handler = log_handler_ ? log_handler_ : std::make_shared<StreamLogHandler>(stderr);
+          auto logger = Logger(name, level, format_string, log_handler);
           loggers_[name] = logger;
         }
         return loggers_[name];
@@ -366,6 +786,13 @@ namespace jetblack::logging {
     return LogManager::get(name);
   }
 
+  // Loggers copied from the manager, like the library's, keep the handler
+  // they were copied with.
+  inline void log_handler(std::shared_ptr<LogHandler> log_handler)
+  {
+    LogManager::log_handler(std::move(log_handler));
+  }
+
   inline Level level() noexcept
   {
     return LogManager::get().level();
@@ -378,37 +805,73 @@ namespace jetblack::logging {
   
   inline void log(Level level, std::string message, std::source_location loc = std::source_location::current())
   {
-    LogManager::get().log(level, message, loc);
+    LogManager::get().log(level, std::move(message), loc);
   }
   
   inline void trace(std::string message, std::source_location loc = std::source_location::current())
   {
-    LogManager::get().trace(message, loc);
+    LogManager::get().trace(std::move(message), loc);
+  }
+
+  template<typename... Args>
+  inline void trace(FormatString<std::type_identity_t<Args>...> format, Args&&... args)
+  {
+    LogManager::get().trace(format, std::forward<Args>(args)...);
   }
   
   inline void debug(std::string message, std::source_location loc = std::source_location::current())
   {
-    LogManager::get().debug(message, loc);
+    LogManager::get().debug(std::move(message), loc);
+  }
+
+  template<typename... Args>
+  inline void debug(FormatString<std::type_identity_t<Args>...> format, Args&&... args)
+  {
+    LogManager::get().debug(format, std::forward<Args>(args)...);
   }
   
   inline void info(std::string message, std::source_location loc = std::source_location::current())
   {
-    LogManager::get().info(message, loc);
+    LogManager::get().info(std::move(message), loc);
+  }
+
+  template<typename... Args>
+  inline void info(FormatString<std::type_identity_t<Args>...> format, Args&&... args)
+  {
+    LogManager::get().info(format, std::forward<Args>(args)...);
   }
   
   inline void warning(std::string message, std::source_location loc = std::source_location::current())
   {
-    LogManager::get().warning(message, loc);
+    LogManager::get().warning(std::move(message), loc);
+  }
+
+  template<typename... Args>
+  inline void warning(FormatString<std::type_identity_t<Args>...> format, Args&&... args)
+  {
+    LogManager::get().warning(format, std::forward<Args>(args)...);
   }
   
   inline void error(std::string message, std::source_location loc = std::source_location::current())
   {
-    LogManager::get().error(message, loc);
+    LogManager::get().error(std::move(message), loc);
+  }
+
+  template<typename... Args>
+  inline void error(FormatString<std::type_identity_t<Args>...> format, Args&&... args)
+  {
+    LogManager::get().error(format, std::forward<Args>(args)...);
   }
   
   inline void critical(std::string message, std::source_location loc = std::source_location::current())
   {
-    LogManager::get().critical(message, loc);
+    LogManager::get().critical(std::move(message), loc);
+  }
+
+  template<typename... Args>
+  inline void critical(FormatString<std::type_identity_t<Args>...> format, Args&&... args)
+  {
+    LogManager::get().critical(format, std::forward<Args>(args)...);
   }
 }
 